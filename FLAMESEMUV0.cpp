@@ -6,431 +6,8425 @@
 #include <chrono>
 #include <thread>
 #include <cmath>
+#include <cfenv>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <signal.h>
+#include <cstddef>
+#include <cstdlib>
+#include <initializer_list>
+#include <string>
+#include <cstdio>
+#include <mutex>
+#include <memory>
+#include <cctype>
+#include <poll.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <array>
+
+// The recompiler and the fastmem fault handling are x86-64 Linux only;
+// other hosts run the interpreter.
+#if defined(__x86_64__) && defined(__linux__)
+#define FLAMES_JIT 1
+#include <ucontext.h>
+#else
+#define FLAMES_JIT 0
+#endif
+
+// Allocation-checking debug build: -DFLAMES_ALLOC_CHECK=1 interposes malloc
+// (glibc only) to catch allocations on the real-time threads (AllocCheck)
+#ifndef FLAMES_ALLOC_CHECK
+#define FLAMES_ALLOC_CHECK 0
+#endif
+#if FLAMES_ALLOC_CHECK
+#include <execinfo.h>
+#endif
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 // Constants for Wii memory sizes
 const uint32_t MEM1_SIZE = 24 * 1024 * 1024;  // 24 MB
 const uint32_t MEM2_SIZE = 64 * 1024 * 1024;  // 64 MB
 
-// Memory-mapped I/O register addresses (for emulator integration)
-const uint32_t REG_VIDEO_BG_COLOR = 0x0D000000;  // Background color register (example)
-const uint32_t REG_INPUT_STATE    = 0x0D000004;  // Input state register (buttons)
-const uint32_t REG_AUDIO_FREQ     = 0x0D000008;  // Audio frequency register (tone control)
+// Locked L1 data cache half, used by games as scratchpad memory
+const uint32_t LOCKED_CACHE_BASE = 0xE0000000;
+const uint32_t LOCKED_CACHE_SIZE = 16 * 1024;  // 16 KB
 
-// Forward declarations
-class Video;
-class Audio;
-class Input;
+// Guest address space reserved for the fastmem arena (plus a guard so a
+// misaligned access at the top of the space still faults inside it)
+const uint64_t FASTMEM_ARENA_SIZE = 0x100000000ull + 0x10000;
 
-class Memory {
+// Where RAM appears in the fastmem arena: guest address, size and offset
+// into the RAM backing (MEM1, then MEM2, then the locked cache)
+struct FastmemView {
+    uint32_t address;
+    uint32_t size;
+    uint32_t offset;
+};
+const FastmemView FASTMEM_VIEWS[] = {
+    { 0x00000000, MEM1_SIZE, 0 },                    // physical
+    { 0x80000000, MEM1_SIZE, 0 },                    // cached
+    { 0xC0000000, MEM1_SIZE, 0 },                    // uncached
+    { 0x10000000, MEM2_SIZE, MEM1_SIZE },
+    { 0x90000000, MEM2_SIZE, MEM1_SIZE },
+    { 0xD0000000, MEM2_SIZE, MEM1_SIZE },
+    { LOCKED_CACHE_BASE, LOCKED_CACHE_SIZE, MEM1_SIZE + MEM2_SIZE },
+};
+
+#if FLAMES_JIT
+// Process-wide SIGSEGV dispatch. Subsystems that fault on purpose (the
+// fastmem arena) register a handler; a fault nobody claims is re-raised
+// with the previous disposition so real crashes still crash.
+class FaultHandler {
 public:
-    Memory() {
-        // Allocate and initialize MEM1 and MEM2
-        mem1.resize(MEM1_SIZE);
-        mem2.resize(MEM2_SIZE);
-        std::memset(mem1.data(), 0, MEM1_SIZE);
-        std::memset(mem2.data(), 0, MEM2_SIZE);
-        // Initialize I/O register values
-        videoBgColor = 0x00000000;  // default black background
-        audioFreqValue = 0;
-        video = nullptr;
-        audio = nullptr;
-        input = nullptr;
+    typedef bool (*Handler)(void* userdata, siginfo_t* info, ucontext_t* context);
+
+    static bool add(Handler handler, void* userdata) {
+        install();
+        for (Entry& e : entries) {
+            bool expected = false;
+            if (e.claimed.compare_exchange_strong(expected, true)) {
+                e.registration = {handler, userdata};
+                e.active.store(&e.registration);
+                return true;
+            }
+        }
+        SDL_Log("Too many fault handlers registered");
+        return false;
     }
 
-    // Connect hardware components for I/O callbacks
-    void connectVideo(Video* v)   { video = v; }
-    void connectAudio(Audio* a)   { audio = a; }
-    void connectInput(Input* i)   { input = i; }
+    static void remove(void* userdata) {
+        for (Entry& e : entries) {
+            const Registration* r = e.active.load();
+            if (r && r->userdata == userdata) {
+                e.active.store(nullptr);
+                e.claimed.store(false);
+            }
+        }
+    }
 
-    // Read 32-bit word from memory or I/O (PowerPC is big-endian)
-    uint32_t read32(uint32_t address) {
-        // Translate address to physical region (MEM1, MEM2 or I/O)
-        if ((address >= 0x80000000 && address < 0x80000000 + MEM1_SIZE) || 
-            (address >= 0xC0000000 && address < 0xC0000000 + MEM1_SIZE)) {
-            // MEM1 (24MB)
-            uint32_t offset = address & (MEM1_SIZE - 1);  // mask to 24MB
-            if (offset + 3 < MEM1_SIZE) {
-                // Combine 4 bytes in big-endian order
-                uint32_t b0 = mem1[offset];
-                uint32_t b1 = mem1[offset + 1];
-                uint32_t b2 = mem1[offset + 2];
-                uint32_t b3 = mem1[offset + 3];
-                return (b0 << 24) | (b1 << 16) | (b2 << 8) | b3;
-            }
-            SDL_Log("MEM1 read out of range: 0x%08X", address);
-            return 0;
-        } else if ((address >= 0x90000000 && address < 0x90000000 + MEM2_SIZE) || 
-                   (address >= 0xD0000000 && address < 0xD0000000 + MEM2_SIZE)) {
-            // MEM2 (64MB)
-            uint32_t offset = address & (MEM2_SIZE - 1);
-            if (offset + 3 < MEM2_SIZE) {
-                uint32_t b0 = mem2[offset];
-                uint32_t b1 = mem2[offset + 1];
-                uint32_t b2 = mem2[offset + 2];
-                uint32_t b3 = mem2[offset + 3];
-                return (b0 << 24) | (b1 << 16) | (b2 << 8) | b3;
-            }
-            SDL_Log("MEM2 read out of range: 0x%08X", address);
-            return 0;
-        } else {
-            // I/O or other regions
-            if (address == REG_VIDEO_BG_COLOR) {
-                return videoBgColor;
-            } else if (address == REG_INPUT_STATE) {
-                return input ? input->getButtonState() : 0;
-            } else if (address == REG_AUDIO_FREQ) {
-                return audioFreqValue;
+private:
+    struct Registration {
+        Handler handler;
+        void* userdata;
+    };
+
+    // The handler and its userdata are filled in while the entry is
+    // unpublished, then published together by the one store to 'active',
+    // so a fault on another thread sees both or neither
+    struct Entry {
+        Registration registration;
+        std::atomic<const Registration*> active;
+        std::atomic<bool> claimed;  // slot taken, possibly not yet published
+    };
+
+    static void install() {
+        static bool installed = false;
+        if (installed) return;
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = onSignal;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGSEGV, &sa, &previous);
+        installed = true;
+    }
+
+    static void onSignal(int sig, siginfo_t* info, void* context) {
+        for (Entry& e : entries) {
+            const Registration* r = e.active.load();
+            if (r && r->handler(r->userdata, info, static_cast<ucontext_t*>(context))) return;
+        }
+        // Not ours: restore the previous handler and let the access fault again
+        sigaction(sig, &previous, nullptr);
+    }
+
+    static inline Entry entries[8];
+    static inline struct sigaction previous;
+};
+#endif
+
+// Heap accounting. The global operator new is replaced so each thread
+// counts the allocations it makes; the frame loop uses this to check that
+// steady-state frames do not touch the general heap (see FrameArena).
+class HeapStats {
+public:
+    struct Counts {
+        uint64_t allocations;
+        uint64_t bytes;
+    };
+
+    // Allocations made by the calling thread so far
+    static Counts current() { return {allocations, bytes}; }
+
+    static void record(size_t size) {
+        allocations++;
+        bytes += size;
+    }
+
+private:
+    static inline thread_local uint64_t allocations = 0;
+    static inline thread_local uint64_t bytes = 0;
+};
+
+void* operator new(size_t size) {
+    HeapStats::record(size);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    HeapStats::record(size);
+    size_t alignment = std::max(size_t(align), sizeof(void*));
+    void* p = nullptr;
+    if (posix_memalign(&p, alignment, size ? size : 1) == 0) return p;
+    throw std::bad_alloc();
+}
+
+// Out of line, or GCC pairs the inlined free() with new-expressions and
+// warns about mismatched deallocation
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+// Trace events. Names and argument labels are what the trace viewer shows.
+enum TraceEvent : uint16_t {
+    TRACE_FRAME,
+    TRACE_FRAME_INPUT,
+    TRACE_FRAME_CPU,
+    TRACE_FRAME_DEMO,
+    TRACE_FRAME_PACING,
+    TRACE_VIDEO_RENDER,
+    TRACE_AUDIO_CALLBACK,
+    TRACE_MMIO_WRITE,
+    TRACE_CPU_SLICE,
+    NUM_TRACE_EVENTS
+};
+
+struct TraceEventInfo {
+    const char* name;
+    const char* category;
+    const char* arg0;  // nullptr if unused
+    const char* arg1;
+};
+
+static const TraceEventInfo TRACE_EVENT_INFO[NUM_TRACE_EVENTS] = {
+    { "Frame",          "frame", "frame",   nullptr },
+    { "Input",          "frame", nullptr,   nullptr },
+    { "CPU",            "frame", nullptr,   nullptr },
+    { "Demo",           "frame", nullptr,   nullptr },
+    { "Frame pacing",   "frame", nullptr,   nullptr },
+    { "Video::render",  "video", nullptr,   nullptr },
+    { "Audio callback", "audio", "samples", nullptr },
+    { "MMIO write",     "mmio",  "address", "value" },
+    { "CPU slice",      "cpu",   "cycles",  nullptr },
+};
+
+// Low-overhead tracer. Each thread records into its own fixed-size ring
+// buffer (oldest events are overwritten), so recording never locks. The
+// buffers are written as Chrome trace-event JSON at shutdown, viewable in
+// chrome://tracing or Perfetto. Disabled tracing costs one relaxed load.
+class Tracer {
+public:
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    static void enable(const char* path) {
+        outputPath = path;
+        epoch = std::chrono::steady_clock::now();
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    static uint64_t now() {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch).count());
+    }
+
+    // Record a span that started at 'start' and ends now
+    static void complete(TraceEvent id, uint64_t start, uint32_t arg0 = 0, uint32_t arg1 = 0) {
+        uint64_t end = now();
+        record({start, end - start, arg0, arg1, id, 'X'});
+    }
+
+    static void instant(TraceEvent id, uint32_t arg0 = 0, uint32_t arg1 = 0) {
+        if (!isEnabled()) return;
+        record({now(), 0, arg0, arg1, id, 'i'});
+    }
+
+    // Label the calling thread in the trace
+    static void setThreadName(const char* name) {
+        if (!isEnabled()) return;
+        getBuffer()->name = name;
+    }
+
+    // Write every thread's events and stop recording. Recording threads
+    // must be stopped first.
+    static bool write() {
+        if (!isEnabled()) return true;
+        enabled.store(false, std::memory_order_relaxed);
+        FILE* f = std::fopen(outputPath, "w");
+        if (!f) {
+            SDL_Log("Failed to open trace file %s: %s", outputPath, std::strerror(errno));
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(buffersLock);
+        std::fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        size_t total = 0;
+        for (size_t t = 0; t < buffers.size(); t++) {
+            const Buffer& b = *buffers[t];
+            std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+                            "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", t + 1, b.name);
+            first = false;
+            uint64_t count = std::min<uint64_t>(b.head, BUFFER_EVENTS);
+            for (uint64_t i = b.head - count; i < b.head; i++) {
+                const Record& r = b.records[i & (BUFFER_EVENTS - 1)];
+                const TraceEventInfo& info = TRACE_EVENT_INFO[r.id];
+                std::fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%zu,"
+                                "\"ts\":%.3f", info.name, info.category, r.phase, t + 1, r.start / 1000.0);
+                if (r.phase == 'X') std::fprintf(f, ",\"dur\":%.3f", r.duration / 1000.0);
+                else                std::fprintf(f, ",\"s\":\"t\"");
+                if (info.arg0) {
+                    std::fprintf(f, ",\"args\":{\"%s\":%u", info.arg0, r.arg0);
+                    if (info.arg1) std::fprintf(f, ",\"%s\":%u", info.arg1, r.arg1);
+                    std::fprintf(f, "}");
+                }
+                std::fprintf(f, "}");
             }
-            SDL_Log("Unhandled read from address 0x%08X", address);
-            return 0;
+            total += count;
         }
+        std::fprintf(f, "\n]}\n");
+        std::fclose(f);
+        SDL_Log("Wrote %zu trace events from %zu threads to %s", total, buffers.size(), outputPath);
+        return true;
     }
 
-    // Write 32-bit word to memory or I/O (big-endian format)
-    void write32(uint32_t address, uint32_t value) {
-        if ((address >= 0x80000000 && address < 0x80000000 + MEM1_SIZE) || 
-            (address >= 0xC0000000 && address < 0xC0000000 + MEM1_SIZE)) {
-            // MEM1 write
-            uint32_t offset = address & (MEM1_SIZE - 1);
-            if (offset + 3 < MEM1_SIZE) {
-                // Split value into bytes (big-endian)
-                mem1[offset]     = (value >> 24) & 0xFF;
-                mem1[offset + 1] = (value >> 16) & 0xFF;
-                mem1[offset + 2] = (value >> 8) & 0xFF;
-                mem1[offset + 3] = value & 0xFF;
-            } else {
-                SDL_Log("MEM1 write out of range: 0x%08X", address);
-            }
-        } else if ((address >= 0x90000000 && address < 0x90000000 + MEM2_SIZE) || 
-                   (address >= 0xD0000000 && address < 0xD0000000 + MEM2_SIZE)) {
-            // MEM2 write
-            uint32_t offset = address & (MEM2_SIZE - 1);
-            if (offset + 3 < MEM2_SIZE) {
-                mem2[offset]     = (value >> 24) & 0xFF;
-                mem2[offset + 1] = (value >> 16) & 0xFF;
-                mem2[offset + 2] = (value >> 8) & 0xFF;
-                mem2[offset + 3] = value & 0xFF;
-            } else {
-                SDL_Log("MEM2 write out of range: 0x%08X", address);
+private:
+    static const uint64_t BUFFER_EVENTS = 1 << 16;  // per thread, power of two
+
+    struct Record {
+        uint64_t start;     // ns since enable()
+        uint64_t duration;
+        uint32_t arg0;
+        uint32_t arg1;
+        uint16_t id;
+        char phase;         // Chrome phase: 'X' complete, 'i' instant
+    };
+
+    struct Buffer {
+        const char* name = "thread";
+        uint64_t head = 0;  // total records written
+        Record records[BUFFER_EVENTS];
+    };
+
+    static Buffer* getBuffer() {
+        thread_local Buffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(buffersLock);
+            buffers.emplace_back(new Buffer);
+            buffer = buffers.back().get();
+        }
+        return buffer;
+    }
+
+    static void record(const Record& r) {
+        Buffer* b = getBuffer();
+        b->records[b->head & (BUFFER_EVENTS - 1)] = r;
+        b->head++;
+    }
+
+    static inline std::atomic<bool> enabled{false};
+    static inline const char* outputPath = nullptr;
+    static inline std::chrono::steady_clock::time_point epoch;
+    static inline std::mutex buffersLock;
+    static inline std::vector<std::unique_ptr<Buffer>> buffers;  // kept until write()
+};
+
+// Records the enclosing scope as one complete event
+class TraceScope {
+public:
+    explicit TraceScope(TraceEvent event, uint32_t arg0 = 0, uint32_t arg1 = 0)
+        : id(event), a0(arg0), a1(arg1), active(Tracer::isEnabled()), start(active ? Tracer::now() : 0) {}
+    ~TraceScope() {
+        if (active) Tracer::complete(id, start, a0, a1);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    TraceEvent id;
+    uint32_t a0, a1;
+    bool active;
+    uint64_t start;
+};
+
+// The emulator's threads by job. The main thread runs the CPU and renders.
+enum ThreadRole {
+    THREAD_MAIN,
+    THREAD_AUDIO,      // SDL audio callback
+    THREAD_PROFILER,   // GuestProfiler sampler
+    THREAD_WORKER,     // JobSystem workers
+    NUM_THREAD_ROLES
+};
+
+// Placement and accounting for the emulator's threads. Each thread calls
+// enter() with its role when it starts, which names it for profilers and
+// the trace, pins it to the role's cores (--pin) and applies the role's
+// scheduling priority (--priority). report() gives each thread's CPU time
+// and context switches; involuntary switches are preemptions.
+class ThreadRoles {
+public:
+    enum Priority { PRIORITY_NORMAL, PRIORITY_HIGH, PRIORITY_REALTIME };
+
+    // "role=cpus", with cpus a list such as 2 or 0-3,6
+    static bool parseAffinity(const char* spec) {
+        const char* cpus;
+        int role = parseRole(spec, cpus);
+        if (role < 0) return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        const char* p = cpus;
+        while (true) {
+            char* end;
+            unsigned long first = std::strtoul(p, &end, 10), last = first;
+            if (end == p) break;
+            if (*end == '-') {
+                p = end + 1;
+                last = std::strtoul(p, &end, 10);
+                if (end == p) break;
             }
-        } else {
-            // I/O register write
-            if (address == REG_VIDEO_BG_COLOR) {
-                videoBgColor = value;
-                if (video) video->setBackgroundColor(value);
-            } else if (address == REG_INPUT_STATE) {
-                SDL_Log("Ignoring write to input state register");
-            } else if (address == REG_AUDIO_FREQ) {
-                audioFreqValue = value;
-                if (audio) audio->setToneFrequency((double)value);
+            for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &set);
+            if (*end == '\0' && CPU_COUNT(&set) > 0) {
+                config[role].cpus = set;
+                config[role].pinned = true;
+                return true;
+            }
+            if (*end != ',') break;
+            p = end + 1;
+        }
+        SDL_Log("Invalid CPU list in --pin %s", spec);
+        return false;
+    }
+
+    // "role=normal|high|realtime"
+    static bool parsePriority(const char* spec) {
+        const char* level;
+        int role = parseRole(spec, level);
+        if (role < 0) return false;
+        if (std::strcmp(level, "normal") == 0)        config[role].priority = PRIORITY_NORMAL;
+        else if (std::strcmp(level, "high") == 0)     config[role].priority = PRIORITY_HIGH;
+        else if (std::strcmp(level, "realtime") == 0) config[role].priority = PRIORITY_REALTIME;
+        else {
+            SDL_Log("Invalid priority in --priority %s (normal, high or realtime)", spec);
+            return false;
+        }
+        return true;
+    }
+
+    // Set up the calling thread for 'role'. After the first call it only
+    // tests a thread-local flag, so callbacks on threads the emulator does
+    // not create (audio) can call it every time.
+    static void enter(ThreadRole role) {
+        if (entered) return;
+        entered = true;
+        static const int atfork = pthread_atfork(nullptr, nullptr, [] { entered = false; });
+        (void)atfork;
+        pid_t tid = pid_t(syscall(SYS_gettid));
+
+        const RoleConfig& c = config[role];
+        char name[16];
+        std::snprintf(name, sizeof(name), "flames-%s", ROLE_NAMES[role]);
+        pthread_setname_np(pthread_self(), name);
+        Tracer::setThreadName(ROLE_NAMES[role]);
+        if (c.pinned) {
+            int error = pthread_setaffinity_np(pthread_self(), sizeof(c.cpus), &c.cpus);
+            if (error) SDL_Log("Could not pin %s thread: %s", ROLE_NAMES[role], std::strerror(error));
+        }
+        applyPriority(role, tid);
+
+        std::lock_guard<std::mutex> lock(threadsLock);
+        threads.push_back({role, tid, false, 0, 0, 0});
+    }
+
+    // Record the calling thread's usage before it exits
+    static void leave() {
+        rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) != 0) return;
+        pid_t tid = pid_t(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(threadsLock);
+        for (Thread& t : threads) {
+            if (t.tid != tid || t.exited) continue;
+            t.exited = true;
+            t.cpuMs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+                      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+            t.voluntary = uint64_t(usage.ru_nvcsw);
+            t.involuntary = uint64_t(usage.ru_nivcsw);
+        }
+    }
+
+    // Log every thread's usage, and write it as a JSON array to 'json' if
+    // given. Threads that ended without leave() are left out.
+    static void report(FILE* json = nullptr) {
+        std::lock_guard<std::mutex> lock(threadsLock);
+        bool first = true;
+        if (json) std::fprintf(json, "[");
+        for (Thread& t : threads) {
+            if (!t.exited && !readUsage(t)) continue;
+            if (json) {
+                std::fprintf(json, "%s{\"role\": \"%s\", \"tid\": %d, \"cpu_ms\": %.1f, "
+                                   "\"involuntary_switches\": %llu, \"voluntary_switches\": %llu}",
+                             first ? "" : ", ", ROLE_NAMES[t.role], int(t.tid), t.cpuMs,
+                             (unsigned long long)t.involuntary, (unsigned long long)t.voluntary);
             } else {
-                SDL_Log("Unhandled write to address 0x%08X: value 0x%08X", address, value);
+                SDL_Log("Thread %-8s (tid %d): %.1f ms CPU, %llu involuntary / %llu voluntary context switches",
+                        ROLE_NAMES[t.role], int(t.tid), t.cpuMs,
+                        (unsigned long long)t.involuntary, (unsigned long long)t.voluntary);
             }
+            first = false;
         }
+        if (json) std::fprintf(json, "]");
     }
 
+    static const char* getName(ThreadRole role) { return ROLE_NAMES[role]; }
+
 private:
-    std::vector<uint8_t> mem1;
-    std::vector<uint8_t> mem2;
-    Video*  video;
-    Audio*  audio;
-    Input*  input;
-    uint32_t videoBgColor;
-    uint32_t audioFreqValue;
+    static constexpr const char* ROLE_NAMES[NUM_THREAD_ROLES] = { "main", "audio", "profiler", "worker" };
+
+    struct RoleConfig {
+        bool pinned;
+        cpu_set_t cpus;
+        Priority priority;
+    };
+
+    struct Thread {
+        ThreadRole role;
+        pid_t tid;
+        bool exited;   // usage below is final
+        double cpuMs;
+        uint64_t voluntary;
+        uint64_t involuntary;
+    };
+
+    // Split "role=value"; returns the role or -1
+    static int parseRole(const char* spec, const char*& value) {
+        const char* eq = std::strchr(spec, '=');
+        if (eq) {
+            for (int role = 0; role < NUM_THREAD_ROLES; role++) {
+                if (std::strncmp(spec, ROLE_NAMES[role], size_t(eq - spec)) == 0 &&
+                    ROLE_NAMES[role][eq - spec] == '\0') {
+                    value = eq + 1;
+                    return role;
+                }
+            }
+        }
+        SDL_Log("Expected role=value with role main, audio, profiler or worker: %s", spec);
+        return -1;
+    }
+
+    // Realtime falls back to high, and high to normal, when the process
+    // lacks the privilege (CAP_SYS_NICE or RLIMIT_RTPRIO / RLIMIT_NICE)
+    static void applyPriority(ThreadRole role, pid_t tid) {
+        Priority priority = config[role].priority;
+        if (priority == PRIORITY_REALTIME) {
+            sched_param param;
+            param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+            int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (!error) return;
+            SDL_Log("No realtime priority for %s thread (%s), trying high", ROLE_NAMES[role], std::strerror(error));
+            priority = PRIORITY_HIGH;
+        }
+        if (priority == PRIORITY_HIGH && setpriority(PRIO_PROCESS, id_t(tid), -10) != 0) {
+            SDL_Log("No high priority for %s thread (%s)", ROLE_NAMES[role], std::strerror(errno));
+        }
+    }
+
+    // Current usage of a live thread from /proc
+    static bool readUsage(Thread& t) {
+        char path[64], buffer[1024];
+        std::snprintf(path, sizeof(path), "/proc/self/task/%d/stat", int(t.tid));
+        FILE* f = std::fopen(path, "r");
+        if (!f) return false;
+        size_t n = std::fread(buffer, 1, sizeof(buffer) - 1, f);
+        std::fclose(f);
+        buffer[n] = '\0';
+        // utime and stime are fields 14 and 15; the name (field 2) may hold spaces
+        const char* p = std::strrchr(buffer, ')');
+        unsigned long long utime, stime;
+        if (!p || std::sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                              &utime, &stime) != 2) {
+            return false;
+        }
+        t.cpuMs = (utime + stime) * 1000.0 / double(sysconf(_SC_CLK_TCK));
+
+        std::snprintf(path, sizeof(path), "/proc/self/task/%d/status", int(t.tid));
+        f = std::fopen(path, "r");
+        if (!f) return false;
+        char line[256];
+        unsigned long long value;
+        while (std::fgets(line, sizeof(line), f)) {
+            if (std::sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1) t.voluntary = value;
+            else if (std::sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1) t.involuntary = value;
+        }
+        std::fclose(f);
+        return true;
+    }
+
+    static inline RoleConfig config[NUM_THREAD_ROLES] = {
+        { false, {}, PRIORITY_NORMAL },
+        { false, {}, PRIORITY_REALTIME },  // audio underruns are audible
+        { false, {}, PRIORITY_NORMAL },
+        { false, {}, PRIORITY_NORMAL },
+    };
+    static inline std::mutex threadsLock;
+    static inline std::vector<Thread> threads;
+    // Whether this thread has entered; cleared in a forked child, whose
+    // one thread is new
+    static inline thread_local bool entered = false;
 };
 
-// Video subsystem
-class Video {
+// Allocations on the real-time threads. The frame loop (CPU and render)
+// and the audio callback open a Scope; once the warm-up frames are over
+// and the check is armed, every malloc, calloc, realloc or aligned
+// allocation a thread makes inside its scope is a violation. Violations
+// are grouped by call site with a backtrace, reported at shutdown, and
+// fail the run. Only allocation-checking builds (FLAMES_ALLOC_CHECK)
+// interpose malloc; in other builds nothing is ever recorded.
+class AllocCheck {
 public:
-    Video() : renderer(nullptr), window(nullptr), bgColor(0x00000000) {}
+    static const int MAX_SITES = 64;
+    static const int MAX_DEPTH = 24;
 
-    bool init() {
-        // Create window with Metal backend for M1 optimization
-        window = SDL_CreateWindow("Wii Memory Emulator - 60 FPS",
-                                  SDL_WINDOWPOS_CENTERED,
-                                  SDL_WINDOWPOS_CENTERED,
-                                  854, 480,  // Wii resolution
-                                  SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI);
-        if (!window) {
-            SDL_Log("Failed to create window: %s", SDL_GetError());
-            return false;
+    class Scope {
+    public:
+        explicit Scope(ThreadRole role) : previous(watching) {
+            if (FLAMES_ALLOC_CHECK && armed.load(std::memory_order_relaxed)) watching = role;
+        }
+        ~Scope() { watching = previous; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        int previous;
+    };
+
+    static void arm(bool enabled) {
+#if FLAMES_ALLOC_CHECK
+        // backtrace() loads its unwinder on first use, which allocates
+        void* frame;
+        if (enabled) backtrace(&frame, 1);
+#endif
+        armed.store(enabled, std::memory_order_relaxed);
+    }
+
+    static uint64_t getViolations() { return violations.load(std::memory_order_relaxed); }
+
+#if FLAMES_ALLOC_CHECK
+    // Called by the malloc interposers for every allocation
+    __attribute__((noinline)) static void record(size_t size) {
+        if (watching < 0 || inside) return;
+        inside = true;
+        void* frames[MAX_DEPTH + 2];
+        int depth = std::max(backtrace(frames, MAX_DEPTH + 2) - 2, 0);  // drop record() and malloc()
+        while (lock.test_and_set(std::memory_order_acquire)) {}
+        Site* site = nullptr;
+        for (int i = 0; i < siteCount && !site; i++) {
+            Site& s = sites[i];
+            if (s.role == watching && s.depth == depth &&
+                std::equal(frames + 2, frames + 2 + depth, s.frames)) site = &s;
+        }
+        if (!site && siteCount < MAX_SITES) {
+            site = &sites[siteCount++];
+            site->role = watching;
+            site->depth = depth;
+            std::copy(frames + 2, frames + 2 + depth, site->frames);
+        }
+        if (site) {
+            site->count++;
+            site->bytes += size;
+        }
+        lock.clear(std::memory_order_release);
+        violations.fetch_add(1, std::memory_order_relaxed);
+        inside = false;
+    }
+#endif
+
+    // Log each call site with its backtrace, and write them as a JSON array
+    // to 'json' if given
+    static void report(FILE* json = nullptr) {
+        if (json) std::fprintf(json, "[");
+        if (!json && getViolations()) {
+            SDL_Log("%llu allocations on real-time threads after warm-up, from %d call sites",
+                    (unsigned long long)getViolations(), siteCount);
+        }
+        for (int i = 0; i < siteCount; i++) {
+            const Site& s = sites[i];
+            if (json) {
+                std::fprintf(json, "%s{\"thread\": \"%s\", \"count\": %llu, \"bytes\": %llu, \"stack\": [",
+                             i ? ", " : "", ThreadRoles::getName(ThreadRole(s.role)),
+                             (unsigned long long)s.count, (unsigned long long)s.bytes);
+                for (int f = 0; f < s.depth; f++) std::fprintf(json, "%s\"%p\"", f ? ", " : "", s.frames[f]);
+                std::fprintf(json, "]}");
+                continue;
+            }
+            SDL_Log("%llu allocations (%llu bytes) on the %s thread at:", (unsigned long long)s.count,
+                    (unsigned long long)s.bytes, ThreadRoles::getName(ThreadRole(s.role)));
+#if FLAMES_ALLOC_CHECK
+            std::fflush(stderr);
+            backtrace_symbols_fd(s.frames, s.depth, STDERR_FILENO);
+#endif
+        }
+        if (json) std::fprintf(json, "]");
+    }
+
+private:
+    struct Site {
+        int role;
+        int depth;
+        uint64_t count;
+        uint64_t bytes;
+        void* frames[MAX_DEPTH];
+    };
+
+    static inline thread_local int watching = -1;  // ThreadRole, or -1
+    static inline thread_local bool inside = false;
+    static inline std::atomic<bool> armed{false};
+    static inline std::atomic<uint64_t> violations{0};
+    static inline std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    static inline Site sites[MAX_SITES];
+    static inline int siteCount = 0;
+};
+
+#if FLAMES_ALLOC_CHECK
+// glibc's allocator under its internal names; free() is left alone
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+extern "C" void* malloc(size_t size) noexcept {
+    AllocCheck::record(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept {
+    AllocCheck::record(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) noexcept {
+    AllocCheck::record(size);
+    return __libc_realloc(p, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) noexcept {
+    AllocCheck::record(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    AllocCheck::record(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+    AllocCheck::record(size);
+    void* p = __libc_memalign(alignment, size);
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+#endif
+
+// Work-stealing job system shared by the emulator's subsystems, so bulk
+// work runs on one set of worker threads sized to the cores instead of
+// ad-hoc threads. Every worker has a deque per priority; it pushes and
+// pops its own jobs at the back and steals the oldest jobs of others
+// from the front. Threads that are not workers share one more deque.
+// High-priority jobs anywhere are taken before normal ones. wait() runs
+// queued jobs while it waits, so fork/join works from any thread, and
+// with no workers (one core) everything runs on the waiting thread.
+// Workers start on the first job; stop() joins them, and must be called
+// before fork() as the child would have none.
+class JobSystem {
+public:
+    enum Priority { PRIORITY_HIGH, PRIORITY_NORMAL, NUM_PRIORITIES };
+
+    // Jobs started under one group are waited for together
+    class Group {
+    public:
+        Group() : pending(0) {}
+        Group(const Group&) = delete;
+        Group& operator=(const Group&) = delete;
+
+    private:
+        friend class JobSystem;
+        std::atomic<uint32_t> pending;
+    };
+
+    // Worker threads to start (default: the cores in the affinity mask,
+    // less one for the thread that waits). Takes effect at the next start.
+    static void setWorkerCount(uint32_t count) {
+        requestedWorkers = int(count);
+    }
+
+    static void run(Group& group, std::function<void()> job, Priority priority = PRIORITY_NORMAL) {
+        start();
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = *slots[currentSlot()];
+        {
+            std::lock_guard<std::mutex> lock(slot.lock);
+            slot.queues[priority].push_back({std::move(job), &group});
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        { std::lock_guard<std::mutex> lock(sleepLock); }
+        sleepCondition.notify_one();
+    }
+
+    // Wait for every job in 'group', running queued jobs meanwhile
+    static void wait(Group& group) {
+        while (group.pending.load(std::memory_order_acquire)) {
+            if (!runOne(currentSlot())) std::this_thread::yield();
+        }
+    }
+
+    // fn(begin, end) over [0, count) in chunks of at most 'grain', in
+    // parallel, returning when all are done
+    template <typename F>
+    static void parallelFor(size_t count, size_t grain, const F& fn, Priority priority = PRIORITY_NORMAL) {
+        if (count <= grain) {
+            if (count) fn(size_t(0), count);
+            return;
+        }
+        Group group;
+        for (size_t begin = 0; begin < count; begin += grain) {
+            size_t end = std::min(count, begin + grain);
+            run(group, [&fn, begin, end] { fn(begin, end); }, priority);
+        }
+        wait(group);
+    }
+
+    // Join the workers (queued jobs are finished first)
+    static void stop() {
+        std::lock_guard<std::mutex> startGuard(startLock);
+        if (!started.load(std::memory_order_acquire)) return;
+        {
+            std::lock_guard<std::mutex> lock(sleepLock);
+            running = false;
+        }
+        sleepCondition.notify_all();
+        for (std::thread& t : threads) t.join();
+        threads.clear();
+        started.store(false, std::memory_order_release);
+    }
+
+    // Log jobs run, jobs stolen and busy time per worker since startup
+    static void report() {
+        std::lock_guard<std::mutex> startGuard(startLock);
+        uint64_t total = 0;
+        for (const auto& slot : slots) total += slot->executed;
+        if (!total) return;
+        for (size_t i = 0; i < slots.size(); i++) {
+            const Slot& s = *slots[i];
+            char name[32];
+            if (i + 1 < slots.size()) std::snprintf(name, sizeof(name), "worker %zu", i);
+            else std::snprintf(name, sizeof(name), "waiting threads");
+            SDL_Log("Jobs on %-15s: %8llu run (%5.1f%%), %8llu stolen, %.2f ms busy", name,
+                    (unsigned long long)s.executed.load(), 100.0 * s.executed / total,
+                    (unsigned long long)s.stolen.load(), s.busyNs / 1e6);
+        }
+    }
+
+private:
+    struct Job {
+        std::function<void()> function;
+        Group* group;
+    };
+
+    struct Slot {
+        std::mutex lock;
+        std::deque<Job> queues[NUM_PRIORITIES];
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> busyNs{0};
+    };
+
+    // Worker index of the calling thread; other threads use the last slot
+    static size_t currentSlot() {
+        return workerIndex >= 0 ? size_t(workerIndex) : slots.size() - 1;
+    }
+
+    static void start() {
+        if (started.load(std::memory_order_acquire)) return;
+        std::lock_guard<std::mutex> startGuard(startLock);
+        if (started.load(std::memory_order_relaxed)) return;
+        int count = requestedWorkers;
+        if (count < 0) {
+            cpu_set_t set;
+            count = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) - 1 : 0;
+        }
+        // Slots are made once, so they cover the whole run and waiting
+        // threads can scan them without locking the list
+        if (slots.empty()) {
+            for (int i = 0; i <= count; i++) slots.emplace_back(new Slot);
+        }
+        count = std::min(count, int(slots.size()) - 1);
+        running = true;
+        for (int i = 0; i < count; i++) threads.emplace_back(workerLoop, i);
+        started.store(true, std::memory_order_release);
+    }
+
+    static void workerLoop(int index) {
+        ThreadRoles::enter(THREAD_WORKER);
+        workerIndex = index;
+        while (true) {
+            if (runOne(size_t(index))) continue;
+            std::unique_lock<std::mutex> lock(sleepLock);
+            sleepCondition.wait(lock, [] { return !running || queued.load(std::memory_order_acquire) > 0; });
+            if (!running && !queued.load(std::memory_order_acquire)) break;
+        }
+        workerIndex = -1;
+        ThreadRoles::leave();
+    }
+
+    // Run one job, taking it from 'self' or stealing it; false if there
+    // was none
+    static bool runOne(size_t self) {
+        Job job;
+        bool stolen = false;
+        if (!take(self, job, stolen)) return false;
+        uint64_t begin = Tracer::now();
+        job.function();
+        Slot& slot = *slots[self];
+        slot.busyNs.fetch_add(Tracer::now() - begin, std::memory_order_relaxed);
+        slot.executed.fetch_add(1, std::memory_order_relaxed);
+        if (stolen) slot.stolen.fetch_add(1, std::memory_order_relaxed);
+        job.group->pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    static bool take(size_t self, Job& job, bool& stolen) {
+        if (!queued.load(std::memory_order_acquire)) return false;
+        size_t count = slots.size();
+        for (int p = 0; p < NUM_PRIORITIES; p++) {
+            for (size_t k = 0; k < count; k++) {
+                Slot& victim = *slots[(self + k) % count];
+                std::lock_guard<std::mutex> lock(victim.lock);
+                std::deque<Job>& queue = victim.queues[p];
+                if (queue.empty()) continue;
+                if (k == 0) {
+                    job = std::move(queue.back());
+                    queue.pop_back();
+                } else {
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                stolen = k != 0;
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
         }
+        return false;
+    }
+
+    static inline int requestedWorkers = -1;
+    static inline std::atomic<bool> started{false};
+    static inline std::mutex startLock;
+    static inline std::vector<std::unique_ptr<Slot>> slots;  // workers, then the shared slot
+    static inline std::vector<std::thread> threads;
+    static inline std::atomic<uint64_t> queued{0};
+    static inline std::mutex sleepLock;
+    static inline std::condition_variable sleepCondition;
+    static inline bool running = false;  // guarded by sleepLock
+    static inline thread_local int workerIndex = -1;
+};
+
+// Guest-cycle event scheduler. Devices schedule callbacks at guest cycle
+// times instead of polling; the CPU runs until the next event is due and
+// the scheduler dispatches it. While the CPU is idle time jumps straight
+// from one event to the next.
+//
+// Time is kept as a downcount: the cycles left until the CPU has to stop,
+// at the next event or the end of the run slice, whichever comes first.
+// Executed code only subtracts its cycles and checks for <= 0 once per
+// block; the current time is the stop point minus the downcount.
+// Scheduling an earlier event moves the stop point, and the downcount
+// with it.
+class Scheduler {
+public:
+    // 'cyclesLate' is how far past its due time the event was dispatched
+    typedef void (*Callback)(void* userdata, uint64_t param, int64_t cyclesLate);
+
+    Scheduler() : stop(0), downcount(0), sliceEnd(UINT64_MAX), nextEvent(UINT64_MAX), order(0) {}
+
+    int registerEvent(const char* name, Callback callback, void* userdata) {
+        types.push_back({name, callback, userdata});
+        return int(types.size() - 1);
+    }
+
+    void scheduleEvent(uint64_t cyclesFromNow, int type, uint64_t param = 0) {
+        scheduleEventAt(getTicks() + cyclesFromNow, type, param);
+    }
+
+    void scheduleEventAt(uint64_t when, int type, uint64_t param = 0) {
+        queue.push_back({when, order++, type, param});
+        std::push_heap(queue.begin(), queue.end(), later);
+        nextEvent = queue.front().when;
+        retarget();
+    }
+
+    void removeEvent(int type) {
+        auto end = std::remove_if(queue.begin(), queue.end(),
+                                  [type](const Event& e) { return e.type == type; });
+        if (end == queue.end()) return;
+        queue.erase(end, queue.end());
+        std::make_heap(queue.begin(), queue.end(), later);
+        nextEvent = queue.empty() ? UINT64_MAX : queue.front().when;
+        retarget();
+    }
+
+    uint64_t getTicks() const { return stop - uint64_t(downcount); }
+    uint64_t getNextEventTicks() const { return nextEvent; }
+    void addTicks(uint64_t cycles) { downcount -= int64_t(cycles); }
+
+    // Cycles left before the CPU has to return to run(); compiled code
+    // subtracts its cycles here directly
+    int64_t getDowncount() const { return downcount; }
+    int64_t* getDowncountPointer() { return &downcount; }
+
+    // Stop the CPU at 'end' at the latest (CPU::run's slice target)
+    void setSliceEnd(uint64_t end) {
+        sliceEnd = end;
+        retarget();
+    }
+
+    // Dispatch every event due at or before the current time
+    void runDueEvents() {
+        while (nextEvent <= getTicks()) {
+            std::pop_heap(queue.begin(), queue.end(), later);
+            Event e = queue.back();
+            queue.pop_back();
+            nextEvent = queue.empty() ? UINT64_MAX : queue.front().when;
+            retarget();
+            const EventType& t = types[e.type];
+            t.callback(t.userdata, e.param, int64_t(getTicks() - e.when));
+        }
+    }
+
+    // Move time forward to 'target', dispatching events on the way at
+    // their due times (used when nothing is executing)
+    void advanceTo(uint64_t target) {
+        while (nextEvent <= target) {
+            if (nextEvent > getTicks()) setTicks(nextEvent);
+            runDueEvents();
+        }
+        if (target > getTicks()) setTicks(target);
+    }
+
+private:
+    struct EventType {
+        const char* name;
+        Callback callback;
+        void* userdata;
+    };
+    struct Event {
+        uint64_t when;
+        uint64_t order;  // FIFO among events due at the same cycle
+        int type;
+        uint64_t param;
+    };
+
+public:
+    // Time and pending events, for save states. Event types are not part
+    // of it; they are registered once and are the same on restore.
+    struct State {
+        std::vector<Event> queue;
+        uint64_t ticks;
+        uint64_t nextEvent;
+        uint64_t order;
+    };
+
+    void saveState(State& s) const {
+        s.queue = queue;  // reuses the state's capacity
+        s.ticks = getTicks();
+        s.nextEvent = nextEvent;
+        s.order = order;
+    }
+
+    void restoreState(const State& s) {
+        queue = s.queue;
+        nextEvent = s.nextEvent;
+        order = s.order;
+        setTicks(s.ticks);
+    }
+
+private:
+    static bool later(const Event& a, const Event& b) {
+        return a.when > b.when || (a.when == b.when && a.order > b.order);
+    }
+
+    void setTicks(uint64_t ticks) {
+        stop = ticks;
+        downcount = 0;
+        retarget();
+    }
+
+    // Move the stop point to the next event or the slice end, keeping the
+    // current time. An overdue event leaves the downcount negative.
+    void retarget() {
+        uint64_t now = getTicks();
+        stop = std::min({sliceEnd, nextEvent, now + uint64_t(INT64_MAX)});
+        downcount = int64_t(stop - now);
+    }
+
+    std::vector<EventType> types;
+    std::vector<Event> queue;  // min-heap on (when, order)
+    uint64_t stop;             // where the downcount reaches 0
+    int64_t downcount;
+    uint64_t sliceEnd;
+    uint64_t nextEvent;
+    uint64_t order;
+};
+
+// Bump allocator for transient data that lives until a known point, such
+// as the end of the frame. One block is allocated up front; allocation is
+// a pointer bump and reset() frees everything at once. Requests that do
+// not fit fall back to the heap (and count as overflow) so a bad estimate
+// costs jitter, not a crash. Only trivially destructible types belong
+// here, as nothing is destroyed.
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity)
+        : base(static_cast<uint8_t*>(std::malloc(capacity))), capacity(base ? capacity : 0), used(0),
+          peak(0), overflowBytes(0), overflowPeak(0) {}
+    ~FrameArena() {
+        reset();
+        std::free(base);
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (offset + size <= capacity) {
+            used = offset + size;
+            peak = std::max(peak, used);
+            return base + offset;
+        }
+        if (overflow.empty()) SDL_Log("Frame arena full (%zu bytes); falling back to the heap", capacity);
+        overflowBytes += size;
+        overflow.push_back({::operator new(size, std::align_val_t(align)), align});
+        return overflow.back().first;
+    }
+
+    template <typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    // Free everything allocated since the last reset
+    void reset() {
+        for (const auto& block : overflow) ::operator delete(block.first, std::align_val_t(block.second));
+        overflow.clear();
+        overflowPeak = std::max(overflowPeak, overflowBytes);
+        overflowBytes = 0;
+        used = 0;
+    }
+
+    size_t getCapacity() const { return capacity; }
+    size_t getUsed() const { return used; }                  // bytes in the block since the last reset
+    size_t getPeak() const { return peak; }                  // most bytes used between resets
+    size_t getOverflowPeak() const { return overflowPeak; }  // most heap bytes between resets
+
+private:
+    uint8_t* base;
+    size_t capacity;
+    size_t used;
+    size_t peak;
+    size_t overflowBytes;
+    size_t overflowPeak;
+    std::vector<std::pair<void*, size_t>> overflow;  // heap blocks and their alignment
+};
+
+// Fixed pool of N objects' worth of storage for objects that come and go
+// at a steady rate. acquire() returns raw storage (nullptr when the pool
+// is exhausted) that the caller constructs in, and release() takes it
+// back; neither touches the heap.
+template <typename T, size_t N>
+class FixedPool {
+    struct Slot {
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+
+public:
+    FixedPool() : freeCount(N), live(0), peak(0), failures(0) {
+        for (size_t i = 0; i < N; i++) freeSlots[i] = uint32_t(N - 1 - i);
+    }
+
+    FixedPool(const FixedPool&) = delete;
+    FixedPool& operator=(const FixedPool&) = delete;
+
+    void* acquire() {
+        if (freeCount == 0) {
+            failures++;
+            return nullptr;
+        }
+        live++;
+        peak = std::max(peak, live);
+        return storage[freeSlots[--freeCount]].bytes;
+    }
+
+    void release(void* p) {
+        size_t slot = size_t(static_cast<Slot*>(p) - storage);
+        freeSlots[freeCount++] = uint32_t(slot);
+        live--;
+    }
+
+    size_t index(const void* p) const { return size_t(static_cast<const Slot*>(p) - storage); }
+    void* at(size_t slot) { return storage[slot].bytes; }
+
+    size_t getLive() const { return live; }
+    size_t getPeak() const { return peak; }
+    uint64_t getFailures() const { return failures; }
+
+    // Contents and free list, copied whole as bytes. Restoring one is only
+    // sound where that copy is (see DeviceTasks::State).
+    struct State {
+        Slot storage[N];
+        uint32_t freeSlots[N];
+        size_t freeCount;
+        size_t live;
+    };
+
+    void saveState(State& s) const {
+        std::memcpy(s.storage, storage, sizeof(storage));
+        std::memcpy(s.freeSlots, freeSlots, sizeof(freeSlots));
+        s.freeCount = freeCount;
+        s.live = live;
+    }
+
+    void restoreState(const State& s) {
+        std::memcpy(storage, s.storage, sizeof(storage));
+        std::memcpy(freeSlots, s.freeSlots, sizeof(freeSlots));
+        freeCount = s.freeCount;
+        live = s.live;
+    }
+
+private:
+    Slot storage[N];
+    uint32_t freeSlots[N];
+    size_t freeCount;
+    size_t live;
+    size_t peak;
+    uint64_t failures;
+};
+
+// Device operations that start, wait and complete (IPC requests, and DMA
+// and disc transfers as they are added) run as tasks resumed by the
+// scheduler rather than as chains of event callbacks. A task's resume()
+// is a switch on its own step counter, so the operation reads top to
+// bottom; each step returns how many guest cycles to wait before the
+// next one, WAIT to sleep until its handle is passed to wake() (an I/O
+// completion), or DONE.
+// Tasks live in a FixedPool of frames inside DeviceTasks, so starting one
+// does not allocate, and no host thread waits on an outstanding operation.
+class DeviceTask {
+public:
+    static const int64_t WAIT = -1;
+    static const int64_t DONE = -2;
+
+    virtual ~DeviceTask() {}
+    virtual int64_t resume() = 0;
+
+protected:
+    // Names this task to DeviceTasks::wake(); a task that returns WAIT
+    // hands it to whatever will complete it
+    uint32_t handle;
+
+    friend class DeviceTasks;
+};
+
+class DeviceTasks {
+public:
+    static const uint32_t MAX_TASKS = 32;  // outstanding at once
+    static const size_t FRAME_SIZE = 64;   // bytes per task object
+
+    // Storage for one task
+    struct Frame {
+        alignas(std::max_align_t) unsigned char bytes[FRAME_SIZE];
+    };
+
+    DeviceTasks() : scheduler(nullptr), event(-1) {
+        for (uint32_t i = 0; i < MAX_TASKS; i++) {
+            tasks[i] = nullptr;
+            serials[i] = 0;
+            waiting[i] = false;
+        }
+    }
+    ~DeviceTasks() {
+        for (uint32_t slot = 0; slot < MAX_TASKS; slot++) {
+            if (tasks[slot]) release(slot);
+        }
+    }
+
+    DeviceTasks(const DeviceTasks&) = delete;
+    DeviceTasks& operator=(const DeviceTasks&) = delete;
+
+    void connectScheduler(Scheduler* s) {
+        scheduler = s;
+        event = scheduler->registerEvent("DeviceTask", onResume, this);
+    }
+
+    // Construct a task in a free frame and run its first step now
+    template <typename Task, typename... Args>
+    bool start(Args&&... args) {
+        static_assert(sizeof(Task) <= FRAME_SIZE && alignof(Task) <= alignof(Frame), "task does not fit a frame");
+        void* frame = scheduler ? frames.acquire() : nullptr;
+        if (!frame) {
+            SDL_Log("No frame for a device task (%zu outstanding)", frames.getLive());
+            return false;
+        }
+        uint32_t slot = uint32_t(frames.index(frame));
+        tasks[slot] = new (frame) Task(std::forward<Args>(args)...);
+        tasks[slot]->handle = serials[slot] * MAX_TASKS + slot;
+        step(slot);
+        return true;
+    }
+
+    // Resume the task that returned WAIT under 'handle'. It runs from the
+    // scheduler, not inside the caller. A handle whose task has finished,
+    // or is not waiting, is ignored.
+    void wake(uint32_t handle) {
+        uint32_t slot = handle % MAX_TASKS;
+        if (!tasks[slot] || !waiting[slot] || serials[slot] != handle / MAX_TASKS) return;
+        waiting[slot] = false;
+        scheduler->scheduleEvent(0, event, slot);
+    }
+
+    // Most tasks outstanding at once
+    size_t getPeak() const { return frames.getPeak(); }
+
+    // Drop every outstanding task
+    void reset() {
+        if (scheduler) scheduler->removeEvent(event);
+        for (uint32_t slot = 0; slot < MAX_TASKS; slot++) {
+            if (tasks[slot]) release(slot);
+        }
+    }
+
+    // Outstanding tasks, for save states. Tasks are plain data behind a
+    // vtable, so their frames are saved as bytes; a state can only be
+    // restored into the DeviceTasks that saved it, where the pointers and
+    // the references tasks hold are still valid. Their next steps are
+    // scheduler events and are restored with the scheduler.
+    struct State {
+        FixedPool<Frame, MAX_TASKS>::State frames;
+        DeviceTask* tasks[MAX_TASKS];
+        uint32_t serials[MAX_TASKS];
+        bool waiting[MAX_TASKS];
+    };
+
+    void saveState(State& s) const {
+        frames.saveState(s.frames);
+        std::copy(std::begin(tasks), std::end(tasks), s.tasks);
+        std::copy(std::begin(serials), std::end(serials), s.serials);
+        std::copy(std::begin(waiting), std::end(waiting), s.waiting);
+    }
+
+    void restoreState(const State& s) {
+        frames.restoreState(s.frames);
+        std::copy(std::begin(s.tasks), std::end(s.tasks), tasks);
+        std::copy(std::begin(s.serials), std::end(s.serials), serials);
+        std::copy(std::begin(s.waiting), std::end(s.waiting), waiting);
+    }
+
+private:
+    void step(uint32_t slot) {
+        int64_t next = tasks[slot]->resume();
+        if (next == DeviceTask::DONE) release(slot);
+        else if (next == DeviceTask::WAIT) waiting[slot] = true;
+        else scheduler->scheduleEvent(uint64_t(next), event, slot);
+    }
+
+    void release(uint32_t slot) {
+        tasks[slot]->~DeviceTask();
+        tasks[slot] = nullptr;
+        serials[slot]++;  // stale handles no longer match
+        waiting[slot] = false;
+        frames.release(frames.at(slot));
+    }
+
+    static void onResume(void* userdata, uint64_t param, int64_t) {
+        DeviceTasks* self = static_cast<DeviceTasks*>(userdata);
+        if (self->tasks[param]) self->step(uint32_t(param));
+    }
+
+    Scheduler* scheduler;
+    int event;
+    FixedPool<Frame, MAX_TASKS> frames;
+    DeviceTask* tasks[MAX_TASKS];  // live task per frame, or nullptr
+    uint32_t serials[MAX_TASKS];   // tasks finished in each frame, part of handles
+    bool waiting[MAX_TASKS];       // returned WAIT and not yet woken
+};
+
+// Hollywood register block (PPC view, mirrored at 0x0D800000)
+const uint32_t HOLLYWOOD_BASE = 0x0D000000;
+const uint32_t HOLLYWOOD_SIZE = 0x400;
+
+// Hollywood register offsets
+enum HollywoodReg : uint32_t {
+    HW_IPC_PPCMSG    = 0x000,
+    HW_IPC_PPCCTRL   = 0x004,
+    HW_IPC_ARMMSG    = 0x008,
+    HW_IPC_ARMCTRL   = 0x00C,
+    HW_TIMER         = 0x010,
+    HW_ALARM         = 0x014,
+    HW_PPCIRQFLAG    = 0x030,
+    HW_PPCIRQMASK    = 0x034,
+    HW_ARMIRQFLAG    = 0x038,
+    HW_ARMIRQMASK    = 0x03C,
+    HW_SRNPROT       = 0x060,
+    HW_AHBPROT       = 0x064,
+    HW_GPIOB_OUT     = 0x0C0,
+    HW_GPIOB_DIR     = 0x0C4,
+    HW_GPIOB_IN      = 0x0C8,
+    HW_GPIOB_INTLVL  = 0x0CC,
+    HW_GPIOB_INTFLAG = 0x0D0,
+    HW_GPIOB_INTMASK = 0x0D4,
+    HW_GPIOB_STRAPS  = 0x0D8,
+    HW_GPIO_ENABLE   = 0x0DC,
+    HW_GPIO_OUT      = 0x0E0,
+    HW_GPIO_DIR      = 0x0E4,
+    HW_GPIO_IN       = 0x0E8,
+    HW_GPIO_INTLVL   = 0x0EC,
+    HW_GPIO_INTFLAG  = 0x0F0,
+    HW_GPIO_INTMASK  = 0x0F4,
+    HW_GPIO_STRAPS   = 0x0F8,
+    HW_GPIO_OWNER    = 0x0FC,
+    HW_BOOT0         = 0x18C,
+    HW_CLOCKS        = 0x190,
+    HW_RESETS        = 0x194,
+    HW_PLLSYS        = 0x1B0,
+    HW_PLLSYSEXT     = 0x1B4,
+    HW_VERSION       = 0x214,
+
+    // Emulator integration registers, in an unused part of the block
+    HW_FLAMES_BG_COLOR   = 0x3F0,
+    HW_FLAMES_INPUT      = 0x3F4,
+    HW_FLAMES_AUDIO_FREQ = 0x3F8,
+};
+
+// Memory-mapped I/O register addresses (for emulator integration)
+const uint32_t REG_VIDEO_BG_COLOR = HOLLYWOOD_BASE + HW_FLAMES_BG_COLOR;    // Background color register (example)
+const uint32_t REG_INPUT_STATE    = HOLLYWOOD_BASE + HW_FLAMES_INPUT;       // Input state register (buttons)
+const uint32_t REG_AUDIO_FREQ     = HOLLYWOOD_BASE + HW_FLAMES_AUDIO_FREQ;  // Audio frequency register (tone control)
+
+// Hollywood timer: 243 MHz / 128, i.e. one tick every 384 CPU cycles
+const uint32_t HOLLYWOOD_TIMER_DIVIDER = 384;
+
+// Hollywood interrupt sources (bits of HW_PPCIRQFLAG / HW_ARMIRQFLAG)
+const uint32_t HOLLYWOOD_IRQ_TIMER = 0x00000001;
+const uint32_t HOLLYWOOD_IRQ_IPC   = 0x40000000;
+
+// HW_IPC_PPCCTRL bits
+const uint32_t IPC_CTRL_X1  = 0x01;  // PPC: request in PPCMSG
+const uint32_t IPC_CTRL_Y2  = 0x02;  // ARM: request taken
+const uint32_t IPC_CTRL_Y1  = 0x04;  // ARM: reply in ARMMSG
+const uint32_t IPC_CTRL_X2  = 0x08;  // PPC: reply consumed
+const uint32_t IPC_CTRL_IY1 = 0x10;  // interrupt on Y1
+const uint32_t IPC_CTRL_IY2 = 0x20;  // interrupt on Y2
+
+// Starlet response times for an IPC request, in CPU cycles
+const uint32_t IPC_ACK_CYCLES = 729;     // ~1 us
+const uint32_t IPC_REPLY_CYCLES = 7290;  // ~10 us
+
+// Forward declarations
+class Video;
+class Audio;
+class Input;
+class CPU;
+class JIT;
+class Memory;
+
+// Hollywood register block. Every register is described by one entry in the
+// constexpr table in HollywoodMap; the access dispatch and the reset image
+// are generated from that table at compile time, so an access is a slot
+// lookup in a fixed array plus an indirect call.
+class Hollywood {
+public:
+    Hollywood() : video(nullptr), audio(nullptr), input(nullptr), cpu(nullptr), memory(nullptr),
+                  scheduler(nullptr), alarmEvent(-1), timerBase(0), timerEpoch(0), replyWaiters{},
+                  replyWaiterHead(0), replyWaiterCount(0) {
+        reset();
+    }
+
+    // Connect hardware components for I/O callbacks
+    void connectVideo(Video* v)   { video = v; }
+    void connectAudio(Audio* a)   { audio = a; }
+    void connectInput(Input* i)   { input = i; }
+    void connectCPU(CPU* c)       { cpu = c; }
+    void connectMemory(Memory* m) { memory = m; }
+    void connectScheduler(Scheduler* s);
+
+    void reset();
+    uint32_t read32(uint32_t offset);
+    void write32(uint32_t offset, uint32_t value);
+
+    size_t getDeviceTaskPeak() const { return tasks.getPeak(); }
+
+    // Registers, timer and outstanding IPC, for save states (see
+    // DeviceTasks::State). The alarm is a scheduler event.
+    struct State {
+        uint32_t regs[HOLLYWOOD_SIZE / 4];
+        uint32_t timerBase;
+        uint64_t timerEpoch;
+        DeviceTasks::State tasks;
+        uint32_t replyWaiters[DeviceTasks::MAX_TASKS];
+        uint32_t replyWaiterHead;
+        uint32_t replyWaiterCount;
+    };
+
+    void saveState(State& s) const;
+    void restoreState(const State& s);
+
+private:
+    friend struct HollywoodMap;
+    friend class IPCRequest;
+
+    // Register handlers referenced from the table
+    static uint32_t readStored(Hollywood& hw, uint32_t offset) { return hw.regs[offset >> 2]; }
+    static void writeStored(Hollywood& hw, uint32_t offset, uint32_t value) { hw.regs[offset >> 2] = value; }
+    static void writeReadOnly(Hollywood& hw, uint32_t offset, uint32_t value);
+    static void writeClearBits(Hollywood& hw, uint32_t offset, uint32_t value) { hw.regs[offset >> 2] &= ~value; }
+    static void writeIPCControl(Hollywood& hw, uint32_t offset, uint32_t value);
+    static void writeResets(Hollywood& hw, uint32_t offset, uint32_t value);
+    static uint32_t readGPIOInput(Hollywood& hw, uint32_t offset);
+    static uint32_t readInputState(Hollywood& hw, uint32_t offset);
+    static void writeVideoBgColor(Hollywood& hw, uint32_t offset, uint32_t value);
+    static void writeAudioFreq(Hollywood& hw, uint32_t offset, uint32_t value);
+    static uint32_t readTimer(Hollywood& hw, uint32_t offset);
+    static void writeTimer(Hollywood& hw, uint32_t offset, uint32_t value);
+    static void writeAlarm(Hollywood& hw, uint32_t offset, uint32_t value);
+    static void writeIRQFlag(Hollywood& hw, uint32_t offset, uint32_t value);
+    static void writeIRQMask(Hollywood& hw, uint32_t offset, uint32_t value);
+
+    // The timer is not ticked: its value is derived from the guest cycle
+    // counter when read, and the alarm is a scheduler event
+    uint32_t currentTimer() const;
+    void scheduleAlarm();
+    static void onAlarm(void* userdata, uint64_t param, int64_t cyclesLate);
+    void raiseIRQ(uint32_t bits);
+    void updateInterrupts();
+
+    // IPC with Starlet. IOS is not emulated: every request gets an error
+    // reply, after the delays real firmware would take.
+    void acknowledgeIPC();
+    bool replyPending() const { return regs[HW_IPC_PPCCTRL >> 2] & IPC_CTRL_Y1; }
+    void waitForReplySlot(uint32_t task);
+    void replyIPC(uint32_t request);
+    void updateIPCInterrupt();
+
+    uint32_t regs[HOLLYWOOD_SIZE / 4];
+    Video*  video;
+    Audio*  audio;
+    Input*  input;
+    CPU*    cpu;
+    Memory* memory;
+    Scheduler* scheduler;
+    DeviceTasks tasks;
+    int alarmEvent;
+    uint32_t timerBase;    // HW_TIMER value at timerEpoch
+    uint64_t timerEpoch;   // guest cycle of the last timer write
+    // IPC requests ready to reply while the PPC still holds the last
+    // reply, oldest first, as DeviceTasks handles
+    uint32_t replyWaiters[DeviceTasks::MAX_TASKS];
+    uint32_t replyWaiterHead;
+    uint32_t replyWaiterCount;
+};
+
+// One IPC request from the PPC: Starlet takes it, runs it, then posts the
+// reply. There is one reply register, so a request that finishes while
+// the PPC has not yet acknowledged the previous reply waits for that.
+class IPCRequest : public DeviceTask {
+public:
+    IPCRequest(Hollywood& h, uint32_t address) : hw(h), request(address), step(0) {}
+
+    int64_t resume() override {
+        switch (step++) {
+            case 0:
+                return IPC_ACK_CYCLES;
+            case 1:
+                hw.acknowledgeIPC();
+                return IPC_REPLY_CYCLES;
+            default:
+                if (hw.replyPending()) {
+                    hw.waitForReplySlot(handle);
+                    return WAIT;
+                }
+                hw.replyIPC(request);
+                return DONE;
+        }
+    }
+
+private:
+    Hollywood& hw;
+    uint32_t request;  // guest address of the IOS request block
+    uint32_t step;
+};
+
+// A guest store as seen by Memory (see Memory::setWriteLog)
+struct MemoryWrite {
+    uint32_t address;
+    uint32_t size;
+    uint32_t value;
+};
+
+// Undo journal for guest RAM, which makes save states cheap enough to take
+// every frame (see Memory::saveState). Each checkpoint opens an epoch, and
+// the first store to a 4KB page in an epoch first copies the page's old
+// contents into the epoch's record. Rolling back copies those pages back,
+// newest epoch first, so both cost in proportion to the pages written
+// rather than to the 88MB of RAM. The newest 'capacity' checkpoints can be
+// rolled back to.
+class RamJournal {
+public:
+    static const uint32_t PAGE_SHIFT = 12;
+    static const uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;
+
+    RamJournal() : base(nullptr), next(0), oldest(0), serial(0), open(false) {}
+
+    void attach(uint8_t* ram, size_t size, uint32_t capacity) {
+        base = ram;
+        marks.assign((size + PAGE_SIZE - 1) >> PAGE_SHIFT, 0);
+        epochs.resize(capacity);
+        next = oldest = serial = 0;
+        open = false;
+    }
+
+    bool isAttached() const { return base != nullptr; }
+
+    // Open a new epoch, dropping the oldest if all are in use. Returns the
+    // checkpoint to pass to rollback().
+    uint32_t checkpoint() {
+        if (next - oldest == epochs.size()) oldest++;
+        Epoch& e = epochs[next % epochs.size()];
+        e.pages.clear();
+        e.data.clear();
+        serial++;
+        open = true;
+        return next++;
+    }
+
+    // Called before 'len' bytes at 'p', inside the journaled RAM, change
+    void preserve(const uint8_t* p, size_t len) {
+        if (!open || len == 0) return;
+        size_t first = size_t(p - base) >> PAGE_SHIFT, last = (size_t(p - base) + len - 1) >> PAGE_SHIFT;
+        for (size_t page = first; page <= last; page++) {
+            if (marks[page] == serial) continue;
+            marks[page] = serial;
+            Epoch& e = epochs[(next - 1) % epochs.size()];
+            const uint8_t* contents = base + (page << PAGE_SHIFT);
+            e.pages.push_back(uint32_t(page));
+            e.data.insert(e.data.end(), contents, contents + PAGE_SIZE);
+        }
+    }
+
+    // Pages, as a list in a FrameArena
+    struct PageList {
+        uint32_t* pages;
+        size_t count;
+    };
+
+    // Put RAM back as it was at 'checkpoint', dropping it and every later
+    // one. Stores are not journaled again until the next checkpoint().
+    // 'restored' lists the pages (offsets >> PAGE_SHIFT) whose contents
+    // changed, allocated from 'scratch'.
+    bool rollback(uint32_t checkpoint, FrameArena& scratch, PageList& restored) {
+        if (checkpoint < oldest || checkpoint >= next) return false;
+        size_t saved = 0;
+        for (uint32_t epoch = checkpoint; epoch < next; epoch++) saved += epochs[epoch % epochs.size()].pages.size();
+        restored = {scratch.allocate<uint32_t>(saved), 0};
+        for (uint32_t epoch = next; epoch-- > checkpoint;) {
+            const Epoch& e = epochs[epoch % epochs.size()];
+            for (size_t i = 0; i < e.pages.size(); i++) {
+                uint8_t* page = base + (size_t(e.pages[i]) << PAGE_SHIFT);
+                const uint8_t* contents = &e.data[i << PAGE_SHIFT];
+                if (std::memcmp(page, contents, PAGE_SIZE) == 0) continue;
+                std::memcpy(page, contents, PAGE_SIZE);
+                restored.pages[restored.count++] = e.pages[i];
+            }
+        }
+        next = checkpoint;
+        open = false;
+        return true;
+    }
+
+private:
+    struct Epoch {
+        std::vector<uint32_t> pages;
+        std::vector<uint8_t> data;  // PAGE_SIZE bytes per entry of 'pages'
+    };
+
+    uint8_t* base;
+    std::vector<uint32_t> marks;  // serial of the epoch that saved each page
+    std::vector<Epoch> epochs;    // ring, by checkpoint % size
+    uint32_t next;
+    uint32_t oldest;
+    uint32_t serial;              // never reused, unlike checkpoints
+    bool open;
+};
+
+// Guest memory watchpoints (--watch, --watch-access). Watched pages are
+// write-protected, or made inaccessible for access watches, in the RAM
+// backing and at each of their fastmem views, so memory nobody watches
+// costs nothing. An access to a watched page faults; the handler opens
+// the page for that one host instruction, single-steps it with the trap
+// flag and closes the page again, so the interpreter, compiled code and
+// bulk copies are all caught. An access is a hit when it starts inside
+// the range or, for stores, when it changes the watched bytes; a load
+// that starts below the range is not seen. Another thread touching the
+// page while it is open is missed. Hits are logged from the handler; the
+// faults are synchronous, so this is as safe as logging from the access
+// itself. x86-64 Linux only.
+class Watchpoints {
+public:
+    Watchpoints() : ram(nullptr), ramSize(0), arena(nullptr), guestPC(nullptr), hits(0), registered(false) {}
+
+    ~Watchpoints() {
+#if FLAMES_JIT
+        if (registered) FaultHandler::remove(this);
+#endif
+    }
+
+    // RAM backing and fastmem arena (nullptr once dropped) to protect
+    void attach(uint8_t* backing, size_t size) { ram = backing; ramSize = size; }
+    void setArena(uint8_t* base) { arena = base; }
+
+    // Guest PC shown with each hit (under the JIT, the block's start)
+    void setGuestPC(const uint32_t* pc) { guestPC = pc; }
+
+    // Watch 'length' bytes at 'offset' into the RAM backing; 'address' is
+    // the guest address they were given as
+    bool add(uint32_t offset, uint32_t length, bool access, uint32_t address) {
+#if FLAMES_JIT
+        if (length == 0) return false;
+        if (pages.empty()) pages.assign(ramSize >> RamJournal::PAGE_SHIFT, 0);
+        if (!registered) {
+            if (!FaultHandler::add(handleFault, this)) return false;
+            installTrapHandler();
+            registered = true;
+        }
+        watches.push_back({ offset, offset + length, address, access, 0 });
+        for (uint32_t page = offset >> RamJournal::PAGE_SHIFT; page <= (offset + length - 1) >> RamJournal::PAGE_SHIFT; page++) {
+            pages[page] = std::max<uint8_t>(pages[page], access ? WATCH_ACCESS : WATCH_WRITE);
+            protect(page);
+        }
+        SDL_Log("Watching %s of 0x%08X (+%u)", access ? "accesses" : "writes", address, length);
+        return true;
+#else
+        (void)offset; (void)length; (void)access;
+        SDL_Log("Watchpoint 0x%08X: watchpoints need x86-64 Linux", address);
+        return false;
+#endif
+    }
+
+    bool empty() const { return watches.empty(); }
+    uint64_t getHits() const { return hits; }
+
+    // Whether a fault at 'host' is on a watched page (the JIT leaves those
+    // to handleFault)
+    bool covers(const void* host) const {
+        uint32_t offset;
+        return !pages.empty() && ramOffset(static_cast<const uint8_t*>(host), offset) &&
+               pages[offset >> RamJournal::PAGE_SHIFT] != 0;
+    }
+
+private:
+    enum PageWatch : uint8_t { UNWATCHED, WATCH_WRITE, WATCH_ACCESS };
+
+    struct Watch {
+        uint32_t start, end;  // offsets into the RAM backing
+        uint32_t address;
+        bool access;
+        uint64_t hits;
+    };
+
+    // Offset into the RAM backing of a host address in the backing or in
+    // a fastmem view
+    bool ramOffset(const uint8_t* host, uint32_t& offset) const {
+        if (ram && host >= ram && host < ram + ramSize) {
+            offset = uint32_t(host - ram);
+            return true;
+        }
+        if (arena && host >= arena && host < arena + FASTMEM_ARENA_SIZE) {
+            uint32_t address = uint32_t(host - arena);
+            for (const FastmemView& v : FASTMEM_VIEWS) {
+                if (address - v.address < v.size) {
+                    offset = v.offset + (address - v.address);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+#if FLAMES_JIT
+    // Protect a RAM page wherever it is mapped, as its watches require
+    void protect(uint32_t page) {
+        int prot = pages[page] == WATCH_ACCESS ? PROT_NONE : pages[page] == WATCH_WRITE ? PROT_READ : PROT_READ | PROT_WRITE;
+        uint32_t offset = page << RamJournal::PAGE_SHIFT;
+        mprotect(ram + offset, RamJournal::PAGE_SIZE, prot);
+        if (!arena) return;
+        for (const FastmemView& v : FASTMEM_VIEWS) {
+            if (offset - v.offset < v.size) mprotect(arena + v.address + (offset - v.offset), RamJournal::PAGE_SIZE, prot);
+        }
+    }
+
+    // A page opened for the instruction being single-stepped. An access
+    // that straddles two watched pages opens both.
+    struct Step {
+        Watchpoints* owner;
+        uint8_t* page;      // host page that faulted
+        uint32_t offset;    // RAM backing offset of the faulting byte
+        uint32_t address;   // guest address of the faulting byte
+        bool write;
+        uint8_t before[RamJournal::PAGE_SIZE];
+    };
+    static const uint32_t MAX_STEP_PAGES = 4;
+    static const greg_t TRAP_FLAG = 0x100;
+
+    static bool handleFault(void* userdata, siginfo_t* info, ucontext_t* context) {
+        Watchpoints* self = static_cast<Watchpoints*>(userdata);
+        const uint8_t* host = static_cast<const uint8_t*>(info->si_addr);
+        uint32_t offset;
+        if (!self->ramOffset(host, offset) || !self->pages[offset >> RamJournal::PAGE_SHIFT] ||
+            stepCount == MAX_STEP_PAGES) {
+            return false;
+        }
+        greg_t* regs = context->uc_mcontext.gregs;
+        Step& step = steps[stepCount++];
+        step.owner = self;
+        step.page = const_cast<uint8_t*>(host) - (uintptr_t(host) & (RamJournal::PAGE_SIZE - 1));
+        step.offset = offset;
+        step.address = self->arena && host >= self->arena && host < self->arena + FASTMEM_ARENA_SIZE
+            ? uint32_t(host - self->arena) : cachedAddress(offset);
+        step.write = (regs[REG_ERR] & 2) != 0;
+        mprotect(step.page, RamJournal::PAGE_SIZE, PROT_READ | PROT_WRITE);
+        std::memcpy(step.before, step.page, RamJournal::PAGE_SIZE);
+        regs[REG_EFL] |= TRAP_FLAG;
+        return true;
+    }
+
+    static void onTrap(int sig, siginfo_t* info, void* context) {
+        if (stepCount == 0) {
+            // Not a step of ours: take the trap the way it was going to be taken
+            sigaction(sig, &previousTrap, nullptr);
+            if (previousTrap.sa_flags & SA_SIGINFO) previousTrap.sa_sigaction(sig, info, context);
+            else raise(sig);
+            return;
+        }
+        for (uint32_t i = 0; i < stepCount; i++) steps[i].owner->finishStep(steps[i]);
+        stepCount = 0;
+        static_cast<ucontext_t*>(context)->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+    }
+
+    // The stepped instruction has run: report the watches it hit and close
+    // the page again
+    void finishStep(const Step& step) {
+        uint32_t pageStart = step.offset & ~(RamJournal::PAGE_SIZE - 1), pageEnd = pageStart + RamJournal::PAGE_SIZE;
+        for (Watch& w : watches) {
+            uint32_t lo = std::max(w.start, pageStart), hi = std::min(w.end, pageEnd);
+            if (lo >= hi || (!w.access && !step.write)) continue;
+            const uint8_t* before = step.before + (lo - pageStart);
+            const uint8_t* after = step.page + (lo - pageStart);
+            bool inside = step.offset >= w.start && step.offset < w.end;
+            if (!inside && std::memcmp(before, after, hi - lo) == 0) continue;
+            uint32_t oldValue = 0, newValue = 0;
+            for (uint32_t i = 0; i < std::min(hi - lo, 4u); i++) {
+                oldValue = (oldValue << 8) | before[i];
+                newValue = (newValue << 8) | after[i];
+            }
+            w.hits++;
+            hits++;
+            SDL_Log("Watchpoint 0x%08X: %s at 0x%08X, pc 0x%08X, 0x%08X -> 0x%08X",
+                    w.address, step.write ? "write" : "read", step.address, guestPC ? *guestPC : 0,
+                    oldValue, newValue);
+        }
+        protect(step.offset >> RamJournal::PAGE_SHIFT);
+    }
+
+    // Guest address of a backing offset in the cached mirrors
+    static uint32_t cachedAddress(uint32_t offset) {
+        if (offset < MEM1_SIZE) return 0x80000000 + offset;
+        if (offset < MEM1_SIZE + MEM2_SIZE) return 0x90000000 + (offset - MEM1_SIZE);
+        return LOCKED_CACHE_BASE + (offset - MEM1_SIZE - MEM2_SIZE);
+    }
+
+    static void installTrapHandler() {
+        static bool installed = false;
+        if (installed) return;
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = onTrap;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGTRAP, &sa, &previousTrap);
+        installed = true;
+    }
+
+    static inline thread_local Step steps[MAX_STEP_PAGES];
+    static inline thread_local uint32_t stepCount = 0;
+    static inline struct sigaction previousTrap;
+#endif
+
+    uint8_t* ram;
+    size_t ramSize;
+    uint8_t* arena;
+    const uint32_t* guestPC;
+    std::vector<uint8_t> pages;  // PageWatch per RAM page
+    std::vector<Watch> watches;
+    uint64_t hits;
+    bool registered;
+};
+
+class Memory {
+public:
+    // 'fastmem' = false skips the arena, so recompiled code takes the slow
+    // path for every access
+    explicit Memory(bool fastmem = true) : backing(nullptr), fastmemBase(nullptr), writeLog(nullptr) {
+        // Allocate MEM1, MEM2 and the locked cache (zero-filled by the OS)
+        allocate(fastmem);
+        hollywood.connectMemory(this);
+    }
+
+    ~Memory() {
+        if (fastmemBase) munmap(fastmemBase, FASTMEM_ARENA_SIZE);
+        if (backing) munmap(backing, BACKING_SIZE);
+    }
+
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+
+    // Base of the fastmem arena: guest address A is host address base + A
+    // for RAM; everything else (I/O, unmapped space) faults. nullptr when
+    // the arena could not be set up.
+    uint8_t* getFastmemBase() const { return fastmemBase; }
+
+    // Record every store made through write8/16/32 into 'log' (nullptr
+    // stops). Fastmem stores from compiled code bypass this.
+    void setWriteLog(std::vector<MemoryWrite>* log) { writeLog = log; }
+
+    // Log accesses to 'length' bytes of RAM at 'address': stores, or with
+    // 'access' loads as well (see Watchpoints). 'pc' is shown with hits.
+    bool addWatchpoint(uint32_t address, uint32_t length, bool access, const uint32_t* pc) {
+        uint8_t* p = getPointer(address, length);
+        if (!p || length == 0) {
+            SDL_Log("Watchpoint 0x%08X (+%u) is outside RAM", address, length);
+            return false;
+        }
+        watchpoints.setGuestPC(pc);
+        return watchpoints.add(uint32_t(p - backing), length, access, address);
+    }
+
+    const Watchpoints& getWatchpoints() const { return watchpoints; }
+
+    // Connect hardware components for I/O callbacks
+    void connectVideo(Video* v)   { hollywood.connectVideo(v); }
+    void connectAudio(Audio* a)   { hollywood.connectAudio(a); }
+    void connectInput(Input* i)   { hollywood.connectInput(i); }
+    void connectCPU(CPU* c)       { hollywood.connectCPU(c); }
+    void connectScheduler(Scheduler* s) { hollywood.connectScheduler(s); }
+
+    // Most device operations outstanding at once (see DeviceTasks)
+    size_t getDeviceTaskPeak() const { return hollywood.getDeviceTaskPeak(); }
+
+    // Save states: a RamJournal checkpoint plus the Hollywood state, valid
+    // only in this Memory. enableSaveStates() starts journaling RAM and
+    // keeps the newest 'capacity' states restorable. Compiled code's
+    // fastmem stores would bypass the journal, so it drops the fastmem
+    // arena (call before the JIT is initialised).
+    struct State {
+        uint32_t checkpoint;
+        Hollywood::State hollywood;
+    };
+
+    void enableSaveStates(uint32_t capacity) {
+        if (fastmemBase) {
+            munmap(fastmemBase, FASTMEM_ARENA_SIZE);
+            fastmemBase = nullptr;
+            watchpoints.setArena(nullptr);
+        }
+        journal.attach(backing, BACKING_SIZE, capacity);
+    }
+
+    void saveState(State& s) {
+        s.checkpoint = journal.checkpoint();
+        hollywood.saveState(s.hollywood);
+    }
+
+    // 'restored' receives the cached-mirror address of each page whose
+    // contents changed, and whose compiled code is stale, allocated from
+    // 'scratch'
+    bool restoreState(const State& s, FrameArena& scratch, RamJournal::PageList& restored) {
+        if (!journal.rollback(s.checkpoint, scratch, restored)) return false;
+        hollywood.restoreState(s.hollywood);
+        for (size_t i = 0; i < restored.count; i++) {
+            uint32_t offset = restored.pages[i] << RamJournal::PAGE_SHIFT;
+            if (offset < MEM1_SIZE) restored.pages[i] = 0x80000000 + offset;
+            else if (offset < MEM1_SIZE + MEM2_SIZE) restored.pages[i] = 0x90000000 + (offset - MEM1_SIZE);
+            else restored.pages[i] = LOCKED_CACHE_BASE + (offset - MEM1_SIZE - MEM2_SIZE);
+        }
+        return true;
+    }
+
+    // Host pointer for a RAM access of 'size' bytes, or nullptr for I/O and
+    // unmapped space. Accepts the cached (0x8/0x9) and uncached (0xC/0xD)
+    // mirrors as well as the physical addresses used with translation off.
+    uint8_t* getPointer(uint32_t address, uint32_t size = 1) {
+        uint32_t offset = address & 0x0FFFFFFF;
+        switch (address >> 28) {
+            case 0x0: case 0x8: case 0xC:  // MEM1 (24MB)
+                if (offset < MEM1_SIZE && size <= MEM1_SIZE - offset) return &mem1[offset];
+                break;
+            case 0x1: case 0x9: case 0xD:  // MEM2 (64MB)
+                if (offset < MEM2_SIZE && size <= MEM2_SIZE - offset) return &mem2[offset];
+                break;
+            case 0xE:  // locked cache scratchpad (16KB)
+                if (offset < LOCKED_CACHE_SIZE && size <= LOCKED_CACHE_SIZE - offset) return &lockedCache[offset];
+                break;
+        }
+        return nullptr;
+    }
+
+    // getPointer() for a store: the bytes are about to change
+    uint8_t* getWritePointer(uint32_t address, uint32_t size = 1) {
+        uint8_t* p = getPointer(address, size);
+        if (p) journal.preserve(p, size);
+        return p;
+    }
+
+    // Locked cache DMA: bulk copy between MEM1/MEM2 and the scratchpad.
+    // 'toCache' loads the cache from memory, otherwise the cache is stored.
+    bool lockedCacheDMA(uint32_t memAddress, uint32_t cacheAddress, uint32_t len, bool toCache) {
+        uint32_t cacheOffset = cacheAddress & (LOCKED_CACHE_SIZE - 1);
+        uint8_t* ram = getPointer(memAddress, len);
+        if (!ram || (memAddress >> 28) == 0xE || len > LOCKED_CACHE_SIZE - cacheOffset) {
+            SDL_Log("Invalid locked cache DMA: mem 0x%08X cache 0x%08X len 0x%X", memAddress, cacheAddress, len);
+            return false;
+        }
+        if (toCache) {
+            journal.preserve(&lockedCache[cacheOffset], len);
+            std::memcpy(&lockedCache[cacheOffset], ram, len);
+        } else {
+            journal.preserve(ram, len);
+            std::memcpy(ram, &lockedCache[cacheOffset], len);
+        }
+        return true;
+    }
+
+    // Bulk transfers used by the loader and DMA paths
+    bool copyToGuest(uint32_t address, const void* src, uint32_t len) {
+        uint8_t* dst = getWritePointer(address, len);
+        if (!dst) {
+            SDL_Log("Bulk write outside RAM: 0x%08X (+0x%X)", address, len);
+            return false;
+        }
+        std::memcpy(dst, src, len);
+        return true;
+    }
+
+    bool clearGuest(uint32_t address, uint32_t len) {
+        uint8_t* dst = getWritePointer(address, len);
+        if (!dst) {
+            SDL_Log("Bulk clear outside RAM: 0x%08X (+0x%X)", address, len);
+            return false;
+        }
+        std::memset(dst, 0, len);
+        return true;
+    }
+
+    // Read 32-bit word from memory or I/O (PowerPC is big-endian)
+    uint32_t read32(uint32_t address) {
+        if (const uint8_t* p = getPointer(address, 4)) {
+            // Combine 4 bytes in big-endian order
+            return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+                   (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+        // I/O or other regions
+        return readIO(address);
+    }
+
+    uint16_t read16(uint32_t address) {
+        if (const uint8_t* p = getPointer(address, 2)) {
+            return uint16_t((p[0] << 8) | p[1]);
+        }
+        // I/O registers are word-wide; pick the addressed half
+        uint32_t word = readIO(address & ~3u);
+        return uint16_t((address & 2) ? word : word >> 16);
+    }
+
+    uint8_t read8(uint32_t address) {
+        if (const uint8_t* p = getPointer(address, 1)) {
+            return *p;
+        }
+        uint32_t word = readIO(address & ~3u);
+        return uint8_t(word >> (24 - (address & 3) * 8));
+    }
+
+    // Write 32-bit word to memory or I/O (big-endian format)
+    void write32(uint32_t address, uint32_t value) {
+        if (writeLog) writeLog->push_back({address, 4, value});
+        if (uint8_t* p = getWritePointer(address, 4)) {
+            // Split value into bytes (big-endian)
+            p[0] = (value >> 24) & 0xFF;
+            p[1] = (value >> 16) & 0xFF;
+            p[2] = (value >> 8) & 0xFF;
+            p[3] = value & 0xFF;
+            return;
+        }
+        // I/O register write
+        writeIO(address, value);
+    }
+
+    void write16(uint32_t address, uint16_t value) {
+        if (writeLog) writeLog->push_back({address, 2, value});
+        if (uint8_t* p = getWritePointer(address, 2)) {
+            p[0] = value >> 8;
+            p[1] = value & 0xFF;
+            return;
+        }
+        SDL_Log("Unhandled 16-bit write to address 0x%08X: value 0x%04X", address, value);
+    }
+
+    void write8(uint32_t address, uint8_t value) {
+        if (writeLog) writeLog->push_back({address, 1, value});
+        if (uint8_t* p = getWritePointer(address, 1)) {
+            *p = value;
+            return;
+        }
+        SDL_Log("Unhandled 8-bit write to address 0x%08X: value 0x%02X", address, value);
+    }
+
+private:
+    // Memory-mapped register accesses (defined once the devices are complete)
+    uint32_t readIO(uint32_t address);
+    void writeIO(uint32_t address, uint32_t value);
+
+    // MEM1, MEM2 and the locked cache share one shared-memory object so the
+    // same pages can also be mapped at every guest alias in the arena
+    static const uint32_t BACKING_SIZE = MEM1_SIZE + MEM2_SIZE + LOCKED_CACHE_SIZE;
+
+    void allocate(bool fastmem) {
+        int fd = -1;
+#if FLAMES_JIT
+        if (fastmem) fd = memfd_create("flames-ram", MFD_CLOEXEC);
+        if (fd >= 0 && ftruncate(fd, BACKING_SIZE) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+#else
+        (void)fastmem;
+#endif
+        void* map = fd >= 0
+            ? mmap(nullptr, BACKING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+            : mmap(nullptr, BACKING_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            SDL_Log("Failed to allocate guest memory: %s", std::strerror(errno));
+            std::abort();
+        }
+        backing = static_cast<uint8_t*>(map);
+        mem1 = backing;
+        mem2 = backing + MEM1_SIZE;
+        lockedCache = mem2 + MEM2_SIZE;
+        watchpoints.attach(backing, BACKING_SIZE);
+        if (fd >= 0) {
+            mapFastmem(fd);
+            ::close(fd);
+        }
+    }
+
+    // Reserve 4GB of address space and map RAM at each guest alias
+    void mapFastmem(int fd) {
+        void* arena = mmap(nullptr, FASTMEM_ARENA_SIZE, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (arena == MAP_FAILED) {
+            SDL_Log("Fastmem arena unavailable: %s", std::strerror(errno));
+            return;
+        }
+        uint8_t* base = static_cast<uint8_t*>(arena);
+        for (const FastmemView& v : FASTMEM_VIEWS) {
+            if (mmap(base + v.address, v.size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED, fd, v.offset) == MAP_FAILED) {
+                SDL_Log("Fastmem view 0x%08X failed: %s", v.address, std::strerror(errno));
+                munmap(arena, FASTMEM_ARENA_SIZE);
+                return;
+            }
+        }
+        fastmemBase = base;
+        watchpoints.setArena(base);
+    }
+
+    uint8_t* backing;
+    uint8_t* mem1;
+    uint8_t* mem2;
+    uint8_t* lockedCache;
+    uint8_t* fastmemBase;
+    std::vector<MemoryWrite>* writeLog;
+    Hollywood hollywood;
+    RamJournal journal;
+    Watchpoints watchpoints;
+};
+
+// Video subsystem
+class Video {
+public:
+    Video() : renderer(nullptr), window(nullptr), bgColor(0x00000000) {}
+
+    bool init() {
+        // Create window with Metal backend for M1 optimization
+        window = SDL_CreateWindow("Wii Memory Emulator - 60 FPS",
+                                  SDL_WINDOWPOS_CENTERED,
+                                  SDL_WINDOWPOS_CENTERED,
+                                  854, 480,  // Wii resolution
+                                  SDL_WINDOW_SHOWN | SDL_WINDOW_ALLOW_HIGHDPI);
+        if (!window) {
+            SDL_Log("Failed to create window: %s", SDL_GetError());
+            return false;
+        }
+
+        // Create renderer with vsync for smooth 60 FPS
+        renderer = SDL_CreateRenderer(window, -1, 
+                                      SDL_RENDERER_ACCELERATED | 
+                                      SDL_RENDERER_PRESENTVSYNC);
+        if (!renderer) {
+            SDL_Log("Failed to create renderer: %s", SDL_GetError());
+            return false;
+        }
+
+        return true;
+    }
+
+    void shutdown() {
+        if (renderer) SDL_DestroyRenderer(renderer);
+        if (window) SDL_DestroyWindow(window);
+    }
+
+    void setBackgroundColor(uint32_t color) {
+        bgColor = color;
+    }
+
+    void render() {
+        TraceScope trace(TRACE_VIDEO_RENDER);
+
+        // Extract RGBA from 32-bit color
+        uint8_t r = (bgColor >> 24) & 0xFF;
+        uint8_t g = (bgColor >> 16) & 0xFF;
+        uint8_t b = (bgColor >> 8) & 0xFF;
+        uint8_t a = bgColor & 0xFF;
+
+        SDL_SetRenderDrawColor(renderer, r, g, b, a);
+        SDL_RenderClear(renderer);
+
+        // Draw some debug info
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_Rect rect = {10, 10, 200, 50};
+        SDL_RenderDrawRect(renderer, &rect);
+
+        SDL_RenderPresent(renderer);
+    }
+
+private:
+    SDL_Renderer* renderer;
+    SDL_Window* window;
+    uint32_t bgColor;
+};
+
+// Audio subsystem
+class Audio {
+public:
+    Audio() : deviceId(0), frequency(440.0), phase(0.0) {}
+
+    bool init() {
+        SDL_AudioSpec desired, obtained;
+        SDL_zero(desired);
+        desired.freq = 48000;
+        desired.format = AUDIO_F32;
+        desired.channels = 2;
+        desired.samples = 512;  // Low latency
+        desired.callback = audioCallback;
+        desired.userdata = this;
+
+        deviceId = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, 0);
+        if (deviceId == 0) {
+            SDL_Log("Failed to open audio device: %s", SDL_GetError());
+            return false;
+        }
+
+        SDL_PauseAudioDevice(deviceId, 0);  // Start playback
+        return true;
+    }
+
+    void shutdown() {
+        if (deviceId) {
+            SDL_CloseAudioDevice(deviceId);
+        }
+    }
+
+    void setToneFrequency(double freq) {
+        frequency = freq;
+    }
+
+    // Fill 'samples' interleaved stereo frames
+    void generateSamples(float* buffer, int samples) {
+        for (int i = 0; i < samples; i++) {
+            float sample = 0.0f;
+            if (frequency > 0) {
+                sample = 0.1f * sinf(phase);
+                phase += 2.0f * M_PI * frequency / 48000.0f;
+                if (phase > 2.0f * M_PI) {
+                    phase -= 2.0f * M_PI;
+                }
+            }
+            buffer[i * 2] = sample;      // left
+            buffer[i * 2 + 1] = sample;  // right
+        }
+    }
+
+private:
+    static void audioCallback(void* userdata, uint8_t* stream, int len) {
+        Audio* audio = static_cast<Audio*>(userdata);
+        ThreadRoles::enter(THREAD_AUDIO);
+        AllocCheck::Scope allocScope(THREAD_AUDIO);
+        TraceScope trace(TRACE_AUDIO_CALLBACK, uint32_t(len / sizeof(float) / 2));
+        audio->generateSamples(reinterpret_cast<float*>(stream), len / sizeof(float) / 2);  // stereo
+    }
+
+    SDL_AudioDeviceID deviceId;
+    double frequency;
+    float phase;
+};
+
+// Input subsystem
+class Input {
+public:
+    Input() : buttonState(0), movieFrame(0), recording(nullptr), netplayState(0), netplayActive(false) {}
+
+    ~Input() {
+        if (recording) std::fclose(recording);
+    }
+
+    // Play back a recorded movie instead of live input: one button word per
+    // frame in hex, one per line ('#' starts a comment). The last word holds
+    // once the movie has ended.
+    bool loadMovie(const char* path) {
+        FILE* f = std::fopen(path, "r");
+        if (!f) {
+            SDL_Log("Failed to open input movie %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        movie.clear();
+        char line[64];
+        while (std::fgets(line, sizeof(line), f)) {
+            char* end;
+            unsigned long word = std::strtoul(line, &end, 16);
+            if (end != line) movie.push_back(uint32_t(word) & ~0x80000000u);  // never the quit flag
+        }
+        std::fclose(f);
+        movieFrame = 0;
+        SDL_Log("Input movie %s: %zu frames", path, movie.size());
+        return true;
+    }
+
+    bool hasMovie() const { return !movie.empty(); }
+
+    // Write the input of every update to 'path' in the movie format, so a
+    // live session can be played back exactly with loadMovie
+    bool recordMovie(const char* path) {
+        recording = std::fopen(path, "w");
+        if (!recording) {
+            SDL_Log("Failed to create input movie %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    void update() {
+        if (!movie.empty()) {
+            if (movieFrame < movie.size()) buttonState = movie[movieFrame++];
+        } else {
+            pollEvents();
+        }
+        if (recording) std::fprintf(recording, "%08X\n", getLocalState());
+    }
+
+    // What the guest sees in REG_INPUT_STATE
+    uint32_t getButtonState() const {
+        return netplayActive ? netplayState : buttonState;
+    }
+
+    // This machine's controller, without the quit flag
+    uint32_t getLocalState() const {
+        return buttonState & ~0x80000000u;
+    }
+
+    // Show the guest every player's input for this frame instead of the
+    // local controller (see Netplay)
+    void setNetplayInput(uint32_t state) {
+        netplayState = state;
+        netplayActive = true;
+    }
+
+    bool shouldQuit() const {
+        return (buttonState & 0x80000000) != 0;
+    }
+
+private:
+    void pollEvents() {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                buttonState |= 0x80000000;  // Quit flag
+            } else if (event.type == SDL_KEYDOWN) {
+                switch (event.key.keysym.sym) {
+                    case SDLK_UP:    buttonState |= 0x00000001; break;
+                    case SDLK_DOWN:  buttonState |= 0x00000002; break;
+                    case SDLK_LEFT:  buttonState |= 0x00000004; break;
+                    case SDLK_RIGHT: buttonState |= 0x00000008; break;
+                    case SDLK_a:     buttonState |= 0x00000010; break;
+                    case SDLK_b:     buttonState |= 0x00000020; break;
+                    case SDLK_SPACE: buttonState |= 0x00000040; break;
+                }
+            } else if (event.type == SDL_KEYUP) {
+                switch (event.key.keysym.sym) {
+                    case SDLK_UP:    buttonState &= ~0x00000001; break;
+                    case SDLK_DOWN:  buttonState &= ~0x00000002; break;
+                    case SDLK_LEFT:  buttonState &= ~0x00000004; break;
+                    case SDLK_RIGHT: buttonState &= ~0x00000008; break;
+                    case SDLK_a:     buttonState &= ~0x00000010; break;
+                    case SDLK_b:     buttonState &= ~0x00000020; break;
+                    case SDLK_SPACE: buttonState &= ~0x00000040; break;
+                }
+            }
+        }
+    }
+
+    uint32_t buttonState;
+    std::vector<uint32_t> movie;
+    size_t movieFrame;
+    FILE* recording;
+    uint32_t netplayState;
+    bool netplayActive;
+};
+
+// A single Hollywood register: access width in bits, handlers and the value
+// it takes on reset
+struct HollywoodRegister {
+    uint32_t offset;
+    uint32_t width;
+    uint32_t (*read)(Hollywood&, uint32_t offset);
+    void (*write)(Hollywood&, uint32_t offset, uint32_t value);
+    uint32_t resetValue;
+};
+
+struct HollywoodMap {
+    using H = Hollywood;
+    static constexpr HollywoodRegister registers[] = {
+        // IPC with the Starlet (ARM) core
+        { HW_IPC_PPCMSG,    32, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_IPC_PPCCTRL,    6, H::readStored,     H::writeIPCControl,   0x00000000 },
+        { HW_IPC_ARMMSG,    32, H::readStored,     H::writeReadOnly,     0x00000000 },
+        { HW_IPC_ARMCTRL,    6, H::readStored,     H::writeReadOnly,     0x00000000 },
+        // Timer and alarm
+        { HW_TIMER,         32, H::readTimer,      H::writeTimer,        0x00000000 },
+        { HW_ALARM,         32, H::readStored,     H::writeAlarm,        0x00000000 },
+        // Interrupt flags (write 1 to clear) and masks
+        { HW_PPCIRQFLAG,    32, H::readStored,     H::writeIRQFlag,      0x00000000 },
+        { HW_PPCIRQMASK,    32, H::readStored,     H::writeIRQMask,      0x00000000 },
+        { HW_ARMIRQFLAG,    32, H::readStored,     H::writeIRQFlag,      0x00000000 },
+        { HW_ARMIRQMASK,    32, H::readStored,     H::writeIRQMask,      0x00000000 },
+        // AHB protection
+        { HW_SRNPROT,       32, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_AHBPROT,       32, H::readStored,     H::writeStored,       0xFFFFFFFF },
+        // GPIO: the PPC-accessible bank and the full (Starlet) bank
+        { HW_GPIOB_OUT,     24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIOB_DIR,     24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIOB_IN,      24, H::readGPIOInput,  H::writeReadOnly,     0x00000000 },
+        { HW_GPIOB_INTLVL,  24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIOB_INTFLAG, 24, H::readStored,     H::writeClearBits,    0x00000000 },
+        { HW_GPIOB_INTMASK, 24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIOB_STRAPS,  24, H::readStored,     H::writeReadOnly,     0x00000000 },
+        { HW_GPIO_ENABLE,   24, H::readStored,     H::writeStored,       0x00FFFFFF },
+        { HW_GPIO_OUT,      24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIO_DIR,      24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIO_IN,       24, H::readGPIOInput,  H::writeReadOnly,     0x00000000 },
+        { HW_GPIO_INTLVL,   24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIO_INTFLAG,  24, H::readStored,     H::writeClearBits,    0x00000000 },
+        { HW_GPIO_INTMASK,  24, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_GPIO_STRAPS,   24, H::readStored,     H::writeReadOnly,     0x00000000 },
+        { HW_GPIO_OWNER,    24, H::readStored,     H::writeStored,       0x00000000 },
+        // Reset and clock control
+        { HW_BOOT0,         32, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_CLOCKS,        32, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_RESETS,        32, H::readStored,     H::writeResets,       0x03FFFFFF },
+        { HW_PLLSYS,        32, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_PLLSYSEXT,     32, H::readStored,     H::writeStored,       0x00000000 },
+        { HW_VERSION,       32, H::readStored,     H::writeReadOnly,     0x00000011 },
+        // Emulator integration
+        { HW_FLAMES_BG_COLOR,   32, H::readStored,     H::writeVideoBgColor, 0x00000000 },
+        { HW_FLAMES_INPUT,      32, H::readInputState, H::writeReadOnly,     0x00000000 },
+        { HW_FLAMES_AUDIO_FREQ, 32, H::readStored,     H::writeAudioFreq,    0x00000000 },
+    };
+
+    static constexpr uint32_t NUM_REGISTERS = sizeof(registers) / sizeof(registers[0]);
+    static constexpr uint32_t NUM_SLOTS = HOLLYWOOD_SIZE / 4;
+    static constexpr uint8_t UNMAPPED = 0xFF;
+    static_assert(NUM_REGISTERS < UNMAPPED, "slot table uses 8-bit indices");
+
+    static constexpr uint32_t widthMask(uint32_t width) {
+        return width >= 32 ? 0xFFFFFFFFu : (1u << width) - 1;
+    }
+
+    // Word slot -> table index
+    struct SlotTable { uint8_t index[NUM_SLOTS]; };
+    // Register contents after reset
+    struct ResetImage { uint32_t value[NUM_SLOTS]; };
+
+    static const SlotTable slots;
+    static const ResetImage resetImage;
+};
+
+constexpr HollywoodMap::SlotTable buildHollywoodSlots() {
+    HollywoodMap::SlotTable t{};
+    for (uint32_t i = 0; i < HollywoodMap::NUM_SLOTS; i++) {
+        t.index[i] = HollywoodMap::UNMAPPED;
+    }
+    for (uint32_t i = 0; i < HollywoodMap::NUM_REGISTERS; i++) {
+        t.index[HollywoodMap::registers[i].offset >> 2] = uint8_t(i);
+    }
+    return t;
+}
+
+constexpr HollywoodMap::ResetImage buildHollywoodResetImage() {
+    HollywoodMap::ResetImage r{};
+    for (uint32_t i = 0; i < HollywoodMap::NUM_REGISTERS; i++) {
+        const HollywoodRegister& reg = HollywoodMap::registers[i];
+        r.value[reg.offset >> 2] = reg.resetValue & HollywoodMap::widthMask(reg.width);
+    }
+    return r;
+}
+
+constexpr HollywoodMap::SlotTable HollywoodMap::slots = buildHollywoodSlots();
+constexpr HollywoodMap::ResetImage HollywoodMap::resetImage = buildHollywoodResetImage();
+
+void Hollywood::reset() {
+    static_assert(sizeof(regs) == sizeof(HollywoodMap::resetImage.value), "reset image size");
+    std::memcpy(regs, HollywoodMap::resetImage.value, sizeof(regs));
+    timerBase = regs[HW_TIMER >> 2];
+    timerEpoch = scheduler ? scheduler->getTicks() : 0;
+    if (scheduler) scheduler->removeEvent(alarmEvent);
+    tasks.reset();
+    replyWaiterHead = replyWaiterCount = 0;
+}
+
+void Hollywood::connectScheduler(Scheduler* s) {
+    scheduler = s;
+    alarmEvent = scheduler->registerEvent("HollywoodAlarm", onAlarm, this);
+    timerEpoch = scheduler->getTicks();
+    tasks.connectScheduler(scheduler);
+}
+
+void Hollywood::saveState(State& s) const {
+    std::memcpy(s.regs, regs, sizeof(regs));
+    s.timerBase = timerBase;
+    s.timerEpoch = timerEpoch;
+    tasks.saveState(s.tasks);
+    std::copy(std::begin(replyWaiters), std::end(replyWaiters), s.replyWaiters);
+    s.replyWaiterHead = replyWaiterHead;
+    s.replyWaiterCount = replyWaiterCount;
+}
+
+void Hollywood::restoreState(const State& s) {
+    std::memcpy(regs, s.regs, sizeof(regs));
+    timerBase = s.timerBase;
+    timerEpoch = s.timerEpoch;
+    tasks.restoreState(s.tasks);
+    std::copy(std::begin(s.replyWaiters), std::end(s.replyWaiters), replyWaiters);
+    replyWaiterHead = s.replyWaiterHead;
+    replyWaiterCount = s.replyWaiterCount;
+    // Devices keep their own copies of these
+    if (video) video->setBackgroundColor(regs[HW_FLAMES_BG_COLOR >> 2]);
+    if (audio) audio->setToneFrequency(double(regs[HW_FLAMES_AUDIO_FREQ >> 2]));
+}
+
+uint32_t Hollywood::currentTimer() const {
+    uint64_t now = scheduler ? scheduler->getTicks() : timerEpoch;
+    return timerBase + uint32_t((now - timerEpoch) / HOLLYWOOD_TIMER_DIVIDER);
+}
+
+// Schedule the alarm for the next time the timer reaches HW_ALARM
+void Hollywood::scheduleAlarm() {
+    if (!scheduler) return;
+    scheduler->removeEvent(alarmEvent);
+    uint64_t elapsed = (scheduler->getTicks() - timerEpoch) / HOLLYWOOD_TIMER_DIVIDER;
+    uint32_t remaining = regs[HW_ALARM >> 2] - (timerBase + uint32_t(elapsed));
+    uint64_t matchTick = elapsed + (remaining ? remaining : (uint64_t(1) << 32));
+    scheduler->scheduleEventAt(timerEpoch + matchTick * HOLLYWOOD_TIMER_DIVIDER, alarmEvent);
+}
+
+void Hollywood::onAlarm(void* userdata, uint64_t, int64_t) {
+    Hollywood* hw = static_cast<Hollywood*>(userdata);
+    hw->raiseIRQ(HOLLYWOOD_IRQ_TIMER);
+    hw->scheduleAlarm();  // matches again after the timer wraps
+}
+
+void Hollywood::raiseIRQ(uint32_t bits) {
+    regs[HW_PPCIRQFLAG >> 2] |= bits;
+    regs[HW_ARMIRQFLAG >> 2] |= bits;
+    updateInterrupts();
+}
+
+uint32_t Hollywood::read32(uint32_t offset) {
+    uint8_t index = HollywoodMap::slots.index[(offset & (HOLLYWOOD_SIZE - 1)) >> 2];
+    if (index == HollywoodMap::UNMAPPED) {
+        SDL_Log("Unhandled read from Hollywood register 0x%03X", offset);
+        return 0;
+    }
+    const HollywoodRegister& reg = HollywoodMap::registers[index];
+    return reg.read(*this, reg.offset) & HollywoodMap::widthMask(reg.width);
+}
+
+void Hollywood::write32(uint32_t offset, uint32_t value) {
+    uint8_t index = HollywoodMap::slots.index[(offset & (HOLLYWOOD_SIZE - 1)) >> 2];
+    if (index == HollywoodMap::UNMAPPED) {
+        SDL_Log("Unhandled write to Hollywood register 0x%03X: value 0x%08X", offset, value);
+        return;
+    }
+    const HollywoodRegister& reg = HollywoodMap::registers[index];
+    reg.write(*this, reg.offset, value & HollywoodMap::widthMask(reg.width));
+}
+
+void Hollywood::writeReadOnly(Hollywood&, uint32_t offset, uint32_t value) {
+    SDL_Log("Ignoring write to read-only Hollywood register 0x%03X: value 0x%08X", offset, value);
+}
+
+// PPCCTRL: X1/X2/IY1/IY2 are set by the PPC, Y1/Y2 (ARM acknowledgements)
+// are cleared by writing 1
+void Hollywood::writeIPCControl(Hollywood& hw, uint32_t offset, uint32_t value) {
+    const uint32_t ackBits = IPC_CTRL_Y1 | IPC_CTRL_Y2;
+    uint32_t& ctrl = hw.regs[offset >> 2];
+    ctrl = (ctrl & ackBits & ~value) | (value & ~ackBits);
+    if (value & IPC_CTRL_X1) hw.tasks.start<IPCRequest>(hw, hw.regs[HW_IPC_PPCMSG >> 2]);
+    // The reply register is free again: let the oldest waiting reply in
+    if (!(ctrl & IPC_CTRL_Y1) && hw.replyWaiterCount) {
+        hw.tasks.wake(hw.replyWaiters[hw.replyWaiterHead]);
+        hw.replyWaiterHead = (hw.replyWaiterHead + 1) % DeviceTasks::MAX_TASKS;
+        hw.replyWaiterCount--;
+    }
+    hw.updateIPCInterrupt();
+}
+
+// Every outstanding task can wait here at most once, so the ring is big
+// enough
+void Hollywood::waitForReplySlot(uint32_t task) {
+    replyWaiters[(replyWaiterHead + replyWaiterCount) % DeviceTasks::MAX_TASKS] = task;
+    replyWaiterCount++;
+}
+
+void Hollywood::acknowledgeIPC() {
+    regs[HW_IPC_PPCCTRL >> 2] = (regs[HW_IPC_PPCCTRL >> 2] & ~IPC_CTRL_X1) | IPC_CTRL_Y2;
+    updateIPCInterrupt();
+}
+
+// The reply is the request block itself: IOS stores the result at +4,
+// replaces the command with 8 (reply) and moves the command to +8
+void Hollywood::replyIPC(uint32_t request) {
+    enum { IOS_OPEN = 1, IOS_REPLY = 8 };
+    const int32_t IPC_EINVAL = -4, IPC_ENOENT = -6;
+    uint32_t command = memory->read32(request);
+    int32_t result = command == IOS_OPEN ? IPC_ENOENT : IPC_EINVAL;
+    SDL_Log("IPC: IOS command %u at 0x%08X not emulated, replying %d", command, request, result);
+    memory->write32(request + 4, uint32_t(result));
+    memory->write32(request + 8, command);
+    memory->write32(request, IOS_REPLY);
+    regs[HW_IPC_ARMMSG >> 2] = request;
+    regs[HW_IPC_PPCCTRL >> 2] |= IPC_CTRL_Y1;
+    updateIPCInterrupt();
+}
+
+void Hollywood::updateIPCInterrupt() {
+    uint32_t ctrl = regs[HW_IPC_PPCCTRL >> 2];
+    if (((ctrl & IPC_CTRL_Y1) && (ctrl & IPC_CTRL_IY1)) || ((ctrl & IPC_CTRL_Y2) && (ctrl & IPC_CTRL_IY2))) {
+        raiseIRQ(HOLLYWOOD_IRQ_IPC);
+    }
+}
+
+// Clearing a reset line puts that block into reset; bit 0 resets the system
+void Hollywood::writeResets(Hollywood& hw, uint32_t offset, uint32_t value) {
+    if (!(value & 1)) {
+        SDL_Log("System reset requested through HW_RESETS");
+    }
+    hw.regs[offset >> 2] = value;
+}
+
+// Input pins read back what the output latch drives on pins set as outputs
+uint32_t Hollywood::readGPIOInput(Hollywood& hw, uint32_t offset) {
+    uint32_t out = hw.regs[(offset - 8) >> 2];
+    uint32_t dir = hw.regs[(offset - 4) >> 2];
+    return out & dir;
+}
+
+uint32_t Hollywood::readTimer(Hollywood& hw, uint32_t) {
+    return hw.currentTimer();
+}
+
+void Hollywood::writeTimer(Hollywood& hw, uint32_t, uint32_t value) {
+    hw.timerBase = value;
+    hw.timerEpoch = hw.scheduler ? hw.scheduler->getTicks() : 0;
+    hw.scheduleAlarm();
+}
+
+void Hollywood::writeAlarm(Hollywood& hw, uint32_t offset, uint32_t value) {
+    hw.regs[offset >> 2] = value;
+    hw.scheduleAlarm();
+}
+
+void Hollywood::writeIRQFlag(Hollywood& hw, uint32_t offset, uint32_t value) {
+    hw.regs[offset >> 2] &= ~value;
+    hw.updateInterrupts();
+}
+
+void Hollywood::writeIRQMask(Hollywood& hw, uint32_t offset, uint32_t value) {
+    hw.regs[offset >> 2] = value;
+    hw.updateInterrupts();
+}
+
+uint32_t Hollywood::readInputState(Hollywood& hw, uint32_t) {
+    return hw.input ? hw.input->getButtonState() : 0;
+}
+
+void Hollywood::writeVideoBgColor(Hollywood& hw, uint32_t offset, uint32_t value) {
+    hw.regs[offset >> 2] = value;
+    if (hw.video) hw.video->setBackgroundColor(value);
+}
+
+void Hollywood::writeAudioFreq(Hollywood& hw, uint32_t offset, uint32_t value) {
+    hw.regs[offset >> 2] = value;
+    if (hw.audio) hw.audio->setToneFrequency((double)value);
+}
+
+// Memory-mapped register dispatch. The uncached 0xCC/0xCD window aliases the
+// physical register space.
+uint32_t Memory::readIO(uint32_t address) {
+    if ((address & 0xF0000000) == 0xC0000000) address &= 0x0FFFFFFF;
+    if ((address & 0xFF7FFC00) == HOLLYWOOD_BASE) {
+        return hollywood.read32(address & (HOLLYWOOD_SIZE - 1));
+    }
+    SDL_Log("Unhandled read from address 0x%08X", address);
+    return 0;
+}
+
+void Memory::writeIO(uint32_t address, uint32_t value) {
+    Tracer::instant(TRACE_MMIO_WRITE, address, value);
+    if ((address & 0xF0000000) == 0xC0000000) address &= 0x0FFFFFFF;
+    if ((address & 0xFF7FFC00) == HOLLYWOOD_BASE) {
+        hollywood.write32(address & (HOLLYWOOD_SIZE - 1), value);
+        return;
+    }
+    SDL_Log("Unhandled write to address 0x%08X: value 0x%08X", address, value);
+}
+
+// Broadway clock rates
+const uint32_t CPU_CLOCK_HZ = 729000000;   // 729 MHz core
+const uint32_t BUS_CLOCK_HZ = 243000000;   // 243 MHz bus
+const uint32_t TIMEBASE_DIVIDER = 12;      // timebase ticks at bus/4
+
+// Special-purpose register numbers
+enum SPR : uint32_t {
+    SPR_XER = 1, SPR_LR = 8, SPR_CTR = 9,
+    SPR_DSISR = 18, SPR_DAR = 19, SPR_DEC = 22,
+    SPR_SRR0 = 26, SPR_SRR1 = 27,
+    SPR_TBL_READ = 268, SPR_TBU_READ = 269,
+    SPR_SPRG0 = 272, SPR_TBL_WRITE = 284, SPR_TBU_WRITE = 285, SPR_PVR = 287,
+    SPR_IBAT0U = 528, SPR_DBAT0U = 536, SPR_IBAT4U = 560, SPR_DBAT4U = 568,
+    SPR_GQR0 = 912, SPR_HID2 = 920, SPR_WPAR = 921, SPR_DMAU = 922, SPR_DMAL = 923,
+    SPR_HID0 = 1008, SPR_HID1 = 1009, SPR_HID4 = 1011, SPR_L2CR = 1017,
+};
+
+// HID2 and locked cache DMA register fields
+const uint32_t HID2_LCE         = 0x10000000;  // locked cache enable
+const uint32_t DMAL_LOAD        = 0x00000010;  // memory -> locked cache
+const uint32_t DMAL_TRIGGER     = 0x00000002;
+const uint32_t DMAL_FLUSH       = 0x00000001;
+
+// Machine state register bits
+const uint32_t MSR_EE = 0x00008000;
+const uint32_t MSR_FP = 0x00002000;
+const uint32_t MSR_IP = 0x00000040;
+const uint32_t MSR_IR = 0x00000020;
+const uint32_t MSR_DR = 0x00000010;
+const uint32_t MSR_RI = 0x00000002;
+
+// XER bits
+const uint32_t XER_SO = 0x80000000;
+const uint32_t XER_OV = 0x40000000;
+const uint32_t XER_CA = 0x20000000;
+
+// Pending exception bits
+enum Exception : uint32_t {
+    EXCEPTION_SYSCALL     = 1 << 0,
+    EXCEPTION_PROGRAM     = 1 << 1,
+    EXCEPTION_FPU_UNAVAIL = 1 << 2,
+    EXCEPTION_DECREMENTER = 1 << 3,
+    EXCEPTION_EXTERNAL    = 1 << 4,
+};
+
+// Broadway register file
+struct CPUState {
+    uint32_t gpr[32];
+    double   ps0[32];    // paired-single slot 0 (also the FPR for scalar FP)
+    double   ps1[32];    // paired-single slot 1
+    uint32_t pc;
+    uint32_t npc;
+    uint32_t cr;
+    uint32_t xer;
+    uint32_t lr;
+    uint32_t ctr;
+    uint32_t msr;
+    uint32_t fpscr;
+    uint32_t sr[16];
+    uint32_t spr[1024];
+    uint32_t exceptions;
+    uint32_t reserveAddress;
+    bool     reserve;
+};
+
+// Instruction timing. Each instruction is charged Broadway's latency for
+// it in guest cycles, with loads and stores hitting the cache. Blocks sum
+// these when they are compiled or interpreted (CPU::cycleCost), so time
+// advances once per block rather than per instruction. Every instruction
+// costs at least one cycle.
+
+// By primary opcode; 0 where it depends on the rest of the word
+constexpr uint8_t PRIMARY_CYCLES[64] = {
+    1, 1, 1, 1, 3, 1, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1,  // paired singles, mulli
+    1, 2, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,  // sc; 19 and 31 extended
+    2, 2, 2, 2, 1, 1, 1, 1, 2, 2, 2, 2, 1, 1, 0, 0,  // integer loads and stores; lmw, stmw
+    2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 0,  // FP loads and stores; 59 and 63 extended
+};
+
+// Opcode 31 by extended opcode, which is common enough to get a table
+constexpr uint8_t op31Cycles(uint32_t xo) {
+    switch (xo & 0x1FF) {                                // XO-form, without OE
+        case 11: case 75: case 235: return 5;            // mulhwu, mulhw, mullw
+        case 459: case 491: return 19;                   // divwu, divw
+    }
+    switch (xo) {
+        case 23: case 87: case 279: case 343: case 55: case 119: case 311: case 375:
+        case 534: case 790: case 535: case 567: case 599: case 631:
+            return 2;                                    // indexed loads
+        case 20: return 3;                               // lwarx
+        case 150: return 8;                              // stwcx.
+        case 533: case 597: case 661: case 725: return 8;        // string loads and stores
+        case 54: case 86: case 470: case 982: case 1014: return 3;  // dcbst dcbf dcbi icbi dcbz
+        case 598: case 566: case 306: return 3;          // sync, tlbsync, tlbie
+        case 146: case 210: case 242: case 467: return 2;        // mtmsr, mtsr, mtsrin, mtspr
+        default: return 1;
+    }
+}
+
+constexpr std::array<uint8_t, 1024> OP31_CYCLES = [] {
+    std::array<uint8_t, 1024> cycles{};
+    for (uint32_t xo = 0; xo < 1024; xo++) cycles[xo] = op31Cycles(xo);
+    return cycles;
+}();
+
+// Opcodes 19, 46, 47, 59 and 63
+inline uint32_t extendedCycles(uint32_t inst) {
+    uint32_t xo = (inst >> 1) & 0x3FF;
+    switch (inst >> 26) {
+        case 19: return xo == 50 || xo == 150 ? 2 : 1;  // rfi, isync; branches, CR logic
+        case 46: return 2 + (32 - ((inst >> 21) & 0x1F));  // lmw
+        case 47: return 1 + (32 - ((inst >> 21) & 0x1F));  // stmw
+        case 59:
+            switch (xo & 0x1F) {
+                case 18: return 17;                      // fdivs
+                case 24: return 10;                      // fres
+                default: return 3;
+            }
+        case 63:
+            switch (xo & 0x1F) {
+                case 18: return 31;                      // fdiv
+                case 25: case 28: case 29: case 30: case 31:
+                    return 4;                            // double multiply(-add)
+                default: return 3;
+            }
+        default: return 1;
+    }
+}
+
+// Processor core: interpreter for the Broadway (PowerPC 750CL) user and
+// supervisor instruction set. Paired-single (opcode 4/56-61) support is not
+// implemented yet; those opcodes (other than dcbz_l) raise a program
+// exception.
+class CPU {
+public:
+    CPU(Memory& mem, Scheduler& sched) : memory(mem), scheduler(sched), jit(nullptr), halted(true) {
+        decrementerEvent = scheduler.registerEvent("Decrementer", onDecrementer, this);
+        reset();
+    }
+
+    void reset() {
+        std::memset(&state, 0, sizeof(state));
+        state.spr[SPR_PVR] = 0x00087102;  // Broadway
+        state.msr = 0x00000040;           // exception prefix set at power-on
+        tbBase = 0;
+        tbTicks = scheduler.getTicks();
+        decValue = 0xFFFFFFFF;
+        decTicks = scheduler.getTicks();
+        scheduler.removeEvent(decrementerEvent);
+        __atomic_store_n(&halted, true, __ATOMIC_RELAXED);
+    }
+
+    // Start executing at 'entry' (used by the HLE boot path)
+    void start(uint32_t entry) {
+        state.pc = entry;
+        __atomic_store_n(&halted, false, __ATOMIC_RELAXED);
+    }
+
+    // Atomic, as the profiler's sampling thread polls it
+    bool isRunning() const { return !__atomic_load_n(&halted, __ATOMIC_RELAXED); }
+    CPUState& getState() { return state; }
+
+    // Registers and timers, for save states. The decrementer event is
+    // restored with the scheduler; compiled code is not part of it.
+    struct State {
+        CPUState state;
+        uint64_t tbBase;
+        uint64_t tbTicks;
+        uint32_t decValue;
+        uint64_t decTicks;
+        bool halted;
+    };
+
+    void saveState(State& s) const {
+        s.state = state;
+        s.tbBase = tbBase;
+        s.tbTicks = tbTicks;
+        s.decValue = decValue;
+        s.decTicks = decTicks;
+        s.halted = halted;
+    }
+
+    void restoreState(const State& s) {
+        state = s.state;
+        tbBase = s.tbBase;
+        tbTicks = s.tbTicks;
+        decValue = s.decValue;
+        decTicks = s.decTicks;
+        __atomic_store_n(&halted, s.halted, __ATOMIC_RELAXED);
+    }
+
+    // Execute through the recompiler instead of the interpreter
+    void setJIT(JIT* j) { jit = j; }
+
+    // Level-sensitive external interrupt input (Hollywood IRQ line)
+    void setExternalInterrupt(bool asserted) {
+        if (asserted) state.exceptions |= EXCEPTION_EXTERNAL;
+        else          state.exceptions &= ~EXCEPTION_EXTERNAL;
+    }
+
+    // Run for 'cycles' guest cycles. Execution is split into slices that
+    // end at the next scheduled event; with the CPU halted the scheduler
+    // jumps straight from event to event. Blocks charge their cycles to
+    // the scheduler's downcount, which is checked once per block; devices
+    // scheduling an earlier event mid-slice shorten it.
+    void run(uint64_t cycles) {
+        uint64_t target = scheduler.getTicks() + cycles;
+        scheduler.setSliceEnd(target);
+        while (scheduler.getTicks() < target) {
+            if (halted) {
+                scheduler.advanceTo(target);
+                break;
+            }
+            TraceScope trace(TRACE_CPU_SLICE, uint32_t(std::max<int64_t>(scheduler.getDowncount(), 0)));
+            while (!halted && scheduler.getDowncount() > 0) {
+                if (jit) runBlock();
+                else     interpretBlock();
+            }
+            scheduler.runDueEvents();
+            if (state.exceptions) checkExceptions();
+        }
+        scheduler.setSliceEnd(UINT64_MAX);
+    }
+
+    // Interpret one block the way the recompiler compiles it: up to
+    // MAX_BLOCK_INSTRUCTIONS, ending at a block-ending instruction, a taken
+    // branch or a synchronous exception. Its cycles are charged and
+    // exceptions taken once, at the end, so interrupts and events land at
+    // the same points as with tier 0 compiled code.
+    void interpretBlock() {
+        uint32_t cycles = 0;
+        for (uint32_t i = 0; i < MAX_BLOCK_INSTRUCTIONS; i++) {
+            uint32_t pc = state.pc, inst = memory.read32(pc);
+            state.npc = pc + 4;
+            execute(inst);
+            cycles += cycleCost(inst);
+            state.pc = state.npc;
+            if (state.npc != pc + 4 || (state.exceptions & SYNC_EXCEPTIONS) ||
+                (((MAY_END_BLOCK >> (inst >> 26)) & 1) && endsBlock(inst))) {
+                break;
+            }
+        }
+        scheduler.addTicks(cycles);
+        if (state.exceptions) checkExceptions();
+    }
+
+    // Lockstep unit (see Lockstep). With a JIT, run one compiled block;
+    // without, interpret instructions until they add up to 'cycles', the
+    // way a compiled block runs them: time advances and exceptions are
+    // taken only at the end. Costs are at least a cycle, so the same path
+    // stops at the same instruction. Events due and pending exceptions are
+    // then dispatched. Returns the cycles executed; 'instructions' is set to
+    // the number interpreted (0 with a JIT).
+    uint32_t runLockstepBlock(uint32_t cycles, uint32_t& instructions) {
+        uint64_t before = scheduler.getTicks();
+        scheduler.setSliceEnd(before + 1);  // one pass through a superblock loop
+        instructions = 0;
+        if (jit) {
+            runBlock();
+        } else {
+            uint32_t executed = 0;
+            while (executed < cycles) {
+                uint32_t inst = memory.read32(state.pc);
+                state.npc = state.pc + 4;
+                execute(inst);
+                executed += cycleCost(inst);
+                instructions++;
+                state.pc = state.npc;
+            }
+            scheduler.addTicks(executed);
+            if (state.exceptions) checkExceptions();
+        }
+        scheduler.runDueEvents();
+        if (state.exceptions) checkExceptions();
+        return uint32_t(scheduler.getTicks() - before);
+    }
+
+    void execute(uint32_t inst);
+
+    // Longest block, compiled or interpreted
+    static const uint32_t MAX_BLOCK_INSTRUCTIONS = 64;
+
+    // Exceptions an instruction raises itself, which end its block
+    static const uint32_t SYNC_EXCEPTIONS = EXCEPTION_SYSCALL | EXCEPTION_PROGRAM | EXCEPTION_FPU_UNAVAIL;
+
+    // Instructions after which a block must end
+    static bool endsBlock(uint32_t inst) {
+        uint32_t op = inst >> 26, xo = (inst >> 1) & 0x3FF;
+        switch (op) {
+            case 1: case 16: case 17: case 18: return true;          // HLE, bc, sc, b
+            case 19: return xo == 16 || xo == 528 || xo == 50 || xo == 150;  // bclr, bcctr, rfi, isync
+            case 31: return xo == 146;                               // mtmsr
+            default: return false;
+        }
+    }
+
+    // Guest cycles charged for an instruction (see the timing tables)
+    static uint32_t cycleCost(uint32_t inst) {
+        uint32_t op = inst >> 26;
+        if (op == 31) return OP31_CYCLES[(inst >> 1) & 0x3FF];
+        uint32_t cost = PRIMARY_CYCLES[op];
+        return cost ? cost : extendedCycles(inst);
+    }
+
+    // Drop recompiled code for [address, address + len) after guest code
+    // has been modified
+    void invalidateICache(uint32_t address, uint32_t len);
+
+private:
+    // Primary opcodes whose instructions may end a block (see endsBlock)
+    static const uint64_t MAY_END_BLOCK = (1ull << 1) | (1ull << 16) | (1ull << 17) | (1ull << 18) |
+                                          (1ull << 19) | (1ull << 31);
+
+    // Instruction field helpers
+    static uint32_t OPCD(uint32_t i) { return i >> 26; }
+    static uint32_t RD(uint32_t i)   { return (i >> 21) & 0x1F; }
+    static uint32_t RA(uint32_t i)   { return (i >> 16) & 0x1F; }
+    static uint32_t RB(uint32_t i)   { return (i >> 11) & 0x1F; }
+    static uint32_t RC(uint32_t i)   { return (i >> 6) & 0x1F; }
+    static uint32_t XO(uint32_t i)   { return (i >> 1) & 0x3FF; }
+    static bool     Rc(uint32_t i)   { return i & 1; }
+    static int32_t  SIMM(uint32_t i) { return int16_t(i & 0xFFFF); }
+    static uint32_t UIMM(uint32_t i) { return i & 0xFFFF; }
+
+    static uint32_t rotl(uint32_t v, uint32_t n) {
+        n &= 31;
+        return n ? (v << n) | (v >> (32 - n)) : v;
+    }
+
+    static uint32_t makeMask(uint32_t mb, uint32_t me) {
+        uint32_t begin = 0xFFFFFFFFu >> mb;
+        uint32_t end = me < 31 ? ~(0xFFFFFFFFu >> (me + 1)) : 0xFFFFFFFFu;
+        return mb <= me ? (begin & end) : (begin | end);
+    }
+
+    static uint32_t floatBits(float f)   { uint32_t u; std::memcpy(&u, &f, 4); return u; }
+    static float    bitsFloat(uint32_t u) { float f; std::memcpy(&f, &u, 4); return f; }
+    static uint64_t doubleBits(double d)  { uint64_t u; std::memcpy(&u, &d, 8); return u; }
+    static double   bitsDouble(uint64_t u) { double d; std::memcpy(&d, &u, 8); return d; }
+
+    uint32_t& gpr(uint32_t n) { return state.gpr[n]; }
+    uint32_t gprOrZero(uint32_t n) const { return n ? state.gpr[n] : 0; }
+
+    void setCRField(uint32_t field, uint32_t value) {
+        uint32_t shift = (7 - field) * 4;
+        state.cr = (state.cr & ~(0xFu << shift)) | ((value & 0xF) << shift);
+    }
+    uint32_t getCRField(uint32_t field) const {
+        return (state.cr >> ((7 - field) * 4)) & 0xF;
+    }
+    bool getCRBit(uint32_t bit) const { return (state.cr >> (31 - bit)) & 1; }
+    void setCRBit(uint32_t bit, bool v) {
+        if (v) state.cr |= 0x80000000u >> bit;
+        else   state.cr &= ~(0x80000000u >> bit);
+    }
+
+    void updateCR0(uint32_t value) {
+        int32_t s = int32_t(value);
+        uint32_t f = s < 0 ? 0x8 : (s > 0 ? 0x4 : 0x2);
+        if (state.xer & XER_SO) f |= 1;
+        setCRField(0, f);
+    }
+
+    void compare(uint32_t crf, int32_t a, int32_t b) {
+        uint32_t f = a < b ? 0x8 : (a > b ? 0x4 : 0x2);
+        if (state.xer & XER_SO) f |= 1;
+        setCRField(crf, f);
+    }
+    void compareLogical(uint32_t crf, uint32_t a, uint32_t b) {
+        uint32_t f = a < b ? 0x8 : (a > b ? 0x4 : 0x2);
+        if (state.xer & XER_SO) f |= 1;
+        setCRField(crf, f);
+    }
+
+    void setCarry(bool ca) {
+        if (ca) state.xer |= XER_CA; else state.xer &= ~XER_CA;
+    }
+    bool getCarry() const { return (state.xer & XER_CA) != 0; }
+    void setOverflow(bool ov) {
+        if (ov) state.xer |= XER_OV | XER_SO; else state.xer &= ~XER_OV;
+    }
+
+    // Shared body of the XO-form add family: rD = a + b + carryIn
+    uint32_t addWithCarry(uint32_t a, uint32_t b, uint32_t carryIn, uint32_t inst, bool updateCA) {
+        uint64_t wide = uint64_t(a) + uint64_t(b) + carryIn;
+        uint32_t result = uint32_t(wide);
+        if (updateCA) setCarry(wide >> 32);
+        if (inst & 0x400) setOverflow(((a ^ result) & (b ^ result)) >> 31);
+        if (Rc(inst)) updateCR0(result);
+        return result;
+    }
+
+    bool conditionPasses(uint32_t bo, uint32_t bi) {
+        if (!(bo & 0x04)) state.ctr--;
+        bool ctrOk = (bo & 0x04) || ((state.ctr != 0) ^ ((bo >> 1) & 1));
+        bool condOk = (bo & 0x10) || (getCRBit(bi) == ((bo >> 3) & 1));
+        return ctrOk && condOk;
+    }
+
+    uint32_t readSPR(uint32_t n);
+    void writeSPR(uint32_t n, uint32_t value);
+
+    // Timebase and decrementer are derived from the guest cycle counter
+    uint64_t readTimebase() const {
+        return tbBase + (scheduler.getTicks() - tbTicks) / TIMEBASE_DIVIDER;
+    }
+    void writeTimebase(uint64_t value) {
+        tbBase = value;
+        tbTicks = scheduler.getTicks();
+    }
+    void writeDecrementer(uint32_t value) {
+        decValue = value;
+        decTicks = scheduler.getTicks();
+        scheduler.removeEvent(decrementerEvent);
+        // Exception fires when the counter passes from 0 to -1
+        if (int32_t(value) >= 0) {
+            scheduler.scheduleEvent((uint64_t(value) + 1) * TIMEBASE_DIVIDER, decrementerEvent);
+        }
+    }
+    static void onDecrementer(void* userdata, uint64_t, int64_t) {
+        static_cast<CPU*>(userdata)->raiseException(EXCEPTION_DECREMENTER);
+    }
+
+    void raiseException(uint32_t exception) { state.exceptions |= exception; }
+    void checkExceptions();
+    void runBlock();
+    void executeHLE(uint32_t inst);
+    void enterException(uint32_t vector, uint32_t srr0, uint32_t srr1Bits);
+
+    void lockedCacheDMA();
+    void executeOp4(uint32_t inst);
+    void executeOp19(uint32_t inst);
+    void executeOp31(uint32_t inst);
+    void executeOp59(uint32_t inst);
+    void executeOp63(uint32_t inst);
+    void illegal(uint32_t inst);
+
+    void setFPRF(double value);
+    void compareFloat(uint32_t crf, double a, double b);
+    void updateCR1() { setCRField(1, state.fpscr >> 28); }
+    bool fpuAvailable() {
+        if (state.msr & MSR_FP) return true;
+        raiseException(EXCEPTION_FPU_UNAVAIL);
+        state.npc = state.pc;
+        return false;
+    }
+    static double roundSingle(double v) { return double(float(v)); }
+    // Round a finite value to an integer in the guest's FPSCR[RN] mode,
+    // not the host's
+    double roundFPSCR(double v) const {
+        switch (state.fpscr & 3) {
+            case 0:  return v - std::remainder(v, 1.0);  // nearest, ties to even
+            case 1:  return std::trunc(v);
+            case 2:  return std::ceil(v);
+            default: return std::floor(v);
+        }
+    }
+
+    Memory& memory;
+    Scheduler& scheduler;
+    JIT* jit;
+    CPUState state;
+    uint64_t tbBase;
+    uint64_t tbTicks;
+    uint32_t decValue;
+    uint64_t decTicks;
+    int decrementerEvent;
+    bool halted;
+};
+
+uint32_t CPU::readSPR(uint32_t n) {
+    switch (n) {
+        case SPR_XER: return state.xer;
+        case SPR_LR:  return state.lr;
+        case SPR_CTR: return state.ctr;
+        case SPR_DEC:
+            return decValue - uint32_t((scheduler.getTicks() - decTicks) / TIMEBASE_DIVIDER);
+        case SPR_TBL_READ: case SPR_TBL_WRITE: return uint32_t(readTimebase());
+        case SPR_TBU_READ: case SPR_TBU_WRITE: return uint32_t(readTimebase() >> 32);
+        default: return state.spr[n];
+    }
+}
+
+void CPU::writeSPR(uint32_t n, uint32_t value) {
+    switch (n) {
+        case SPR_XER: state.xer = value; break;
+        case SPR_LR:  state.lr = value; break;
+        case SPR_CTR: state.ctr = value; break;
+        case SPR_DEC: writeDecrementer(value); break;
+        case SPR_TBL_WRITE:
+            writeTimebase((readTimebase() & 0xFFFFFFFF00000000ull) | value);
+            break;
+        case SPR_TBU_WRITE:
+            writeTimebase((readTimebase() & 0xFFFFFFFFull) | (uint64_t(value) << 32));
+            break;
+        case SPR_PVR: break;  // read-only
+        case SPR_DMAL:
+            state.spr[n] = value;
+            if (value & DMAL_TRIGGER) lockedCacheDMA();
+            break;
+        default: state.spr[n] = value; break;
+    }
+}
+
+void CPU::enterException(uint32_t vector, uint32_t srr0, uint32_t srr1Bits) {
+    state.spr[SPR_SRR0] = srr0;
+    state.spr[SPR_SRR1] = (state.msr & 0x87C0FFFF) | srr1Bits;
+    state.msr &= ~0x04EF36u;
+    state.pc = ((state.msr & MSR_IP) ? 0xFFF00000 : 0) | vector;
+    state.reserve = false;
+}
+
+void CPU::checkExceptions() {
+    // Synchronous exceptions first: these were raised by the instruction
+    // that just executed, so SRR0 points past or at it.
+    uint32_t& pending = state.exceptions;
+    if (pending & EXCEPTION_SYSCALL) {
+        pending &= ~EXCEPTION_SYSCALL;
+        enterException(0xC00, state.pc, 0);
+    } else if (pending & EXCEPTION_PROGRAM) {
+        pending &= ~EXCEPTION_PROGRAM;
+        enterException(0x700, state.pc - 4, 0x00080000);
+    } else if (pending & EXCEPTION_FPU_UNAVAIL) {
+        pending &= ~EXCEPTION_FPU_UNAVAIL;
+        enterException(0x800, state.pc, 0);
+    } else if (state.msr & MSR_EE) {
+        if (pending & EXCEPTION_EXTERNAL) {
+            // Level-sensitive: stays pending until the source is cleared
+            enterException(0x500, state.pc, 0);
+        } else if (pending & EXCEPTION_DECREMENTER) {
+            pending &= ~EXCEPTION_DECREMENTER;
+            enterException(0x900, state.pc, 0);
+        }
+    }
+}
+
+void CPU::illegal(uint32_t inst) {
+    SDL_Log("Unimplemented instruction 0x%08X at 0x%08X", inst, state.pc);
+    raiseException(EXCEPTION_PROGRAM);
+}
+
+void CPU::execute(uint32_t inst) {
+    uint32_t d = RD(inst), a = RA(inst), b = RB(inst);
+    switch (OPCD(inst)) {
+        case 1:  // HLE hook (see class HLE)
+            executeHLE(inst);
+            break;
+        case 3:  // twi: traps are only used by debug builds
+            break;
+        case 4:
+            executeOp4(inst);
+            break;
+        case 7:  // mulli
+            gpr(d) = uint32_t(int32_t(gpr(a)) * SIMM(inst));
+            break;
+        case 8: {  // subfic
+            uint64_t wide = uint64_t(~gpr(a)) + uint32_t(SIMM(inst)) + 1;
+            gpr(d) = uint32_t(wide);
+            setCarry(wide >> 32);
+            break;
+        }
+        case 10:  // cmpli
+            compareLogical(d >> 2, gpr(a), UIMM(inst));
+            break;
+        case 11:  // cmpi
+            compare(d >> 2, int32_t(gpr(a)), SIMM(inst));
+            break;
+        case 12:  // addic
+        case 13: {  // addic.
+            uint32_t src = gpr(a), imm = uint32_t(SIMM(inst));
+            gpr(d) = src + imm;
+            setCarry(gpr(d) < src);
+            if (OPCD(inst) == 13) updateCR0(gpr(d));
+            break;
+        }
+        case 14:  // addi
+            gpr(d) = gprOrZero(a) + uint32_t(SIMM(inst));
+            break;
+        case 15:  // addis
+            gpr(d) = gprOrZero(a) + (UIMM(inst) << 16);
+            break;
+        case 16: {  // bc
+            if (inst & 1) state.lr = state.pc + 4;
+            if (conditionPasses(d, a)) {
+                uint32_t disp = uint32_t(int16_t(inst & 0xFFFC));
+                state.npc = (inst & 2) ? disp : state.pc + disp;
+            }
+            break;
+        }
+        case 17:  // sc
+            raiseException(EXCEPTION_SYSCALL);
+            break;
+        case 18: {  // b
+            uint32_t disp = inst & 0x03FFFFFC;
+            if (disp & 0x02000000) disp |= 0xFC000000;
+            if (inst & 1) state.lr = state.pc + 4;
+            state.npc = (inst & 2) ? disp : state.pc + disp;
+            break;
+        }
+        case 19:
+            executeOp19(inst);
+            break;
+        case 20: {  // rlwimi
+            uint32_t mask = makeMask(RC(inst), (inst >> 1) & 0x1F);
+            gpr(a) = (rotl(gpr(d), b) & mask) | (gpr(a) & ~mask);
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 21: {  // rlwinm
+            uint32_t mask = makeMask(RC(inst), (inst >> 1) & 0x1F);
+            gpr(a) = rotl(gpr(d), b) & mask;
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 23: {  // rlwnm
+            uint32_t mask = makeMask(RC(inst), (inst >> 1) & 0x1F);
+            gpr(a) = rotl(gpr(d), gpr(b)) & mask;
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 24: gpr(a) = gpr(d) | UIMM(inst); break;          // ori
+        case 25: gpr(a) = gpr(d) | (UIMM(inst) << 16); break;  // oris
+        case 26: gpr(a) = gpr(d) ^ UIMM(inst); break;          // xori
+        case 27: gpr(a) = gpr(d) ^ (UIMM(inst) << 16); break;  // xoris
+        case 28:  // andi.
+            gpr(a) = gpr(d) & UIMM(inst);
+            updateCR0(gpr(a));
+            break;
+        case 29:  // andis.
+            gpr(a) = gpr(d) & (UIMM(inst) << 16);
+            updateCR0(gpr(a));
+            break;
+        case 31:
+            executeOp31(inst);
+            break;
+
+        // Integer loads and stores (D-form)
+        case 32: gpr(d) = memory.read32(gprOrZero(a) + SIMM(inst)); break;  // lwz
+        case 33: {  // lwzu
+            uint32_t ea = gpr(a) + SIMM(inst);
+            gpr(d) = memory.read32(ea);
+            gpr(a) = ea;
+            break;
+        }
+        case 34: gpr(d) = memory.read8(gprOrZero(a) + SIMM(inst)); break;  // lbz
+        case 35: {  // lbzu
+            uint32_t ea = gpr(a) + SIMM(inst);
+            gpr(d) = memory.read8(ea);
+            gpr(a) = ea;
+            break;
+        }
+        case 36: memory.write32(gprOrZero(a) + SIMM(inst), gpr(d)); break;  // stw
+        case 37: {  // stwu
+            uint32_t ea = gpr(a) + SIMM(inst);
+            memory.write32(ea, gpr(d));
+            gpr(a) = ea;
+            break;
+        }
+        case 38: memory.write8(gprOrZero(a) + SIMM(inst), uint8_t(gpr(d))); break;  // stb
+        case 39: {  // stbu
+            uint32_t ea = gpr(a) + SIMM(inst);
+            memory.write8(ea, uint8_t(gpr(d)));
+            gpr(a) = ea;
+            break;
+        }
+        case 40: gpr(d) = memory.read16(gprOrZero(a) + SIMM(inst)); break;  // lhz
+        case 41: {  // lhzu
+            uint32_t ea = gpr(a) + SIMM(inst);
+            gpr(d) = memory.read16(ea);
+            gpr(a) = ea;
+            break;
+        }
+        case 42: gpr(d) = uint32_t(int16_t(memory.read16(gprOrZero(a) + SIMM(inst)))); break;  // lha
+        case 43: {  // lhau
+            uint32_t ea = gpr(a) + SIMM(inst);
+            gpr(d) = uint32_t(int16_t(memory.read16(ea)));
+            gpr(a) = ea;
+            break;
+        }
+        case 44: memory.write16(gprOrZero(a) + SIMM(inst), uint16_t(gpr(d))); break;  // sth
+        case 45: {  // sthu
+            uint32_t ea = gpr(a) + SIMM(inst);
+            memory.write16(ea, uint16_t(gpr(d)));
+            gpr(a) = ea;
+            break;
+        }
+        case 46: {  // lmw
+            uint32_t ea = gprOrZero(a) + SIMM(inst);
+            for (uint32_t r = d; r < 32; r++, ea += 4) gpr(r) = memory.read32(ea);
+            break;
+        }
+        case 47: {  // stmw
+            uint32_t ea = gprOrZero(a) + SIMM(inst);
+            for (uint32_t r = d; r < 32; r++, ea += 4) memory.write32(ea, gpr(r));
+            break;
+        }
+
+        // Floating-point loads and stores
+        case 48: case 49: {  // lfs, lfsu
+            if (!fpuAvailable()) break;
+            uint32_t ea = (OPCD(inst) == 49 ? gpr(a) : gprOrZero(a)) + SIMM(inst);
+            double v = bitsFloat(memory.read32(ea));
+            state.ps0[d] = v;
+            state.ps1[d] = v;
+            if (OPCD(inst) == 49) gpr(a) = ea;
+            break;
+        }
+        case 50: case 51: {  // lfd, lfdu
+            if (!fpuAvailable()) break;
+            uint32_t ea = (OPCD(inst) == 51 ? gpr(a) : gprOrZero(a)) + SIMM(inst);
+            uint64_t hi = memory.read32(ea), lo = memory.read32(ea + 4);
+            state.ps0[d] = bitsDouble((hi << 32) | lo);
+            if (OPCD(inst) == 51) gpr(a) = ea;
+            break;
+        }
+        case 52: case 53: {  // stfs, stfsu
+            if (!fpuAvailable()) break;
+            uint32_t ea = (OPCD(inst) == 53 ? gpr(a) : gprOrZero(a)) + SIMM(inst);
+            memory.write32(ea, floatBits(float(state.ps0[d])));
+            if (OPCD(inst) == 53) gpr(a) = ea;
+            break;
+        }
+        case 54: case 55: {  // stfd, stfdu
+            if (!fpuAvailable()) break;
+            uint32_t ea = (OPCD(inst) == 55 ? gpr(a) : gprOrZero(a)) + SIMM(inst);
+            uint64_t bits = doubleBits(state.ps0[d]);
+            memory.write32(ea, uint32_t(bits >> 32));
+            memory.write32(ea + 4, uint32_t(bits));
+            if (OPCD(inst) == 55) gpr(a) = ea;
+            break;
+        }
+        case 59:
+            executeOp59(inst);
+            break;
+        case 63:
+            executeOp63(inst);
+            break;
+        default:
+            illegal(inst);
+            break;
+    }
+}
+
+// Locked cache DMA. The transfer completes immediately, so the trigger bit
+// the guest polls is already clear when it next reads DMAL.
+void CPU::lockedCacheDMA() {
+    uint32_t dmaU = state.spr[SPR_DMAU], dmaL = state.spr[SPR_DMAL];
+    state.spr[SPR_DMAL] &= ~(DMAL_TRIGGER | DMAL_FLUSH);
+    if (!(state.spr[SPR_HID2] & HID2_LCE)) {
+        SDL_Log("Locked cache DMA with HID2[LCE] clear ignored");
+        return;
+    }
+    uint32_t lines = ((dmaU & 0x1F) << 2) | ((dmaL >> 2) & 3);
+    if (lines == 0) lines = 128;
+    memory.lockedCacheDMA(dmaU & ~0x1Fu, dmaL & ~0x1Fu, lines * 32, (dmaL & DMAL_LOAD) != 0);
+}
+
+// Opcode 4 holds the paired-single instructions and dcbz_l
+void CPU::executeOp4(uint32_t inst) {
+    switch (XO(inst)) {
+        case 1014:  // dcbz_l: zero a line of the locked cache
+            if (!(state.spr[SPR_HID2] & HID2_LCE)) {
+                illegal(inst);
+                break;
+            }
+            memory.clearGuest((gprOrZero(RA(inst)) + state.gpr[RB(inst)]) & ~31u, 32);
+            break;
+        default:
+            illegal(inst);
+            break;
+    }
+}
+
+void CPU::executeOp19(uint32_t inst) {
+    uint32_t d = RD(inst), a = RA(inst), b = RB(inst);
+    switch (XO(inst)) {
+        case 0:  // mcrf
+            setCRField(d >> 2, getCRField(a >> 2));
+            break;
+        case 16: {  // bclr
+            uint32_t target = state.lr & ~3u;
+            if (inst & 1) state.lr = state.pc + 4;
+            if (conditionPasses(d, a)) state.npc = target;
+            break;
+        }
+        case 528: {  // bcctr (BO[2] is always set; CTR is not decremented)
+            bool condOk = (d & 0x10) || (getCRBit(a) == ((d >> 3) & 1));
+            if (inst & 1) state.lr = state.pc + 4;
+            if (condOk) state.npc = state.ctr & ~3u;
+            break;
+        }
+        case 50:  // rfi
+            state.msr = ((state.msr & ~0x87C0FFFFu) | (state.spr[SPR_SRR1] & 0x87C0FFFF)) & ~0x00040000u;
+            state.npc = state.spr[SPR_SRR0] & ~3u;
+            break;
+        case 150:  // isync
+            break;
+        case 33:  setCRBit(d, !(getCRBit(a) || getCRBit(b))); break;  // crnor
+        case 129: setCRBit(d, getCRBit(a) && !getCRBit(b)); break;    // crandc
+        case 193: setCRBit(d, getCRBit(a) != getCRBit(b)); break;     // crxor
+        case 225: setCRBit(d, !(getCRBit(a) && getCRBit(b))); break;  // crnand
+        case 257: setCRBit(d, getCRBit(a) && getCRBit(b)); break;     // crand
+        case 289: setCRBit(d, getCRBit(a) == getCRBit(b)); break;     // creqv
+        case 417: setCRBit(d, getCRBit(a) || !getCRBit(b)); break;    // crorc
+        case 449: setCRBit(d, getCRBit(a) || getCRBit(b)); break;     // cror
+        default:
+            illegal(inst);
+            break;
+    }
+}
+
+void CPU::executeOp31(uint32_t inst) {
+    uint32_t d = RD(inst), a = RA(inst), b = RB(inst);
+    uint32_t xo = XO(inst);
+
+    // XO-form arithmetic ignores the OE bit in its extended opcode
+    switch (xo & 0x1FF) {
+        case 8: {  // subfc
+            gpr(d) = addWithCarry(~gpr(a), gpr(b), 1, inst, true);
+            return;
+        }
+        case 10:  // addc
+            gpr(d) = addWithCarry(gpr(a), gpr(b), 0, inst, true);
+            return;
+        case 11: {  // mulhwu
+            gpr(d) = uint32_t((uint64_t(gpr(a)) * gpr(b)) >> 32);
+            if (Rc(inst)) updateCR0(gpr(d));
+            return;
+        }
+        case 40:  // subf
+            gpr(d) = addWithCarry(~gpr(a), gpr(b), 1, inst, false);
+            return;
+        case 75: {  // mulhw
+            gpr(d) = uint32_t((int64_t(int32_t(gpr(a))) * int32_t(gpr(b))) >> 32);
+            if (Rc(inst)) updateCR0(gpr(d));
+            return;
+        }
+        case 104:  // neg
+            gpr(d) = addWithCarry(~gpr(a), 0, 1, inst, false);
+            return;
+        case 136:  // subfe
+            gpr(d) = addWithCarry(~gpr(a), gpr(b), getCarry(), inst, true);
+            return;
+        case 138:  // adde
+            gpr(d) = addWithCarry(gpr(a), gpr(b), getCarry(), inst, true);
+            return;
+        case 200:  // subfze
+            gpr(d) = addWithCarry(~gpr(a), 0, getCarry(), inst, true);
+            return;
+        case 202:  // addze
+            gpr(d) = addWithCarry(gpr(a), 0, getCarry(), inst, true);
+            return;
+        case 232:  // subfme
+            gpr(d) = addWithCarry(~gpr(a), 0xFFFFFFFF, getCarry(), inst, true);
+            return;
+        case 234:  // addme
+            gpr(d) = addWithCarry(gpr(a), 0xFFFFFFFF, getCarry(), inst, true);
+            return;
+        case 235: {  // mullw
+            int64_t wide = int64_t(int32_t(gpr(a))) * int32_t(gpr(b));
+            gpr(d) = uint32_t(wide);
+            if (inst & 0x400) setOverflow(wide != int64_t(int32_t(wide)));
+            if (Rc(inst)) updateCR0(gpr(d));
+            return;
+        }
+        case 266:  // add
+            gpr(d) = addWithCarry(gpr(a), gpr(b), 0, inst, false);
+            return;
+        case 459: {  // divwu
+            uint32_t divisor = gpr(b);
+            gpr(d) = divisor ? gpr(a) / divisor : 0;
+            if (inst & 0x400) setOverflow(divisor == 0);
+            if (Rc(inst)) updateCR0(gpr(d));
+            return;
+        }
+        case 491: {  // divw
+            int32_t dividend = int32_t(gpr(a)), divisor = int32_t(gpr(b));
+            bool overflow = divisor == 0 || (dividend == INT32_MIN && divisor == -1);
+            gpr(d) = overflow ? (dividend < 0 ? 0xFFFFFFFF : 0) : uint32_t(dividend / divisor);
+            if (inst & 0x400) setOverflow(overflow);
+            if (Rc(inst)) updateCR0(gpr(d));
+            return;
+        }
+    }
+
+    uint32_t ea = gprOrZero(a) + gpr(b);
+    switch (xo) {
+        case 0:  // cmp
+            compare(d >> 2, int32_t(gpr(a)), int32_t(gpr(b)));
+            break;
+        case 32:  // cmpl
+            compareLogical(d >> 2, gpr(a), gpr(b));
+            break;
+        case 4:  // tw
+            break;
+        case 19:  // mfcr
+            gpr(d) = state.cr;
+            break;
+        case 144: {  // mtcrf
+            uint32_t crm = (inst >> 12) & 0xFF, mask = 0;
+            for (int i = 0; i < 8; i++) {
+                if (crm & (0x80 >> i)) mask |= 0xF0000000u >> (i * 4);
+            }
+            state.cr = (state.cr & ~mask) | (gpr(d) & mask);
+            break;
+        }
+        case 512: {  // mcrxr
+            setCRField(d >> 2, state.xer >> 28);
+            state.xer &= 0x0FFFFFFF;
+            break;
+        }
+        case 83:  // mfmsr
+            gpr(d) = state.msr;
+            break;
+        case 146:  // mtmsr
+            state.msr = gpr(d);
+            break;
+        case 210: state.sr[(inst >> 16) & 0xF] = gpr(d); break;   // mtsr
+        case 242: state.sr[gpr(b) >> 28] = gpr(d); break;         // mtsrin
+        case 595: gpr(d) = state.sr[(inst >> 16) & 0xF]; break;   // mfsr
+        case 659: gpr(d) = state.sr[gpr(b) >> 28]; break;         // mfsrin
+        case 339: case 371: {  // mfspr, mftb
+            uint32_t n = ((inst >> 16) & 0x1F) | (((inst >> 11) & 0x1F) << 5);
+            gpr(d) = readSPR(n);
+            break;
+        }
+        case 467: {  // mtspr
+            uint32_t n = ((inst >> 16) & 0x1F) | (((inst >> 11) & 0x1F) << 5);
+            writeSPR(n, gpr(d));
+            break;
+        }
+
+        // Logical and shift operations (rS is in the rD field)
+        case 24: {  // slw
+            uint32_t n = gpr(b) & 0x3F;
+            gpr(a) = n > 31 ? 0 : gpr(d) << n;
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 536: {  // srw
+            uint32_t n = gpr(b) & 0x3F;
+            gpr(a) = n > 31 ? 0 : gpr(d) >> n;
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 792: {  // sraw
+            uint32_t n = gpr(b) & 0x3F;
+            int32_t s = int32_t(gpr(d));
+            if (n > 31) {
+                gpr(a) = s < 0 ? 0xFFFFFFFF : 0;
+                setCarry(s < 0);
+            } else {
+                gpr(a) = uint32_t(s >> n);
+                setCarry(s < 0 && n && (uint32_t(s) << (32 - n)));
+            }
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 824: {  // srawi
+            uint32_t n = b;
+            int32_t s = int32_t(gpr(d));
+            gpr(a) = uint32_t(s >> n);
+            setCarry(s < 0 && n && (uint32_t(s) << (32 - n)));
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 26: {  // cntlzw
+            uint32_t v = gpr(d), n = 0;
+            while (n < 32 && !(v & (0x80000000u >> n))) n++;
+            gpr(a) = n;
+            if (Rc(inst)) updateCR0(gpr(a));
+            break;
+        }
+        case 28:  gpr(a) = gpr(d) & gpr(b);    if (Rc(inst)) updateCR0(gpr(a)); break;  // and
+        case 60:  gpr(a) = gpr(d) & ~gpr(b);   if (Rc(inst)) updateCR0(gpr(a)); break;  // andc
+        case 124: gpr(a) = ~(gpr(d) | gpr(b)); if (Rc(inst)) updateCR0(gpr(a)); break;  // nor
+        case 284: gpr(a) = ~(gpr(d) ^ gpr(b)); if (Rc(inst)) updateCR0(gpr(a)); break;  // eqv
+        case 316: gpr(a) = gpr(d) ^ gpr(b);    if (Rc(inst)) updateCR0(gpr(a)); break;  // xor
+        case 412: gpr(a) = gpr(d) | ~gpr(b);   if (Rc(inst)) updateCR0(gpr(a)); break;  // orc
+        case 444: gpr(a) = gpr(d) | gpr(b);    if (Rc(inst)) updateCR0(gpr(a)); break;  // or
+        case 476: gpr(a) = ~(gpr(d) & gpr(b)); if (Rc(inst)) updateCR0(gpr(a)); break;  // nand
+        case 922: gpr(a) = uint32_t(int16_t(gpr(d))); if (Rc(inst)) updateCR0(gpr(a)); break;  // extsh
+        case 954: gpr(a) = uint32_t(int8_t(gpr(d)));  if (Rc(inst)) updateCR0(gpr(a)); break;  // extsb
+
+        // Indexed loads and stores
+        case 23:  gpr(d) = memory.read32(ea); break;                           // lwzx
+        case 87:  gpr(d) = memory.read8(ea); break;                            // lbzx
+        case 279: gpr(d) = memory.read16(ea); break;                           // lhzx
+        case 343: gpr(d) = uint32_t(int16_t(memory.read16(ea))); break;        // lhax
+        case 151: memory.write32(ea, gpr(d)); break;                           // stwx
+        case 215: memory.write8(ea, uint8_t(gpr(d))); break;                   // stbx
+        case 407: memory.write16(ea, uint16_t(gpr(d))); break;                 // sthx
+        case 55:  ea = gpr(a) + gpr(b); gpr(d) = memory.read32(ea); gpr(a) = ea; break;  // lwzux
+        case 119: ea = gpr(a) + gpr(b); gpr(d) = memory.read8(ea); gpr(a) = ea; break;   // lbzux
+        case 311: ea = gpr(a) + gpr(b); gpr(d) = memory.read16(ea); gpr(a) = ea; break;  // lhzux
+        case 375: ea = gpr(a) + gpr(b); gpr(d) = uint32_t(int16_t(memory.read16(ea))); gpr(a) = ea; break;  // lhaux
+        case 183: ea = gpr(a) + gpr(b); memory.write32(ea, gpr(d)); gpr(a) = ea; break;  // stwux
+        case 247: ea = gpr(a) + gpr(b); memory.write8(ea, uint8_t(gpr(d))); gpr(a) = ea; break;  // stbux
+        case 439: ea = gpr(a) + gpr(b); memory.write16(ea, uint16_t(gpr(d))); gpr(a) = ea; break;  // sthux
+        case 534: {  // lwbrx
+            uint32_t v = memory.read32(ea);
+            gpr(d) = (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+            break;
+        }
+        case 662: {  // stwbrx
+            uint32_t v = gpr(d);
+            memory.write32(ea, (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24));
+            break;
+        }
+        case 790: {  // lhbrx
+            uint16_t v = memory.read16(ea);
+            gpr(d) = uint16_t((v >> 8) | (v << 8));
+            break;
+        }
+        case 918: {  // sthbrx
+            uint16_t v = uint16_t(gpr(d));
+            memory.write16(ea, uint16_t((v >> 8) | (v << 8)));
+            break;
+        }
+        case 20:  // lwarx
+            gpr(d) = memory.read32(ea);
+            state.reserve = true;
+            state.reserveAddress = ea;
+            break;
+        case 150:  // stwcx.
+            if (state.reserve && state.reserveAddress == ea) {
+                memory.write32(ea, gpr(d));
+                setCRField(0, 0x2 | ((state.xer & XER_SO) ? 1 : 0));
+            } else {
+                setCRField(0, (state.xer & XER_SO) ? 1 : 0);
+            }
+            state.reserve = false;
+            break;
+        case 597: case 533: {  // lswi, lswx
+            uint32_t n = xo == 597 ? (b ? b : 32) : (state.xer & 0x7F);
+            if (xo == 597) ea = gprOrZero(a);
+            uint32_t r = d - 1, shift = 0;
+            while (n > 0) {
+                if (shift == 0) {
+                    r = (r + 1) & 31;
+                    gpr(r) = 0;
+                }
+                gpr(r) |= uint32_t(memory.read8(ea++)) << (24 - shift);
+                shift = (shift + 8) & 31;
+                n--;
+            }
+            break;
+        }
+        case 725: case 661: {  // stswi, stswx
+            uint32_t n = xo == 725 ? (b ? b : 32) : (state.xer & 0x7F);
+            if (xo == 725) ea = gprOrZero(a);
+            uint32_t r = d - 1, shift = 0;
+            while (n > 0) {
+                if (shift == 0) r = (r + 1) & 31;
+                memory.write8(ea++, uint8_t(gpr(r) >> (24 - shift)));
+                shift = (shift + 8) & 31;
+                n--;
+            }
+            break;
+        }
+
+        // Floating-point indexed loads and stores
+        case 535: case 567: {  // lfsx, lfsux
+            if (!fpuAvailable()) break;
+            double v = bitsFloat(memory.read32(ea));
+            state.ps0[d] = v;
+            state.ps1[d] = v;
+            if (xo == 567) gpr(a) = ea;
+            break;
+        }
+        case 599: case 631: {  // lfdx, lfdux
+            if (!fpuAvailable()) break;
+            uint64_t hi = memory.read32(ea), lo = memory.read32(ea + 4);
+            state.ps0[d] = bitsDouble((hi << 32) | lo);
+            if (xo == 631) gpr(a) = ea;
+            break;
+        }
+        case 663: case 695: {  // stfsx, stfsux
+            if (!fpuAvailable()) break;
+            memory.write32(ea, floatBits(float(state.ps0[d])));
+            if (xo == 695) gpr(a) = ea;
+            break;
+        }
+        case 727: case 759: {  // stfdx, stfdux
+            if (!fpuAvailable()) break;
+            uint64_t bits = doubleBits(state.ps0[d]);
+            memory.write32(ea, uint32_t(bits >> 32));
+            memory.write32(ea + 4, uint32_t(bits));
+            if (xo == 759) gpr(a) = ea;
+            break;
+        }
+        case 983:  // stfiwx
+            if (!fpuAvailable()) break;
+            memory.write32(ea, uint32_t(doubleBits(state.ps0[d])));
+            break;
+
+        // Cache and synchronisation: caches are not modelled
+        case 1014: {  // dcbz
+            memory.clearGuest(ea & ~31u, 32);
+            break;
+        }
+        case 982:  // icbi
+            invalidateICache(ea & ~31u, 32);
+            break;
+        case 54: case 86: case 246: case 278: case 470:  // dcbst dcbf dcbtst dcbt dcbi
+        case 598: case 854: case 566:  // sync eieio tlbsync
+        case 306:  // tlbie
+            break;
+        default:
+            illegal(inst);
+            break;
+    }
+}
+
+void CPU::setFPRF(double value) {
+    uint32_t fprf;
+    if (std::isnan(value))       fprf = 0x11;
+    else if (std::isinf(value))  fprf = value < 0 ? 0x09 : 0x05;
+    else if (value == 0)         fprf = std::signbit(value) ? 0x12 : 0x02;
+    else                         fprf = value < 0 ? 0x08 : 0x04;
+    state.fpscr = (state.fpscr & ~0x0001F000u) | (fprf << 12);
+}
+
+void CPU::compareFloat(uint32_t crf, double a, double b) {
+    uint32_t f;
+    if (std::isnan(a) || std::isnan(b)) f = 0x1;
+    else if (a < b) f = 0x8;
+    else if (a > b) f = 0x4;
+    else f = 0x2;
+    state.fpscr = (state.fpscr & ~0x0000F000u) | (f << 12);
+    setCRField(crf, f);
+}
+
+// The multiply-adds round once, as on Broadway. std::fma keeps that exact
+// whether or not the compiler would have contracted fa * fc + fb.
+void CPU::executeOp59(uint32_t inst) {
+    if (!fpuAvailable()) return;
+    uint32_t d = RD(inst), a = RA(inst), b = RB(inst), c = RC(inst);
+    double fa = state.ps0[a], fb = state.ps0[b], fc = state.ps0[c];
+    double result;
+    switch ((inst >> 1) & 0x1F) {
+        case 18: result = fa / fb; break;              // fdivs
+        case 20: result = fa - fb; break;              // fsubs
+        case 21: result = fa + fb; break;              // fadds
+        case 24: result = 1.0 / fb; break;             // fres
+        case 25: result = fa * fc; break;              // fmuls
+        case 28: result = std::fma(fa, fc, -fb); break;   // fmsubs
+        case 29: result = std::fma(fa, fc, fb); break;    // fmadds
+        case 30: result = -std::fma(fa, fc, -fb); break;  // fnmsubs
+        case 31: result = -std::fma(fa, fc, fb); break;   // fnmadds
+        default:
+            illegal(inst);
+            return;
+    }
+    result = roundSingle(result);
+    state.ps0[d] = result;
+    state.ps1[d] = result;
+    setFPRF(result);
+    if (Rc(inst)) updateCR1();
+}
+
+void CPU::executeOp63(uint32_t inst) {
+    if (!fpuAvailable()) return;
+    uint32_t d = RD(inst), a = RA(inst), b = RB(inst), c = RC(inst);
+    double fa = state.ps0[a], fb = state.ps0[b], fc = state.ps0[c];
+
+    // A-form arithmetic is keyed by the low five bits of the extended opcode
+    uint32_t aform = (inst >> 1) & 0x1F;
+    if (aform >= 18 && aform != 22 && aform != 24 && aform != 27) {
+        double result;
+        switch (aform) {
+            case 18: result = fa / fb; break;                        // fdiv
+            case 20: result = fa - fb; break;                        // fsub
+            case 21: result = fa + fb; break;                        // fadd
+            case 23: result = fa >= 0.0 ? fc : fb; break;            // fsel
+            case 25: result = fa * fc; break;                        // fmul
+            case 26: result = 1.0 / std::sqrt(fb); break;            // frsqrte
+            case 28: result = std::fma(fa, fc, -fb); break;          // fmsub
+            case 29: result = std::fma(fa, fc, fb); break;           // fmadd
+            case 30: result = -std::fma(fa, fc, -fb); break;         // fnmsub
+            case 31: result = -std::fma(fa, fc, fb); break;          // fnmadd
+            default:
+                illegal(inst);
+                return;
+        }
+        state.ps0[d] = result;
+        if (aform != 23) setFPRF(result);
+        if (Rc(inst)) updateCR1();
+        return;
+    }
+
+    switch (XO(inst)) {
+        case 0:  compareFloat(d >> 2, fa, fb); break;   // fcmpu
+        case 32: compareFloat(d >> 2, fa, fb); break;   // fcmpo
+        case 12:  // frsp
+            state.ps0[d] = roundSingle(fb);
+            setFPRF(state.ps0[d]);
+            break;
+        case 14: case 15: {  // fctiw, fctiwz
+            // NaN converts to the most negative integer, like -inf
+            int32_t value;
+            if (std::isnan(fb) || fb == -INFINITY) {
+                value = INT32_MIN;
+            } else if (fb == INFINITY) {
+                value = INT32_MAX;
+            } else {
+                double rounded = XO(inst) == 15 ? std::trunc(fb) : roundFPSCR(fb);
+                if (rounded >= 2147483648.0)       value = INT32_MAX;
+                else if (rounded < -2147483648.0)  value = INT32_MIN;
+                else                               value = int32_t(rounded);
+            }
+            state.ps0[d] = bitsDouble(0xFFF8000000000000ull | uint32_t(value));
+            break;
+        }
+        case 40:  state.ps0[d] = -fb; break;                  // fneg
+        case 72:  state.ps0[d] = fb; break;                   // fmr
+        case 136: state.ps0[d] = -std::fabs(fb); break;       // fnabs
+        case 264: state.ps0[d] = std::fabs(fb); break;        // fabs
+        case 38:  state.fpscr |= 0x80000000u >> d; break;     // mtfsb1
+        case 70:  state.fpscr &= ~(0x80000000u >> d); break;  // mtfsb0
+        case 64: {  // mcrfs
+            uint32_t shift = (7 - (a >> 2)) * 4;
+            setCRField(d >> 2, state.fpscr >> shift);
+            state.fpscr &= ~((0xFu << shift) & 0x9FF80700u);  // clear copied sticky bits
+            break;
+        }
+        case 134: {  // mtfsfi
+            uint32_t shift = (7 - (d >> 2)) * 4;
+            state.fpscr = (state.fpscr & ~(0xFu << shift)) | (((inst >> 12) & 0xF) << shift);
+            break;
+        }
+        case 583:  // mffs
+            state.ps0[d] = bitsDouble(0xFFF8000000000000ull | state.fpscr);
+            break;
+        case 711: {  // mtfsf
+            uint32_t fm = (inst >> 17) & 0xFF, mask = 0;
+            for (int i = 0; i < 8; i++) {
+                if (fm & (0x80 >> i)) mask |= 0xF0000000u >> (i * 4);
+            }
+            state.fpscr = (state.fpscr & ~mask) | (uint32_t(doubleBits(fb)) & mask);
+            break;
+        }
+        default:
+            illegal(inst);
+            return;
+    }
+    if (Rc(inst)) updateCR1();
+}
+
+void Hollywood::updateInterrupts() {
+    bool asserted = (regs[HW_PPCIRQFLAG >> 2] & regs[HW_PPCIRQMASK >> 2]) != 0;
+    if (cpu) cpu->setExternalInterrupt(asserted);
+}
+
+// Guest function symbols, loaded from a linker map or an ELF symbol
+// table. Map files may use the CodeWarrior section layout lines
+// ("00000000 000040 80003100 4 main") or plain "address size name"
+// lines; anything else is skipped.
+class SymbolDB {
+public:
+    struct Symbol {
+        uint32_t address;
+        uint32_t size;
+        std::string name;
+    };
+
+    bool loadMap(const char* path) {
+        FILE* f = std::fopen(path, "r");
+        if (!f) {
+            SDL_Log("Failed to open symbol map %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        char line[512];
+        size_t before = symbols.size();
+        while (std::fgets(line, sizeof(line), f)) {
+            char* tokens[6];
+            int count = 0;
+            for (char* t = std::strtok(line, " \t\r\n"); t && count < 6; t = std::strtok(nullptr, " \t\r\n")) {
+                tokens[count++] = t;
+            }
+            if (count < 3) continue;
+            char* end;
+            unsigned long address = std::strtoul(tokens[0], &end, 16);
+            if (*end) continue;
+            unsigned long size = std::strtoul(tokens[1], &end, 16);
+            if (*end || size == 0) continue;
+            // CodeWarrior lines start with the section offset; the virtual
+            // address follows the size
+            if (count >= 5) {
+                unsigned long virtualAddress = std::strtoul(tokens[2], &end, 16);
+                if (!*end) address = virtualAddress;
+            }
+            // The name is the first token that is not a hex field
+            int nameIndex = 2;
+            while (nameIndex < count - 1) {
+                std::strtoul(tokens[nameIndex], &end, 16);
+                if (*end) break;
+                nameIndex++;
+            }
+            add(uint32_t(address), uint32_t(size), tokens[nameIndex]);
+        }
+        std::fclose(f);
+        SDL_Log("Loaded %zu symbols from %s", symbols.size() - before, path);
+        return true;
+    }
+
+    // Function symbols from a 32-bit big-endian (PowerPC) ELF symbol table
+    bool loadELF(const char* path) {
+        FILE* f = std::fopen(path, "rb");
+        if (!f) {
+            SDL_Log("Failed to open ELF file %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        std::vector<uint8_t> data;
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+        std::fclose(f);
+
+        auto be16 = [&](size_t o) { return o + 2 <= data.size() ? uint32_t(data[o] << 8 | data[o + 1]) : 0u; };
+        auto be32 = [&](size_t o) { return o + 4 <= data.size() ? (be16(o) << 16) | be16(o + 2) : 0u; };
+        if (data.size() < 52 || std::memcmp(data.data(), "\x7F" "ELF", 4) != 0 || data[4] != 1 || data[5] != 2) {
+            SDL_Log("%s is not a 32-bit big-endian ELF file", path);
+            return false;
+        }
+        const uint32_t SHT_SYMTAB = 2, STT_FUNC = 2;
+        uint32_t shoff = be32(32), shentsize = be16(46), shnum = be16(48);
+        size_t before = symbols.size();
+        for (uint32_t i = 0; i < shnum; i++) {
+            size_t sh = size_t(shoff) + size_t(i) * shentsize;
+            if (be32(sh + 4) != SHT_SYMTAB) continue;
+            uint32_t offset = be32(sh + 16), size = be32(sh + 20), link = be32(sh + 24);
+            size_t strtab = size_t(be32(size_t(shoff) + size_t(link) * shentsize + 16));
+            for (size_t sym = offset; sym + 16 <= size_t(offset) + size && sym + 16 <= data.size(); sym += 16) {
+                uint32_t value = be32(sym + 4), symSize = be32(sym + 8);
+                size_t nameOffset = strtab + be32(sym);
+                if ((data[sym + 12] & 0xF) != STT_FUNC || symSize == 0 || nameOffset >= data.size()) continue;
+                const char* name = reinterpret_cast<const char*>(&data[nameOffset]);
+                add(value, symSize, std::string(name, strnlen(name, data.size() - nameOffset)));
+            }
+        }
+        SDL_Log("Loaded %zu symbols from %s", symbols.size() - before, path);
+        return true;
+    }
+
+    // Load an ELF symbol table or a linker map, whichever 'path' holds
+    bool load(const char* path) {
+        char magic[4] = {};
+        FILE* f = std::fopen(path, "rb");
+        if (f) {
+            size_t got = std::fread(magic, 1, sizeof(magic), f);
+            std::fclose(f);
+            if (got == 4 && std::memcmp(magic, "\x7F" "ELF", 4) == 0) return loadELF(path);
+        }
+        return loadMap(path);
+    }
+
+    void add(uint32_t address, uint32_t size, const std::string& name) {
+        symbols[address] = { address, size, name };
+    }
+
+    // Symbol containing 'address', or nullptr
+    const Symbol* lookup(uint32_t address) const {
+        auto it = symbols.upper_bound(address);
+        if (it == symbols.begin()) return nullptr;
+        --it;
+        const Symbol& s = it->second;
+        return address - s.address < s.size ? &s : nullptr;
+    }
+
+    // "name+0xoffset", or the bare address when unknown
+    std::string describe(uint32_t address) const {
+        char buffer[32];
+        const Symbol* s = lookup(address);
+        if (!s) {
+            std::snprintf(buffer, sizeof(buffer), "%08X", address);
+            return buffer;
+        }
+        if (address == s->address) return s->name;
+        std::snprintf(buffer, sizeof(buffer), "+0x%X", address - s->address);
+        return s->name + buffer;
+    }
+
+    bool empty() const { return symbols.empty(); }
+    const std::map<uint32_t, Symbol>& all() const { return symbols; }
+
+private:
+    std::map<uint32_t, Symbol> symbols;
+};
+
+// Sampling profiler for guest code. A background thread reads the guest
+// PC and LR at a fixed rate without stopping the CPU and counts each
+// (LR, PC) pair; LR stands in for a one-level call stack. The reads are
+// relaxed loads of words the CPU thread writes, so a sample may be one
+// instruction (or JIT block) stale, which sampling tolerates.
+class GuestProfiler {
+public:
+    GuestProfiler(CPU& c, const SymbolDB& syms) : cpu(c), symbols(syms), running(false), idleSamples(0) {}
+    ~GuestProfiler() { stop(); }
+
+    void start(uint32_t rateHz) {
+        if (running) return;
+        running = true;
+        thread = std::thread(&GuestProfiler::sampleLoop, this, std::max<uint32_t>(rateHz, 1));
+    }
+
+    void stop() {
+        if (!running) return;
+        running = false;
+        thread.join();
+    }
+
+    // Write '<prefix>.txt' (flat profile by function) and '<prefix>.folded'
+    // (collapsed stacks for flamegraph.pl / speedscope). Call after stop().
+    bool write(const std::string& prefix) const {
+        std::unordered_map<std::string, uint64_t> flat, folded;
+        uint64_t total = idleSamples;
+        for (const auto& entry : samples) {
+            uint32_t pc = uint32_t(entry.first), lr = uint32_t(entry.first >> 32);
+            std::string callee = functionName(pc), caller = functionName(lr);
+            flat[callee] += entry.second;
+            folded[caller + ";" + callee] += entry.second;
+            total += entry.second;
+        }
+        if (idleSamples) {
+            flat["[halted]"] += idleSamples;
+            folded["[halted]"] += idleSamples;
+        }
+
+        std::vector<std::pair<std::string, uint64_t>> sorted(flat.begin(), flat.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        });
+        FILE* f = std::fopen((prefix + ".txt").c_str(), "w");
+        if (!f) {
+            SDL_Log("Failed to open %s.txt: %s", prefix.c_str(), std::strerror(errno));
+            return false;
+        }
+        std::fprintf(f, "%12s %8s  %s\n", "samples", "percent", "function");
+        for (const auto& entry : sorted) {
+            std::fprintf(f, "%12llu %7.2f%%  %s\n", (unsigned long long)entry.second,
+                         total ? 100.0 * entry.second / total : 0.0, entry.first.c_str());
+        }
+        std::fclose(f);
+
+        f = std::fopen((prefix + ".folded").c_str(), "w");
+        if (!f) {
+            SDL_Log("Failed to open %s.folded: %s", prefix.c_str(), std::strerror(errno));
+            return false;
+        }
+        for (const auto& entry : folded) {
+            std::fprintf(f, "%s %llu\n", entry.first.c_str(), (unsigned long long)entry.second);
+        }
+        std::fclose(f);
+        SDL_Log("Wrote guest profile (%llu samples) to %s.txt and %s.folded",
+                (unsigned long long)total, prefix.c_str(), prefix.c_str());
+        return true;
+    }
+
+private:
+    void sampleLoop(uint32_t rateHz) {
+        const auto interval = std::chrono::nanoseconds(1000000000ull / rateHz);
+        ThreadRoles::enter(THREAD_PROFILER);
+        auto next = std::chrono::steady_clock::now();
+        const CPUState& state = cpu.getState();
+        while (running) {
+            next += interval;
+            std::this_thread::sleep_until(next);
+            if (!cpu.isRunning()) {
+                idleSamples++;
+                continue;
+            }
+            uint32_t pc = __atomic_load_n(&state.pc, __ATOMIC_RELAXED);
+            uint32_t lr = __atomic_load_n(&state.lr, __ATOMIC_RELAXED);
+            samples[(uint64_t(lr) << 32) | pc]++;
+        }
+        ThreadRoles::leave();
+    }
+
+    // Function name, or the address rounded to 256 bytes when unknown
+    std::string functionName(uint32_t address) const {
+        const SymbolDB::Symbol* s = symbols.lookup(address);
+        if (s) return s->name;
+        char buffer[16];
+        std::snprintf(buffer, sizeof(buffer), "%08X", address & ~0xFFu);
+        return buffer;
+    }
+
+    CPU& cpu;
+    const SymbolDB& symbols;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::unordered_map<uint64_t, uint64_t> samples;  // (LR << 32 | PC) -> count, sampler thread only
+    uint64_t idleSamples;
+};
+
+#if FLAMES_JIT
+// Describes generated code to Linux perf: /tmp/perf-<pid>.map entries and,
+// optionally, a jitdump file (/tmp/jit-<pid>.dump) that 'perf inject
+// --jit' turns into per-block symbols with the code bytes. jitdump needs
+// 'perf record -k mono' since records carry CLOCK_MONOTONIC timestamps.
+class PerfJitOutput {
+public:
+    PerfJitOutput() : mapFile(nullptr), dumpFile(nullptr), dumpMarker(nullptr), codeIndex(0) {}
+    ~PerfJitOutput() { close(); }
+
+    bool open(bool perfMap, bool jitdump) {
+        char path[64];
+        if (perfMap) {
+            std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", int(getpid()));
+            mapFile = std::fopen(path, "w");
+            if (!mapFile) {
+                SDL_Log("Failed to open %s: %s", path, std::strerror(errno));
+                return false;
+            }
+        }
+        if (jitdump) {
+            std::snprintf(path, sizeof(path), "/tmp/jit-%d.dump", int(getpid()));
+            int fd = ::open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+            if (fd < 0) {
+                SDL_Log("Failed to open %s: %s", path, std::strerror(errno));
+                return false;
+            }
+            // perf finds the dump through this executable mapping of it
+            dumpMarker = mmap(nullptr, getpagesize(), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+            if (dumpMarker == MAP_FAILED) {
+                SDL_Log("Failed to map %s: %s", path, std::strerror(errno));
+                dumpMarker = nullptr;
+                ::close(fd);
+                return false;
+            }
+            dumpFile = fdopen(fd, "wb");
+            JitdumpHeader header = { JITDUMP_MAGIC, 1, sizeof(JitdumpHeader), 62 /* EM_X86_64 */,
+                                     0, uint32_t(getpid()), timestamp(), 0 };
+            std::fwrite(&header, sizeof(header), 1, dumpFile);
+        }
+        return true;
+    }
+
+    void close() {
+        if (mapFile) std::fclose(mapFile);
+        if (dumpFile) {
+            JitdumpRecord end = { JIT_CODE_CLOSE, sizeof(JitdumpRecord), timestamp() };
+            std::fwrite(&end, sizeof(end), 1, dumpFile);
+            std::fclose(dumpFile);
+        }
+        if (dumpMarker) munmap(dumpMarker, getpagesize());
+        mapFile = nullptr;
+        dumpFile = nullptr;
+        dumpMarker = nullptr;
+    }
+
+    bool isEnabled() const { return mapFile || dumpFile; }
+
+    void recordCode(const void* code, size_t size, const std::string& name) {
+        if (mapFile) {
+            std::fprintf(mapFile, "%lx %zx %s\n", (unsigned long)reinterpret_cast<uintptr_t>(code), size, name.c_str());
+            std::fflush(mapFile);
+        }
+        if (dumpFile) {
+            uint32_t total = uint32_t(sizeof(JitdumpRecord) + sizeof(JitdumpCodeLoad) + name.size() + 1 + size);
+            JitdumpRecord record = { JIT_CODE_LOAD, total, timestamp() };
+            uint64_t address = reinterpret_cast<uint64_t>(code);
+            JitdumpCodeLoad load = { uint32_t(getpid()), uint32_t(gettid()), address, address, size, codeIndex++ };
+            std::fwrite(&record, sizeof(record), 1, dumpFile);
+            std::fwrite(&load, sizeof(load), 1, dumpFile);
+            std::fwrite(name.c_str(), name.size() + 1, 1, dumpFile);
+            std::fwrite(code, size, 1, dumpFile);
+            std::fflush(dumpFile);
+        }
+    }
+
+private:
+    static const uint32_t JITDUMP_MAGIC = 0x4A695444;  // "JiTD"
+    enum { JIT_CODE_LOAD = 0, JIT_CODE_CLOSE = 3 };
+
+    struct JitdumpHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t totalSize;
+        uint32_t elfMachine;
+        uint32_t pad;
+        uint32_t pid;
+        uint64_t timestamp;
+        uint64_t flags;
+    };
+    struct JitdumpRecord {
+        uint32_t id;
+        uint32_t totalSize;
+        uint64_t timestamp;
+    };
+    struct JitdumpCodeLoad {  // followed by the name and the code bytes
+        uint32_t pid;
+        uint32_t tid;
+        uint64_t vma;
+        uint64_t codeAddress;
+        uint64_t codeSize;
+        uint64_t codeIndex;
+    };
+
+    static uint64_t timestamp() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+    }
+
+    FILE* mapFile;
+    FILE* dumpFile;
+    void* dumpMarker;
+    uint64_t codeIndex;
+};
+#endif
+
+#if FLAMES_JIT
+// Minimal x86-64 encoder for the recompiler
+enum X64Reg {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Opcode selectors for the generic ALU encoders
+enum X64Alu : uint8_t {
+    // "op r/m32, r32" opcodes for aluRR
+    X64_ADD = 0x01, X64_OR = 0x09, X64_AND = 0x21, X64_SUB = 0x29, X64_XOR = 0x31, X64_CMP = 0x39,
+    // group-1 /digit for aluRI and aluMemImm
+    X64_ADD_IMM = 0, X64_OR_IMM = 1, X64_AND_IMM = 4, X64_SUB_IMM = 5, X64_XOR_IMM = 6, X64_CMP_IMM = 7,
+    // shift group /digit for shiftImm, group-3 /digit for unary
+    X64_ROL = 0, X64_SHL = 4, X64_SHR = 5, X64_SAR = 7,
+    X64_NOT = 2, X64_NEG = 3,
+};
+
+// Condition codes for setcc and jcc32
+enum X64Cond : uint8_t {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_S = 0x8,
+    CC_L = 0xC, CC_LE = 0xE, CC_G = 0xF,
+};
+
+class X64Emitter {
+public:
+    X64Emitter() : code(nullptr) {}
+
+    void setCodePtr(uint8_t* p) { code = p; }
+    uint8_t* getCodePtr() const { return code; }
+
+    void emit8(uint8_t v)   { *code++ = v; }
+    void emit32(uint32_t v) { std::memcpy(code, &v, 4); code += 4; }
+    void emit64(uint64_t v) { std::memcpy(code, &v, 8); code += 8; }
+    void emitBytes(std::initializer_list<uint8_t> bytes) {
+        for (uint8_t b : bytes) emit8(b);
+    }
+
+    void push(X64Reg r) { if (r >= 8) emit8(0x41); emit8(0x50 + (r & 7)); }
+    void pop(X64Reg r)  { if (r >= 8) emit8(0x41); emit8(0x58 + (r & 7)); }
+    void ret()          { emit8(0xC3); }
+    void nop()          { emit8(0x90); }
+
+    void movImm64(X64Reg r, uint64_t imm) {
+        emit8(0x48 | (r >> 3));
+        emit8(0xB8 + (r & 7));
+        emit64(imm);
+    }
+    void movImm32(X64Reg r, uint32_t imm) {
+        if (r >= 8) emit8(0x41);
+        emit8(0xB8 + (r & 7));
+        emit32(imm);
+    }
+    // 32-bit register <- [base + disp]
+    void load32(X64Reg r, X64Reg base, int32_t disp)  { rex(false, r, base); emit8(0x8B); modrm(r, base, disp); }
+    // [base + disp] <- 32-bit register
+    void store32(X64Reg base, int32_t disp, X64Reg r) { rex(false, r, base); emit8(0x89); modrm(r, base, disp); }
+    void storeImm32(X64Reg base, int32_t disp, uint32_t imm) {
+        rex(false, RAX, base);
+        emit8(0xC7);
+        modrm(RAX, base, disp);
+        emit32(imm);
+    }
+    // 32-bit register += [base + disp]
+    void addMem32(X64Reg r, X64Reg base, int32_t disp) { rex(false, r, base); emit8(0x03); modrm(r, base, disp); }
+    void addImm32(X64Reg r, int32_t imm) {
+        rex(false, RAX, r);
+        emit8(0x81);
+        emit8(0xC0 | (r & 7));
+        emit32(uint32_t(imm));
+    }
+    // qword [base + disp] += imm
+    void addMemImm64(X64Reg base, int32_t disp, int32_t imm) {
+        rex(true, RAX, base);
+        emit8(0x81);
+        modrm(RAX, base, disp);
+        emit32(uint32_t(imm));
+    }
+    void movReg64(X64Reg dst, X64Reg src) {
+        emit8(0x48 | ((src >> 3) << 2) | (dst >> 3));
+        emit8(0x89);
+        emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+    void movReg32(X64Reg dst, X64Reg src) {
+        if (dst >= 8 || src >= 8) emit8(0x40 | ((src >> 3) << 2) | (dst >> 3));
+        emit8(0x89);
+        emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+    void xorReg32(X64Reg dst, X64Reg src) {
+        if (dst >= 8 || src >= 8) emit8(0x40 | ((dst >> 3) << 2) | (src >> 3));
+        emit8(0x33);
+        emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+    void testReg32(X64Reg a, X64Reg b) {
+        if (a >= 8 || b >= 8) emit8(0x40 | ((b >> 3) << 2) | (a >> 3));
+        emit8(0x85);
+        emit8(0xC0 | ((b & 7) << 3) | (a & 7));
+    }
+    void movsx16(X64Reg dst, X64Reg src) {  // dst = sign-extended low 16 bits of src
+        if (dst >= 8 || src >= 8) emit8(0x40 | ((dst >> 3) << 2) | (src >> 3));
+        emitBytes({0x0F, 0xBF});
+        emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+    void subRsp(uint8_t n) { emitBytes({0x48, 0x83, 0xEC, n}); }
+    void addRsp(uint8_t n) { emitBytes({0x48, 0x83, 0xC4, n}); }
+    void callReg(X64Reg r) {
+        if (r >= 8) emit8(0x41);
+        emit8(0xFF);
+        emit8(0xD0 | (r & 7));
+    }
+    void callAbs(const void* fn) {
+        movImm64(RAX, reinterpret_cast<uint64_t>(fn));
+        callReg(RAX);
+    }
+    void callRel(const uint8_t* target) {
+        emit8(0xE8);
+        emit32(uint32_t(target - (code + 4)));
+    }
+    // Forward branches: returns the rel32 field to patch with setJumpTarget
+    uint8_t* jnz32() { emitBytes({0x0F, 0x85}); emit32(0); return code - 4; }
+    uint8_t* jmp32() { emit8(0xE9); emit32(0); return code - 4; }
+    void jmpTo(const uint8_t* target) {
+        emit8(0xE9);
+        emit32(uint32_t(target - (code + 4)));
+    }
+    void setJumpTarget(uint8_t* rel32) {
+        uint32_t rel = uint32_t(code - (rel32 + 4));
+        std::memcpy(rel32, &rel, 4);
+    }
+
+    // Register-register ALU op in the "op r/m32, r32" form
+    void aluRR(uint8_t opcode, X64Reg dst, X64Reg src) {
+        if (dst >= 8 || src >= 8) emit8(0x40 | ((src >> 3) << 2) | (dst >> 3));
+        emit8(opcode);
+        emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+    // Group-1 ALU op with a 32-bit immediate, 'digit' selects the op
+    void aluRI(uint8_t digit, X64Reg dst, uint32_t imm) {
+        if (dst >= 8) emit8(0x41);
+        emit8(0x81);
+        emit8(0xC0 | (digit << 3) | (dst & 7));
+        emit32(imm);
+    }
+    void aluMemImm(uint8_t digit, X64Reg base, int32_t disp, uint32_t imm) {
+        rex(false, RAX, base);
+        emit8(0x81);
+        modrm(digit, base, disp);
+        emit32(imm);
+    }
+    // [base + disp] |= 32-bit register
+    void orMem32(X64Reg base, int32_t disp, X64Reg r) { rex(false, r, base); emit8(0x09); modrm(r, base, disp); }
+    void testMemImm(X64Reg base, int32_t disp, uint32_t imm) {
+        rex(false, RAX, base);
+        emit8(0xF7);
+        modrm(0, base, disp);
+        emit32(imm);
+    }
+    void testRI(X64Reg r, uint32_t imm) {
+        if (r >= 8) emit8(0x41);
+        emit8(0xF7);
+        emit8(0xC0 | (r & 7));
+        emit32(imm);
+    }
+    void imulRR(X64Reg dst, X64Reg src) {
+        if (dst >= 8 || src >= 8) emit8(0x40 | ((dst >> 3) << 2) | (src >> 3));
+        emitBytes({0x0F, 0xAF});
+        emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+    void imulRRI(X64Reg dst, X64Reg src, uint32_t imm) {
+        if (dst >= 8 || src >= 8) emit8(0x40 | ((dst >> 3) << 2) | (src >> 3));
+        emit8(0x69);
+        emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+        emit32(imm);
+    }
+    // Shift or rotate by an immediate count, 'digit' selects the op
+    void shiftImm(uint8_t digit, X64Reg r, uint8_t n) {
+        if (r >= 8) emit8(0x41);
+        emit8(0xC1);
+        emit8(0xC0 | (digit << 3) | (r & 7));
+        emit8(n);
+    }
+    // Group-3 unary op (not, neg)
+    void unary(uint8_t digit, X64Reg r) {
+        if (r >= 8) emit8(0x41);
+        emit8(0xF7);
+        emit8(0xC0 | (digit << 3) | (r & 7));
+    }
+    void movsx8(X64Reg dst, X64Reg src) {  // REX always, so SIL/DIL encode
+        emit8(0x40 | ((dst >> 3) << 2) | (src >> 3));
+        emitBytes({0x0F, 0xBE});
+        emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+    void setcc(uint8_t cc, X64Reg r) {     // REX always, so SIL/DIL encode
+        emit8(0x40 | (r >> 3));
+        emitBytes({0x0F, uint8_t(0x90 + cc)});
+        emit8(0xC0 | (r & 7));
+    }
+    void load64(X64Reg r, X64Reg base, int32_t disp)  { rex(true, r, base); emit8(0x8B); modrm(r, base, disp); }
+    void cmp64Mem(X64Reg r, X64Reg base, int32_t disp) { rex(true, r, base); emit8(0x3B); modrm(r, base, disp); }
+    uint8_t* jcc32(uint8_t cc) { emitBytes({0x0F, uint8_t(0x80 + cc)}); emit32(0); return code - 4; }
+
+private:
+    void rex(bool w, int reg, int base) {
+        uint8_t r = 0x40 | (w ? 8 : 0) | ((reg >> 3) << 2) | (base >> 3);
+        if (r != 0x40) emit8(r);
+    }
+    void modrm(int reg, int base, int32_t disp) {
+        uint8_t mod = (disp == 0 && (base & 7) != RBP) ? 0x00 : (disp >= -128 && disp < 128 ? 0x40 : 0x80);
+        emit8(mod | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) emit8(0x24);
+        if (mod == 0x40) emit8(uint8_t(disp));
+        else if (mod == 0x80) emit32(uint32_t(disp));
+    }
+
+    uint8_t* code;
+};
+
+// Decoded form of a host memory access the fault handler can emulate:
+// mov/movzx loads and mov stores with a [base + index*scale + disp] operand
+struct HostAccess {
+    uint32_t length;     // instruction bytes
+    uint32_t size;       // access bytes
+    bool     store;
+    int      reg;        // value register
+    int      base;       // -1 if none
+    int      index;      // -1 if none
+    uint32_t scale;
+    int32_t  disp;
+};
+
+static bool decodeHostAccess(const uint8_t* p, HostAccess& out) {
+    const uint8_t* start = p;
+    bool opsize16 = false;
+    uint8_t rex = 0;
+    if (*p == 0x66) { opsize16 = true; p++; }
+    if ((*p & 0xF0) == 0x40) rex = *p++;
+    if (rex & 0x08) return false;  // 64-bit accesses are never emitted
+    switch (*p++) {
+        case 0x8B: out.store = false; out.size = opsize16 ? 2 : 4; break;
+        case 0x89: out.store = true;  out.size = opsize16 ? 2 : 4; break;
+        case 0x88: out.store = true;  out.size = 1; break;
+        case 0x0F:
+            if (*p == 0xB6)      out.size = 1;
+            else if (*p == 0xB7) out.size = 2;
+            else return false;
+            p++;
+            out.store = false;
+            break;
+        default:
+            return false;
+    }
+    uint8_t modrm = *p++;
+    uint32_t mod = modrm >> 6, rm = modrm & 7;
+    if (mod == 3) return false;
+    out.reg = ((modrm >> 3) & 7) | ((rex & 0x04) ? 8 : 0);
+    out.index = -1;
+    out.scale = 1;
+    if (rm == 4) {
+        uint8_t sib = *p++;
+        uint32_t index = ((sib >> 3) & 7) | ((rex & 0x02) ? 8 : 0);
+        out.scale = 1u << (sib >> 6);
+        out.index = index == RSP ? -1 : int(index);
+        out.base = (sib & 7) | ((rex & 0x01) ? 8 : 0);
+        if (mod == 0 && (sib & 7) == RBP) out.base = -1;
+    } else {
+        if (mod == 0 && rm == RBP) return false;  // RIP-relative
+        out.base = rm | ((rex & 0x01) ? 8 : 0);
+    }
+    out.disp = 0;
+    if (mod == 1) {
+        out.disp = int8_t(*p++);
+    } else if (mod == 2 || (mod == 0 && out.base < 0)) {
+        int32_t d;
+        std::memcpy(&d, p, 4);
+        out.disp = d;
+        p += 4;
+    }
+    out.length = uint32_t(p - start);
+    return true;
+}
+
+// ucontext register slots in x86 encoding order
+static const int HOST_GREG[16] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+// Block recompiler. Guest loads and stores become a single host access
+// through the fastmem arena; instructions without a native implementation
+// call the interpreter. An arena access that faults (MMIO, unmapped space)
+// is emulated by the signal handler through the Memory slow path, and the
+// access site is then backpatched to call the slow path directly.
+class JIT {
+public:
+    JIT(CPU& c, Memory& mem, Scheduler& sched)
+        : cpu(c), memory(mem), scheduler(sched), codeBuffer(nullptr), trampolinesEnd(nullptr),
+          perf(nullptr), symbols(nullptr), tiering(true), gprDirty(0) {
+        std::fill(gprHost, gprHost + 32, int8_t(-1));
+    }
+
+    ~JIT() { shutdown(); }
+
+    bool init() {
+        void* buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            SDL_Log("Failed to allocate JIT code buffer: %s", std::strerror(errno));
+            return false;
+        }
+        codeBuffer = static_cast<uint8_t*>(buffer);
+        if (memory.getFastmemBase()) {
+            FaultHandler::add(handleFault, this);
+        } else {
+            SDL_Log("Fastmem unavailable; JIT memory accesses use the slow path");
+        }
+        clearCache();
+        traceScratch.reserve(MAX_TRACE_INSTRUCTIONS);
+        return true;
+    }
+
+    void shutdown() {
+        if (!codeBuffer) return;
+        FaultHandler::remove(this);
+        munmap(codeBuffer, CODE_BUFFER_SIZE);
+        codeBuffer = nullptr;
+    }
+
+    // Report generated code to perf, naming blocks from 'syms' (either may
+    // be null). Set before init() so the trampolines are included.
+    void setProfilingOutput(PerfJitOutput* output, const SymbolDB* syms) {
+        perf = output;
+        symbols = syms;
+    }
+
+    // Whether hot blocks are promoted to tier 1 superblocks. Superblocks
+    // run through conditional branches and only reach the scheduler at
+    // their exits, so where events land depends on when promotion happened,
+    // which depends on run history and the JIT cache. Without them every
+    // run of the same code takes the same steps (see
+    // WiiEmulator::setDeterministic).
+    void setTiering(bool enabled) { tiering = enabled; }
+
+    // Execute one block at state.pc, compiling it first if needed and
+    // promoting it to tier 1 once it is hot
+    void runBlock() {
+        CPUState& state = cpu.getState();
+        const JitBlock* block = lookup(state.pc);
+        if (!block) {
+            block = compile(state.pc);
+        } else if (tiering && block->tier == 0 && ++lookup(state.pc)->executions >= HOT_THRESHOLD) {
+            block = compileOptimized(state.pc, block->numInstructions, block->contentHash);
+        }
+        reinterpret_cast<BlockEntry>(block->code)(&state, &cpu);
+    }
+
+    // FNV-1a over guest words, used for block contents and executables
+    static uint64_t hashGuest(Memory& memory, uint32_t address, uint32_t size,
+                              uint64_t hash = 0xCBF29CE484222325ull) {
+        for (uint32_t i = 0; i < size; i += 4) {
+            hash ^= memory.read32(address + i);
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // Persistent block cache. Generated code embeds this process's
+    // addresses, so what persists is the block analysis: start, length
+    // and a hash of the guest words each block was compiled from. On load
+    // every block whose words still hash the same is compiled up front,
+    // so a warm start does not stall on first-time compiles. The file is
+    // keyed by executable hash (in its name) and build id (in its header).
+    bool loadCache(const char* path, uint64_t executableHash) {
+        auto start = std::chrono::high_resolution_clock::now();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(CacheHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            SDL_Log("Failed to map JIT cache %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        const CacheHeader* header = static_cast<const CacheHeader*>(map);
+        const CacheEntry* entries = reinterpret_cast<const CacheEntry*>(header + 1);
+        bool valid = header->magic == CACHE_MAGIC && header->buildId == buildId() &&
+                     header->executableHash == executableHash &&
+                     header->count <= (size_t(st.st_size) - sizeof(CacheHeader)) / sizeof(CacheEntry);
+        uint32_t compiled = 0;
+        if (valid) {
+            // Check the guest words in parallel; compiling stays serial
+            std::vector<uint8_t> unchanged(header->count);
+            JobSystem::parallelFor(header->count, 1024, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    const CacheEntry& e = entries[i];
+                    unchanged[i] = e.numInstructions != 0 && e.numInstructions <= MAX_BLOCK_INSTRUCTIONS &&
+                                   hashGuest(memory, e.start, e.numInstructions * 4) == e.contentHash;
+                }
+            });
+            for (uint32_t i = 0; i < header->count; i++) {
+                const CacheEntry& e = entries[i];
+                if (!unchanged[i] || lookup(e.start)) continue;
+                if ((e.flags & CACHE_HOT) && tiering) compileOptimized(e.start, e.numInstructions, e.contentHash);
+                else compile(e.start);
+                compiled++;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - start).count();
+            SDL_Log("JIT cache: precompiled %u of %u blocks in %.2f ms", compiled, header->count, elapsed / 1000.0);
+        } else {
+            SDL_Log("JIT cache %s is stale; it will be rebuilt", path);
+        }
+        munmap(map, st.st_size);
+        return valid;
+    }
+
+    bool saveCache(const char* path, uint64_t executableHash) const {
+        // Per process, as batch instances may save the same cache at once
+        std::string temp = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+        FILE* f = std::fopen(temp.c_str(), "wb");
+        if (!f) {
+            SDL_Log("Failed to write JIT cache %s: %s", temp.c_str(), std::strerror(errno));
+            return false;
+        }
+        CacheHeader header = { CACHE_MAGIC, uint32_t(blocks.size()), buildId(), executableHash };
+        std::fwrite(&header, sizeof(header), 1, f);
+        for (const auto& entry : blocks) {
+            const JitBlock& b = entry.second;
+            CacheEntry e = { b.start, uint16_t(b.numInstructions), uint16_t(b.tier ? CACHE_HOT : 0), b.contentHash };
+            std::fwrite(&e, sizeof(e), 1, f);
+        }
+        bool ok = std::fclose(f) == 0 && std::rename(temp.c_str(), path) == 0;
+        if (ok) SDL_Log("JIT cache: saved %zu blocks to %s", blocks.size(), path);
+        return ok;
+    }
+
+    // Drop compiled blocks overlapping [address, address + len)
+    void invalidate(uint32_t address, uint32_t len) {
+        auto it = blocks.lower_bound(address >= MAX_BLOCK_BYTES ? address - MAX_BLOCK_BYTES : 0);
+        while (it != blocks.end() && it->first < address + len) {
+            if (it->second.high > address) it = eraseBlock(it);
+            else ++it;
+        }
+        // Superblocks can start anywhere and still include this range
+        for (auto s = superblocks.begin(); s != superblocks.end();) {
+            auto b = blocks.find(*s);
+            if (b == blocks.end() || b->second.tier == 0) {
+                s = superblocks.erase(s);
+            } else if (b->second.low < address + len && b->second.high > address) {
+                eraseBlock(b);
+                s = superblocks.erase(s);
+            } else {
+                ++s;
+            }
+        }
+    }
+
+private:
+    typedef void (*BlockEntry)(CPUState* state, CPU* cpu);
+
+    struct JitBlock {
+        uint32_t start;
+        uint32_t end;               // guest address past the last tier 0 instruction
+        uint32_t numInstructions;   // tier 0 length
+        uint64_t contentHash;       // guest words the tier 0 block was compiled from
+        const uint8_t* code;
+        uint32_t tier;
+        uint32_t executions;        // tier 0 runs, counted towards HOT_THRESHOLD
+        uint32_t low, high;         // bounds of all guest code compiled in
+    };
+
+    // A patchable fastmem access. The faulting instruction is at 'fault';
+    // the whole site (access plus byte swap) spans [start, start + length).
+    enum SiteKind { LOAD8, LOAD16, LOAD32, STORE8, STORE16, STORE32, NUM_SITE_KINDS };
+    struct FastmemSite {
+        uint8_t* start;
+        uint8_t length;
+        SiteKind kind;
+    };
+
+    static const size_t CODE_BUFFER_SIZE = 64 * 1024 * 1024;
+    static const size_t CODE_HEADROOM = 256 * 1024;  // worst-case block size
+    static const uint32_t MAX_BLOCK_INSTRUCTIONS = CPU::MAX_BLOCK_INSTRUCTIONS;
+    static const uint32_t MAX_TRACE_INSTRUCTIONS = 256;
+    static const uint32_t HOT_THRESHOLD = 256;
+    static const uint32_t MAX_BLOCK_BYTES = MAX_BLOCK_INSTRUCTIONS * 4;
+    static const uint32_t FAST_LOOKUP_SIZE = 1 << 16;
+
+    static const uint32_t CACHE_MAGIC = 0x434A4C46;  // "FLJC"
+
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t count;
+        uint64_t buildId;
+        uint64_t executableHash;
+    };
+    struct CacheEntry {
+        uint32_t start;
+        uint16_t numInstructions;
+        uint16_t flags;
+        uint64_t contentHash;
+    };
+    static const uint16_t CACHE_HOT = 1;  // block had been promoted to tier 1
+
+    // Changes whenever the emulator is rebuilt
+    static uint64_t buildId() {
+        static const char id[] = __DATE__ " " __TIME__;
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (const char* c = id; *c; c++) {
+            hash ^= uint8_t(*c);
+            hash *= 0x100000001B3ull;
+        }
+        return hash ^ (sizeof(CPUState) << 32) ^ MAX_BLOCK_INSTRUCTIONS;
+    }
+
+    // Registers pinned for the duration of a block
+    static const X64Reg STATE = RBX;   // CPUState*
+    static const X64Reg CPUREG = R12;  // CPU*
+    static const X64Reg FASTMEM = R15; // arena base
+    // Host registers guest GPRs are allocated to in superblocks: those the
+    // prologue saves, then ones the trampolines preserve
+    static constexpr X64Reg ALLOCATABLE[] = { RBP, R13, R14, R8, R9, R10, R11 };
+    // Fastmem site operands: address in ECX, value in EAX (loads) / EDX (stores)
+
+    static int32_t gprOffset(uint32_t r) { return int32_t(offsetof(CPUState, gpr) + r * 4); }
+    static int32_t pcOffset() { return int32_t(offsetof(CPUState, pc)); }
+    static int32_t crOffset() { return int32_t(offsetof(CPUState, cr)); }
+    static int32_t xerOffset() { return int32_t(offsetof(CPUState, xer)); }
+    static int32_t lrOffset() { return int32_t(offsetof(CPUState, lr)); }
+    static int32_t ctrOffset() { return int32_t(offsetof(CPUState, ctr)); }
+    static int32_t exceptionsOffset() { return int32_t(offsetof(CPUState, exceptions)); }
+
+    JitBlock* lookup(uint32_t pc) {
+        JitBlock* b = fastLookup[(pc >> 2) & (FAST_LOOKUP_SIZE - 1)];
+        if (b && b->start == pc) return b;
+        auto it = blocks.find(pc);
+        return it != blocks.end() ? &it->second : nullptr;
+    }
+
+    std::map<uint32_t, JitBlock>::iterator eraseBlock(std::map<uint32_t, JitBlock>::iterator it) {
+        JitBlock*& slot = fastLookup[(it->first >> 2) & (FAST_LOOKUP_SIZE - 1)];
+        if (slot == &it->second) slot = nullptr;
+        return blocks.erase(it);
+    }
+
+    void clearCache() {
+        blocks.clear();
+        superblocks.clear();
+        sites.clear();
+        std::memset(fastLookup, 0, sizeof(fastLookup));
+        emitter.setCodePtr(codeBuffer);
+        emitTrampolines();
+    }
+
+    // Slow-path helpers called from the trampolines
+    static uint32_t slowRead8(Memory* m, uint32_t a)  { return m->read8(a); }
+    static uint32_t slowRead16(Memory* m, uint32_t a) { return m->read16(a); }
+    static uint32_t slowRead32(Memory* m, uint32_t a) { return m->read32(a); }
+    static void slowWrite8(Memory* m, uint32_t a, uint32_t v)  { m->write8(a, uint8_t(v)); }
+    static void slowWrite16(Memory* m, uint32_t a, uint32_t v) { m->write16(a, uint16_t(v)); }
+    static void slowWrite32(Memory* m, uint32_t a, uint32_t v) { m->write32(a, v); }
+
+    // One trampoline per site kind: preserves every caller-saved register
+    // except the load result, calls the slow path with (Memory*, ECX, EDX)
+    void emitTrampolines() {
+        const void* helpers[NUM_SITE_KINDS] = {
+            (void*)slowRead8, (void*)slowRead16, (void*)slowRead32,
+            (void*)slowWrite8, (void*)slowWrite16, (void*)slowWrite32,
+        };
+        const X64Reg saved[] = { RCX, RDX, RSI, RDI, R8, R9, R10, R11 };
+        for (int kind = 0; kind < NUM_SITE_KINDS; kind++) {
+            bool store = kind >= STORE8;
+            trampolines[kind] = emitter.getCodePtr();
+            if (store) emitter.push(RAX);
+            for (X64Reg r : saved) emitter.push(r);
+            // Entry is 8 mod 16; 8 pushes keep that, 9 realign
+            if (!store) emitter.subRsp(8);
+            emitter.movImm64(RDI, reinterpret_cast<uint64_t>(&memory));
+            emitter.movReg32(RSI, RCX);
+            emitter.callAbs(helpers[kind]);
+            if (!store) emitter.addRsp(8);
+            for (int i = 7; i >= 0; i--) emitter.pop(saved[i]);
+            if (store) emitter.pop(RAX);
+            emitter.ret();
+        }
+        trampolinesEnd = emitter.getCodePtr();
+        if (perf) {
+            perf->recordCode(trampolines[0], size_t(trampolinesEnd - trampolines[0]), "JIT slow-path trampolines");
+        }
+    }
+
+    // Emit an access site. With fastmem it is the direct access plus byte
+    // swap, recorded for backpatching; without, it is the patched form.
+    void emitSite(SiteKind kind) {
+        static const uint8_t lengths[NUM_SITE_KINDS] = { 5, 9, 6, 5, 9, 6 };
+        uint8_t* start = emitter.getCodePtr();
+        if (!memory.getFastmemBase()) {
+            writeSlowCall(start, kind, lengths[kind]);
+            emitter.setCodePtr(start + lengths[kind]);
+            return;
+        }
+        uint8_t* fault = start;
+        switch (kind) {
+            case LOAD8:   emitter.emitBytes({0x41, 0x0F, 0xB6, 0x04, 0x0F}); break;  // movzx eax, byte [r15+rcx]
+            case LOAD16:  emitter.emitBytes({0x41, 0x0F, 0xB7, 0x04, 0x0F,           // movzx eax, word [r15+rcx]
+                                             0x66, 0xC1, 0xC0, 0x08}); break;        // rol ax, 8
+            case LOAD32:  emitter.emitBytes({0x41, 0x8B, 0x04, 0x0F,                 // mov eax, [r15+rcx]
+                                             0x0F, 0xC8}); break;                    // bswap eax
+            case STORE8:  emitter.emitBytes({0x41, 0x88, 0x14, 0x0F, 0x90}); break;  // mov [r15+rcx], dl; nop
+            case STORE16: emitter.emitBytes({0x66, 0xC1, 0xC2, 0x08,                 // rol dx, 8
+                                             0x66, 0x41, 0x89, 0x14, 0x0F}); fault = start + 4; break;
+            case STORE32: emitter.emitBytes({0x0F, 0xCA,                             // bswap edx
+                                             0x41, 0x89, 0x14, 0x0F}); fault = start + 2; break;  // mov [r15+rcx], edx
+            default: break;
+        }
+        sites[fault] = { start, lengths[kind], kind };
+    }
+
+    // Replace a site with a call to its trampoline, padded with NOPs
+    void writeSlowCall(uint8_t* start, SiteKind kind, uint8_t length) {
+        X64Emitter patch;
+        patch.setCodePtr(start);
+        patch.callRel(trampolines[kind]);
+        while (patch.getCodePtr() < start + length) patch.nop();
+    }
+
+    // SIGSEGV from a fastmem site: emulate the whole site through the slow
+    // path, resume after it, and backpatch it so it never faults again.
+    // Faults on watched RAM are left to Watchpoints, and the site stays
+    // fast for every other address.
+    static bool handleFault(void* userdata, siginfo_t* info, ucontext_t* context) {
+        JIT* jit = static_cast<JIT*>(userdata);
+        greg_t* regs = context->uc_mcontext.gregs;
+        uint8_t* rip = reinterpret_cast<uint8_t*>(regs[REG_RIP]);
+        uint8_t* arena = jit->memory.getFastmemBase();
+        uint8_t* faultAddress = static_cast<uint8_t*>(info->si_addr);
+        if (rip < jit->codeBuffer || rip >= jit->codeBuffer + CODE_BUFFER_SIZE ||
+            faultAddress < arena || faultAddress >= arena + FASTMEM_ARENA_SIZE ||
+            jit->memory.getWatchpoints().covers(faultAddress)) {
+            return false;
+        }
+        auto it = jit->sites.find(rip);
+        HostAccess access;
+        if (it == jit->sites.end() || !decodeHostAccess(rip, access)) {
+            return false;
+        }
+
+        uint64_t hostAddress = uint64_t(access.disp);
+        if (access.base >= 0)  hostAddress += uint64_t(regs[HOST_GREG[access.base]]);
+        if (access.index >= 0) hostAddress += uint64_t(regs[HOST_GREG[access.index]]) * access.scale;
+        uint32_t address = uint32_t(hostAddress - reinterpret_cast<uint64_t>(arena));
+
+        Memory& memory = jit->memory;
+        greg_t& value = regs[HOST_GREG[access.reg]];
+        if (access.store) {
+            // Store sites have already swapped the value into memory order
+            uint32_t v = uint32_t(value);
+            switch (access.size) {
+                case 1: memory.write8(address, uint8_t(v)); break;
+                case 2: memory.write16(address, uint16_t((v >> 8) | (v << 8))); break;
+                default: memory.write32(address, __builtin_bswap32(v)); break;
+            }
+        } else {
+            // Load sites produce the byte-swapped result
+            switch (access.size) {
+                case 1: value = memory.read8(address); break;
+                case 2: value = memory.read16(address); break;
+                default: value = memory.read32(address); break;
+            }
+        }
+
+        FastmemSite site = it->second;
+        jit->sites.erase(it);
+        jit->writeSlowCall(site.start, site.kind, site.length);
+        regs[REG_RIP] = greg_t(site.start + site.length);
+        return true;
+    }
+
+    // Called from compiled code for instructions without a native
+    // implementation. Returns nonzero when the block has to exit.
+    static uint32_t interpret(CPU* cpu, uint32_t inst, uint32_t pc) {
+        CPUState& s = cpu->getState();
+        s.pc = pc;
+        s.npc = pc + 4;
+        cpu->execute(inst);
+        s.pc = s.npc;
+        return (s.npc != pc + 4) || (s.exceptions & CPU::SYNC_EXCEPTIONS);
+    }
+
+    static bool endsBlock(uint32_t inst) { return CPU::endsBlock(inst); }
+
+    void emitPrologue() {
+        emitter.push(RBX);
+        emitter.push(RBP);
+        emitter.push(R12);
+        emitter.push(R13);
+        emitter.push(R14);
+        emitter.push(R15);
+        emitter.subRsp(8);
+        emitter.movReg64(STATE, RDI);
+        emitter.movReg64(CPUREG, RSI);
+        if (memory.getFastmemBase()) {
+            emitter.movImm64(FASTMEM, reinterpret_cast<uint64_t>(memory.getFastmemBase()));
+        }
+    }
+
+    // Charge 'cycles' (see CPU::cycleCost) to the downcount and return to
+    // the dispatcher
+    void emitExit(uint32_t cycles) {
+        if (cycles) {
+            emitter.movImm64(RAX, reinterpret_cast<uint64_t>(scheduler.getDowncountPointer()));
+            emitter.addMemImm64(RAX, 0, -int32_t(cycles));
+        }
+        emitter.addRsp(8);
+        emitter.pop(R15);
+        emitter.pop(R14);
+        emitter.pop(R13);
+        emitter.pop(R12);
+        emitter.pop(RBP);
+        emitter.pop(RBX);
+        emitter.ret();
+    }
+
+    // Guest registers whose values are known at compile time (tier 1).
+    // Known values are still stored to CPUState; the knowledge only lets
+    // later instructions fold them.
+    struct ConstState {
+        bool known[32];
+        uint32_t value[32];
+
+        void clear() { std::memset(known, 0, sizeof(known)); }
+        bool get(uint32_t r, uint32_t& v) const {
+            if (!known[r]) return false;
+            v = value[r];
+            return true;
+        }
+    };
+
+    // ECX = rA|0 + displacement, or rA|0 + rB for indexed forms. Operands
+    // known in 'consts' (tier 1 only) are folded in.
+    void emitEffectiveAddress(uint32_t ra, int32_t disp, int rb, const ConstState* consts) {
+        uint32_t base = 0, index = uint32_t(disp);
+        bool baseKnown = ra == 0 || (consts && consts->get(ra, base));
+        bool indexKnown = rb < 0 || (consts && consts->get(uint32_t(rb), index));
+        if (baseKnown) emitter.movImm32(RCX, indexKnown ? base + index : base);
+        else           loadGPR(RCX, ra);
+        if (!indexKnown) addGPR(RCX, uint32_t(rb));
+        else if (!baseKnown && index) emitter.addImm32(RCX, int32_t(index));
+    }
+
+    struct LoadStore {
+        SiteKind kind;
+        bool update;
+        bool signExtend;
+        int rb;  // -1 for D-form
+    };
+
+    // Integer loads and stores with a native implementation
+    static bool decodeLoadStore(uint32_t inst, LoadStore& ls) {
+        uint32_t op = inst >> 26, rd = (inst >> 21) & 0x1F, ra = (inst >> 16) & 0x1F;
+        ls.rb = -1;
+        ls.update = false;
+        ls.signExtend = false;
+        switch (op) {
+            case 32: ls.kind = LOAD32; break;                     // lwz
+            case 33: ls.kind = LOAD32; ls.update = true; break;   // lwzu
+            case 34: ls.kind = LOAD8; break;                      // lbz
+            case 35: ls.kind = LOAD8; ls.update = true; break;    // lbzu
+            case 36: ls.kind = STORE32; break;                    // stw
+            case 37: ls.kind = STORE32; ls.update = true; break;  // stwu
+            case 38: ls.kind = STORE8; break;                     // stb
+            case 39: ls.kind = STORE8; ls.update = true; break;   // stbu
+            case 40: ls.kind = LOAD16; break;                     // lhz
+            case 41: ls.kind = LOAD16; ls.update = true; break;   // lhzu
+            case 42: ls.kind = LOAD16; ls.signExtend = true; break;                     // lha
+            case 43: ls.kind = LOAD16; ls.signExtend = true; ls.update = true; break;   // lhau
+            case 44: ls.kind = STORE16; break;                    // sth
+            case 45: ls.kind = STORE16; ls.update = true; break;  // sthu
+            case 31: {
+                ls.rb = int((inst >> 11) & 0x1F);
+                switch ((inst >> 1) & 0x3FF) {
+                    case 23:  ls.kind = LOAD32; break;                       // lwzx
+                    case 55:  ls.kind = LOAD32; ls.update = true; break;     // lwzux
+                    case 87:  ls.kind = LOAD8; break;                        // lbzx
+                    case 119: ls.kind = LOAD8; ls.update = true; break;      // lbzux
+                    case 279: ls.kind = LOAD16; break;                       // lhzx
+                    case 311: ls.kind = LOAD16; ls.update = true; break;     // lhzux
+                    case 343: ls.kind = LOAD16; ls.signExtend = true; break; // lhax
+                    case 375: ls.kind = LOAD16; ls.signExtend = true; ls.update = true; break;  // lhaux
+                    case 151: ls.kind = STORE32; break;                      // stwx
+                    case 183: ls.kind = STORE32; ls.update = true; break;    // stwux
+                    case 215: ls.kind = STORE8; break;                       // stbx
+                    case 247: ls.kind = STORE8; ls.update = true; break;     // stbux
+                    case 407: ls.kind = STORE16; break;                      // sthx
+                    case 439: ls.kind = STORE16; ls.update = true; break;    // sthux
+                    default: return false;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+        // Update forms with rA = 0 (or rA = rD for loads) are invalid; leave
+        // them to the interpreter
+        return !(ls.update && (ra == 0 || (ls.kind <= LOAD32 && ra == rd)));
+    }
+
+    // Native integer loads and stores. Returns false for anything else.
+    bool compileLoadStore(uint32_t inst, ConstState* consts = nullptr) {
+        LoadStore ls;
+        if (!decodeLoadStore(inst, ls)) return false;
+        uint32_t rd = (inst >> 21) & 0x1F, ra = (inst >> 16) & 0x1F;
+
+        emitEffectiveAddress(ra, int16_t(inst & 0xFFFF), ls.rb, consts);
+        if (ls.kind >= STORE8) {
+            uint32_t value;
+            if (consts && consts->get(rd, value)) emitter.movImm32(RDX, value);
+            else loadGPR(RDX, rd);
+        }
+        emitSite(ls.kind);
+        if (ls.kind <= LOAD32) {
+            if (ls.signExtend) emitter.movsx16(RAX, RAX);
+            storeGPR(rd, RAX);
+            if (consts) consts->known[rd] = false;
+        }
+        if (ls.update) {
+            storeGPR(ra, RCX);
+            if (consts) consts->known[ra] = false;
+        }
+        return true;
+    }
+
+    // Call the interpreter for one instruction. Unless the instruction ends
+    // the block, leave early when it raised an exception or branched,
+    // charging 'cycles' for the block up to here. The interpreter works on
+    // CPUState, so allocated registers are written back before the call and
+    // reloaded after it.
+    void emitInterpreterCall(uint32_t inst, uint32_t address, uint32_t cycles) {
+        flushGPRs();
+        emitter.movReg64(RDI, CPUREG);
+        emitter.movImm32(RSI, inst);
+        emitter.movImm32(RDX, address);
+        emitter.callAbs((const void*)interpret);
+        if (!endsBlock(inst)) {
+            emitter.testReg32(RAX, RAX);
+            uint8_t* skip = emitter.jnz32();
+            uint8_t* over = emitter.jmp32();
+            emitter.setJumpTarget(skip);
+            emitExit(cycles);
+            emitter.setJumpTarget(over);
+            reloadGPRs();
+        }
+    }
+
+    // Guest GPR access. Inside a superblock the most used GPRs live in host
+    // registers (gprHost); everything else, and all of tier 0, goes through
+    // CPUState.
+    void loadGPR(X64Reg dst, uint32_t r) {
+        if (gprHost[r] >= 0) emitter.movReg32(dst, X64Reg(gprHost[r]));
+        else emitter.load32(dst, STATE, gprOffset(r));
+    }
+
+    void storeGPR(uint32_t r, X64Reg src) {
+        if (gprHost[r] >= 0) {
+            emitter.movReg32(X64Reg(gprHost[r]), src);
+            gprDirty |= 1u << r;
+        } else {
+            emitter.store32(STATE, gprOffset(r), src);
+        }
+    }
+
+    void storeGPRImm(uint32_t r, uint32_t v) {
+        if (gprHost[r] >= 0) {
+            emitter.movImm32(X64Reg(gprHost[r]), v);
+            gprDirty |= 1u << r;
+        } else {
+            emitter.storeImm32(STATE, gprOffset(r), v);
+        }
+    }
+
+    void addGPR(X64Reg dst, uint32_t r) {
+        if (gprHost[r] >= 0) emitter.aluRR(X64_ADD, dst, X64Reg(gprHost[r]));
+        else emitter.addMem32(dst, STATE, gprOffset(r));
+    }
+
+    // Write modified allocated registers back to CPUState. The dirty set is
+    // kept: this is used on exit paths the rest of the trace does not take.
+    void flushGPRs() {
+        for (uint32_t r = 0; r < 32; r++) {
+            if (gprDirty & (1u << r)) emitter.store32(STATE, gprOffset(r), X64Reg(gprHost[r]));
+        }
+    }
+
+    void reloadGPRs() {
+        for (uint32_t r = 0; r < 32; r++) {
+            if (gprHost[r] >= 0) emitter.load32(X64Reg(gprHost[r]), STATE, gprOffset(r));
+        }
+        gprDirty = 0;
+    }
+
+    const JitBlock* compile(uint32_t pc) {
+        if (size_t(emitter.getCodePtr() - codeBuffer) > CODE_BUFFER_SIZE - CODE_HEADROOM) {
+            clearCache();
+        }
+        uint8_t* entry = emitter.getCodePtr();
+        emitPrologue();
+
+        uint32_t address = pc, count = 0, cycles = 0;
+        bool pcWritten = false;
+        while (count < MAX_BLOCK_INSTRUCTIONS) {
+            uint32_t inst = memory.read32(address);
+            count++;
+            cycles += CPU::cycleCost(inst);
+            pcWritten = false;
+            if (!compileLoadStore(inst)) {
+                emitInterpreterCall(inst, address, cycles);
+                pcWritten = true;
+            }
+            address += 4;
+            if (endsBlock(inst)) break;
+        }
+        if (!pcWritten) emitter.storeImm32(STATE, pcOffset(), address);
+        emitExit(cycles);
+
+        JitBlock& block = blocks[pc];
+        block = { pc, address, count, hashGuest(memory, pc, count * 4), entry, 0, 0, pc, address };
+        fastLookup[(pc >> 2) & (FAST_LOOKUP_SIZE - 1)] = &block;
+        recordBlock(block);
+        return &block;
+    }
+
+    void recordBlock(const JitBlock& block) {
+        if (!perf) return;
+        char name[32];
+        std::snprintf(name, sizeof(name), block.tier ? "PPC:%08X (tier 1)" : "PPC:%08X", block.start);
+        std::string label = name;
+        if (symbols && symbols->lookup(block.start)) label += " " + symbols->describe(block.start);
+        perf->recordCode(block.code, size_t(emitter.getCodePtr() - block.code), label);
+    }
+
+    // Tier 1. Blocks that have run HOT_THRESHOLD times are recompiled as
+    // superblocks: the trace follows unconditional branches and runs
+    // through conditional ones, which leave through side exits when taken.
+    // A branch back to the start loops in native code while the slice has
+    // time left. Common integer instructions are compiled natively with
+    // constant propagation, and CR field or XER[CA] results that are
+    // overwritten before anything can read them are not computed.
+    struct TraceInst {
+        uint32_t address;
+        uint32_t inst;
+        bool followed;  // unconditional branch continued in the trace
+        bool crDead;    // CR field result overwritten before any read
+        bool caDead;    // XER[CA] result overwritten before any read
+    };
+
+    static uint32_t branchTarget(uint32_t address, uint32_t inst) {
+        if ((inst >> 26) == 18) return address + uint32_t(int32_t(inst << 6) >> 6 & ~3);
+        return address + uint32_t(int32_t(int16_t(inst & 0xFFFC)));
+    }
+
+    static bool isConditionalBranch(uint32_t inst) {
+        return (inst >> 26) == 16 && !(inst & 2) && ((inst >> 21) & 0x14) != 0x14;
+    }
+
+    // Integer instructions compileALU implements
+    static bool isNativeALU(uint32_t inst) {
+        switch (inst >> 26) {
+            case 7: case 10: case 11: case 12: case 13: case 14: case 15:
+            case 21: case 24: case 25: case 26: case 27: case 28: case 29:
+                return true;
+            case 31:
+                switch ((inst >> 1) & 0x3FF) {
+                    case 0: case 28: case 32: case 40: case 60: case 104: case 124: case 235:
+                    case 266: case 316: case 444: case 824: case 922: case 954:
+                        return true;
+                    case 339: case 467: {  // mfspr/mtspr of LR and CTR
+                        uint32_t n = ((inst >> 16) & 0x1F) | ((inst >> 6) & 0x3E0);
+                        return n == SPR_LR || n == SPR_CTR;
+                    }
+                    default:
+                        return false;
+                }
+            default:
+                return false;
+        }
+    }
+
+    // CR field a native instruction writes, or -1
+    static int crFieldWritten(uint32_t inst) {
+        uint32_t op = inst >> 26, xo = (inst >> 1) & 0x3FF;
+        if (op == 10 || op == 11 || (op == 31 && (xo == 0 || xo == 32))) return int((inst >> 23) & 7);
+        if (op == 13 || op == 28 || op == 29 || ((op == 21 || op == 31) && (inst & 1))) return 0;
+        return -1;
+    }
+
+    static bool writesCA(uint32_t inst) {
+        uint32_t op = inst >> 26;
+        return op == 12 || op == 13 || (op == 31 && ((inst >> 1) & 0x3FF) == 824);
+    }
+
+    // Decode the superblock starting at 'pc'. 'next' receives the address
+    // execution falls through to after the last instruction.
+    // Fills 'trace', whose capacity is kept between compiles so a tier-up
+    // in the middle of a frame does not allocate
+    void decodeTrace(uint32_t pc, uint32_t& next, std::vector<TraceInst>& trace) {
+        trace.clear();
+        auto visited = [&trace](uint32_t address) {
+            return std::any_of(trace.begin(), trace.end(), [address](const TraceInst& t) { return t.address == address; });
+        };
+        uint32_t address = pc;
+        while (trace.size() < MAX_TRACE_INSTRUCTIONS && !visited(address)) {
+            uint32_t inst = memory.read32(address);
+            trace.push_back({address, inst, false, false, false});
+            if ((inst >> 26) == 18 && !(inst & 2)) {
+                uint32_t target = branchTarget(address, inst);
+                if (target == pc || visited(target)) break;
+                trace.back().followed = true;
+                address = target;
+                continue;
+            }
+            address += 4;
+            if (!isConditionalBranch(inst) && endsBlock(inst)) break;
+        }
+        next = address;
+    }
+
+    // Backward liveness of CR fields and XER[CA]. Exits, branches and
+    // interpreted instructions may read either, so they make all live.
+    static void analyzeTrace(std::vector<TraceInst>& trace) {
+        uint32_t crLive = 0xFF;  // bit 7 - f for field f
+        bool caLive = true;
+        LoadStore ls;
+        for (size_t i = trace.size(); i-- > 0;) {
+            TraceInst& t = trace[i];
+            if (t.followed || decodeLoadStore(t.inst, ls)) continue;
+            if (!isNativeALU(t.inst)) {
+                crLive = 0xFF;
+                caLive = true;
+                continue;
+            }
+            int field = crFieldWritten(t.inst);
+            if (field >= 0) {
+                t.crDead = !(crLive & (0x80u >> field));
+                crLive &= ~(0x80u >> field);
+            }
+            if (writesCA(t.inst)) {
+                t.caDead = !caLive;
+                caLive = false;
+            }
+        }
+    }
+
+    // GPRs a natively compiled instruction reads and writes, as bit masks
+    static void gprUses(uint32_t inst, uint32_t& reads, uint32_t& writes) {
+        uint32_t op = inst >> 26, xo = (inst >> 1) & 0x3FF;
+        uint32_t d = 1u << ((inst >> 21) & 0x1F), a = 1u << ((inst >> 16) & 0x1F), b = 1u << ((inst >> 11) & 0x1F);
+        uint32_t aOrZero = (inst >> 16) & 0x1F ? a : 0;
+        LoadStore ls;
+        reads = writes = 0;
+        if (decodeLoadStore(inst, ls)) {
+            reads = aOrZero | (ls.rb >= 0 ? b : 0) | (ls.kind >= STORE8 ? d : 0);
+            writes = (ls.kind <= LOAD32 ? d : 0) | (ls.update ? a : 0);
+            return;
+        }
+        switch (op) {
+            case 7: case 12: case 13: reads = a; writes = d; break;
+            case 10: case 11:         reads = a; break;
+            case 14: case 15:         reads = aOrZero; writes = d; break;
+            case 21: case 24: case 25: case 26: case 27: case 28: case 29:
+                reads = d; writes = a; break;
+            case 31:
+                switch (xo) {
+                    case 0: case 32:                reads = a | b; break;
+                    case 40: case 235: case 266:    reads = a | b; writes = d; break;
+                    case 104:                       reads = a; writes = d; break;
+                    case 28: case 60: case 124: case 316: case 444:
+                                                    reads = d | b; writes = a; break;
+                    case 824: case 922: case 954:   reads = d; writes = a; break;
+                    case 339:                       writes = d; break;
+                    case 467:                       reads = d; break;
+                }
+                break;
+        }
+    }
+
+    // Pin the GPRs native code in the trace uses most to host registers.
+    // Returns the allocated registers the trace may modify.
+    uint32_t allocateRegisters(const std::vector<TraceInst>& trace) {
+        uint32_t uses[32] = {}, written = 0;
+        LoadStore ls;
+        for (const TraceInst& t : trace) {
+            if (!isNativeALU(t.inst) && !decodeLoadStore(t.inst, ls)) continue;
+            uint32_t reads, writes;
+            gprUses(t.inst, reads, writes);
+            for (uint32_t r = 0; r < 32; r++) {
+                if ((reads | writes) & (1u << r)) uses[r]++;
+            }
+            written |= writes;
+        }
+        std::fill(gprHost, gprHost + 32, int8_t(-1));
+        for (X64Reg host : ALLOCATABLE) {
+            uint32_t best = 0;
+            for (uint32_t r = 1; r < 32; r++) {
+                if (gprHost[r] < 0 && uses[r] > uses[best]) best = r;
+            }
+            if (uses[best] < 2) break;  // a single access gains nothing
+            gprHost[best] = int8_t(host);
+            uses[best] = 0;
+        }
+        uint32_t allocated = 0;
+        for (uint32_t r = 0; r < 32; r++) {
+            if (gprHost[r] >= 0) allocated |= 1u << r;
+        }
+        return written & allocated;
+    }
+
+    const JitBlock* compileOptimized(uint32_t pc, uint32_t baseInstructions, uint64_t baseHash) {
+        if (size_t(emitter.getCodePtr() - codeBuffer) > CODE_BUFFER_SIZE - CODE_HEADROOM) {
+            clearCache();
+        }
+        uint32_t next;
+        std::vector<TraceInst>& trace = traceScratch;
+        decodeTrace(pc, next, trace);
+        analyzeTrace(trace);
+        uint32_t written = allocateRegisters(trace);
+
+        uint8_t* entry = emitter.getCodePtr();
+        emitPrologue();
+        reloadGPRs();
+        uint8_t* loopHead = emitter.getCodePtr();
+        // A loop back can arrive with any allocated register modified
+        gprDirty = written;
+        ConstState consts;
+        consts.clear();
+        uint32_t low = pc, high = pc + 4;
+        bool closed = false;  // the last instruction already left the block
+        uint32_t cycles = 0;  // of the trace up to and including t
+        for (size_t i = 0; i < trace.size() && !closed; i++) {
+            const TraceInst& t = trace[i];
+            uint32_t op = t.inst >> 26;
+            cycles += CPU::cycleCost(t.inst);
+            low = std::min(low, t.address);
+            high = std::max(high, t.address + 4);
+            if (op == 18 && !(t.inst & 2)) {  // b, bl
+                if (t.inst & 1) emitter.storeImm32(STATE, lrOffset(), t.address + 4);
+                if (t.followed) continue;
+                emitBranchExit(branchTarget(t.address, t.inst), cycles, loopHead, pc);
+                closed = true;
+            } else if (op == 16 && !(t.inst & 2)) {  // bc
+                closed = emitConditionalBranch(t, cycles, loopHead, pc);
+            } else if (!compileLoadStore(t.inst, &consts) && !compileALU(t, consts)) {
+                consts.clear();
+                emitInterpreterCall(t.inst, t.address, cycles);
+                if (endsBlock(t.inst)) {
+                    emitExit(cycles);
+                    closed = true;
+                }
+            }
+        }
+        if (!closed) {
+            flushGPRs();
+            emitter.storeImm32(STATE, pcOffset(), next);
+            emitExit(cycles);
+        }
+        std::fill(gprHost, gprHost + 32, int8_t(-1));
+        gprDirty = 0;
+
+        JitBlock& block = blocks[pc];
+        block = { pc, pc + baseInstructions * 4, baseInstructions, baseHash, entry, 1, 0, low, high };
+        fastLookup[(pc >> 2) & (FAST_LOOKUP_SIZE - 1)] = &block;
+        superblocks.insert(pc);
+        recordBlock(block);
+        return &block;
+    }
+
+    // Leave for 'target', or loop back when it is the superblock start
+    void emitBranchExit(uint32_t target, uint32_t cycles, const uint8_t* loopHead, uint32_t pc) {
+        if (target == pc) {
+            emitLoopBack(cycles, loopHead, pc);
+        } else {
+            flushGPRs();
+            emitter.storeImm32(STATE, pcOffset(), target);
+            emitExit(cycles);
+        }
+    }
+
+    // Side exit for bc. Returns true when the branch is always taken.
+    bool emitConditionalBranch(const TraceInst& t, uint32_t cycles, const uint8_t* loopHead, uint32_t pc) {
+        uint32_t bo = (t.inst >> 21) & 0x1F, bi = (t.inst >> 16) & 0x1F;
+        if (t.inst & 1) emitter.storeImm32(STATE, lrOffset(), t.address + 4);
+        uint8_t* notTaken[2];
+        int checks = 0;
+        if (!(bo & 0x04)) {  // decrement CTR; BO[3] selects CTR == 0 or != 0
+            emitter.aluMemImm(X64_SUB_IMM, STATE, ctrOffset(), 1);
+            notTaken[checks++] = emitter.jcc32((bo & 0x02) ? CC_NE : CC_E);
+        }
+        if (!(bo & 0x10)) {  // test CR bit BI against BO[1]
+            emitter.testMemImm(STATE, crOffset(), 0x80000000u >> bi);
+            notTaken[checks++] = emitter.jcc32((bo & 0x08) ? CC_E : CC_NE);
+        }
+        emitBranchExit(branchTarget(t.address, t.inst), cycles, loopHead, pc);
+        for (int i = 0; i < checks; i++) emitter.setJumpTarget(notTaken[i]);
+        return checks == 0;
+    }
+
+    // Charge one pass to the downcount and run the superblock again unless
+    // it ran out (slice over or event due) or an exception is pending
+    void emitLoopBack(uint32_t cycles, const uint8_t* loopHead, uint32_t pc) {
+        emitter.movImm64(RAX, reinterpret_cast<uint64_t>(scheduler.getDowncountPointer()));
+        emitter.addMemImm64(RAX, 0, -int32_t(cycles));
+        uint8_t* stop = emitter.jcc32(CC_LE);
+        emitter.aluMemImm(X64_CMP_IMM, STATE, exceptionsOffset(), 0);
+        uint8_t* exceptionPending = emitter.jcc32(CC_NE);
+        emitter.jmpTo(loopHead);
+        emitter.setJumpTarget(stop);
+        emitter.setJumpTarget(exceptionPending);
+        flushGPRs();
+        emitter.storeImm32(STATE, pcOffset(), pc);
+        emitExit(0);
+    }
+
+    // Operand of a native ALU instruction: a guest register or an immediate
+    struct Operand {
+        bool isReg;
+        uint32_t value;  // register number or immediate
+    };
+    static Operand gprOperand(uint32_t r) { return {true, r}; }
+    static Operand immOperand(uint32_t v) { return {false, v}; }
+
+    enum AluOp { ALU_ADD, ALU_SUB, ALU_AND, ALU_OR, ALU_XOR, ALU_NOR, ALU_ANDC, ALU_MUL };
+
+    static uint32_t foldAlu(AluOp op, uint32_t a, uint32_t b) {
+        switch (op) {
+            case ALU_ADD:  return a + b;
+            case ALU_SUB:  return a - b;
+            case ALU_AND:  return a & b;
+            case ALU_OR:   return a | b;
+            case ALU_XOR:  return a ^ b;
+            case ALU_NOR:  return ~(a | b);
+            case ALU_ANDC: return a & ~b;
+            default:       return a * b;
+        }
+    }
+
+    static uint32_t rotateMask(uint32_t mb, uint32_t me) {
+        uint32_t begin = 0xFFFFFFFFu >> mb;
+        uint32_t end = me < 31 ? ~(0xFFFFFFFFu >> (me + 1)) : 0xFFFFFFFFu;
+        return mb <= me ? (begin & end) : (begin | end);
+    }
+
+    static bool resolve(const Operand& o, const ConstState& c, uint32_t& v) {
+        if (!o.isReg) {
+            v = o.value;
+            return true;
+        }
+        return c.get(o.value, v);
+    }
+
+    void loadOperand(X64Reg r, const Operand& o, const ConstState& c) {
+        uint32_t v;
+        if (resolve(o, c, v)) emitter.movImm32(r, v);
+        else loadGPR(r, o.value);
+    }
+
+    void setConst(uint32_t r, uint32_t v, ConstState& c) {
+        storeGPRImm(r, v);
+        c.known[r] = true;
+        c.value[r] = v;
+    }
+
+    void storeResult(uint32_t r, ConstState& c) {
+        storeGPR(r, RAX);
+        c.known[r] = false;
+    }
+
+    // CR field 'crf' = LT/GT/EQ of EAX against EDX (or 'imm' when useImm),
+    // plus XER[SO]
+    void emitCompareToCR(uint32_t crf, bool isSigned, bool useImm, uint32_t imm) {
+        emitter.movImm32(RCX, 0);
+        emitter.movImm32(RSI, 0);
+        emitter.movImm32(RDI, 0);
+        if (useImm) emitter.aluRI(X64_CMP_IMM, RAX, imm);
+        else        emitter.aluRR(X64_CMP, RAX, RDX);
+        emitter.setcc(isSigned ? CC_L : CC_B, RCX);
+        emitter.setcc(isSigned ? CC_G : CC_A, RSI);
+        emitter.setcc(CC_E, RDI);
+        emitter.shiftImm(X64_SHL, RCX, 3);
+        emitter.shiftImm(X64_SHL, RSI, 2);
+        emitter.shiftImm(X64_SHL, RDI, 1);
+        emitter.aluRR(X64_OR, RCX, RSI);
+        emitter.aluRR(X64_OR, RCX, RDI);
+        emitter.load32(RSI, STATE, xerOffset());
+        emitter.shiftImm(X64_SHR, RSI, 31);
+        emitter.aluRR(X64_OR, RCX, RSI);
+        uint32_t shift = 28 - crf * 4;
+        if (shift) emitter.shiftImm(X64_SHL, RCX, uint8_t(shift));
+        emitter.aluMemImm(X64_AND_IMM, STATE, crOffset(), ~(0xFu << shift));
+        emitter.orMem32(STATE, crOffset(), RCX);
+    }
+
+    // CR0 from the result in EAX
+    void emitRecord(const TraceInst& t) {
+        if (!t.crDead) emitCompareToCR(0, true, true, 0);
+    }
+
+    // XER[CA] = 'bit' (0 or 1)
+    void emitSetCA(X64Reg bit) {
+        emitter.aluMemImm(X64_AND_IMM, STATE, xerOffset(), ~XER_CA);
+        emitter.shiftImm(X64_SHL, bit, 29);
+        emitter.orMem32(STATE, xerOffset(), bit);
+    }
+
+    void emitSetCAConst(bool carry) {
+        if (carry) emitter.aluMemImm(X64_OR_IMM, STATE, xerOffset(), XER_CA);
+        else       emitter.aluMemImm(X64_AND_IMM, STATE, xerOffset(), ~XER_CA);
+    }
+
+    // rD = a op b, with CR0 from the result when 'rc'
+    void emitAlu(AluOp op, uint32_t rd, Operand a, Operand b, bool rc, const TraceInst& t, ConstState& c) {
+        uint32_t va = 0, vb = 0;
+        bool aKnown = resolve(a, c, va), bKnown = resolve(b, c, vb);
+        if (aKnown && bKnown) {
+            uint32_t result = foldAlu(op, va, vb);
+            setConst(rd, result, c);
+            if (rc && !t.crDead) {
+                emitter.movImm32(RAX, result);
+                emitRecord(t);
+            }
+            return;
+        }
+        loadOperand(RAX, a, c);
+        if (bKnown && op != ALU_NOR) {
+            switch (op) {
+                case ALU_ADD:  emitter.aluRI(X64_ADD_IMM, RAX, vb); break;
+                case ALU_SUB:  emitter.aluRI(X64_SUB_IMM, RAX, vb); break;
+                case ALU_AND:  emitter.aluRI(X64_AND_IMM, RAX, vb); break;
+                case ALU_OR:   emitter.aluRI(X64_OR_IMM, RAX, vb); break;
+                case ALU_XOR:  emitter.aluRI(X64_XOR_IMM, RAX, vb); break;
+                case ALU_ANDC: emitter.aluRI(X64_AND_IMM, RAX, ~vb); break;
+                default:       emitter.imulRRI(RAX, RAX, vb); break;
+            }
+        } else {
+            loadOperand(RDX, b, c);
+            switch (op) {
+                case ALU_ADD:  emitter.aluRR(X64_ADD, RAX, RDX); break;
+                case ALU_SUB:  emitter.aluRR(X64_SUB, RAX, RDX); break;
+                case ALU_AND:  emitter.aluRR(X64_AND, RAX, RDX); break;
+                case ALU_OR:   emitter.aluRR(X64_OR, RAX, RDX); break;
+                case ALU_XOR:  emitter.aluRR(X64_XOR, RAX, RDX); break;
+                case ALU_NOR:  emitter.aluRR(X64_OR, RAX, RDX); emitter.unary(X64_NOT, RAX); break;
+                case ALU_ANDC: emitter.unary(X64_NOT, RDX); emitter.aluRR(X64_AND, RAX, RDX); break;
+                default:       emitter.imulRR(RAX, RDX); break;
+            }
+        }
+        storeResult(rd, c);
+        if (rc) emitRecord(t);
+    }
+
+    // CR field crfD = compare rA with 'b'
+    void emitCompare(const TraceInst& t, uint32_t ra, Operand b, bool isSigned, const ConstState& c) {
+        if (t.crDead) return;
+        uint32_t crf = (t.inst >> 23) & 7, vb;
+        loadOperand(RAX, gprOperand(ra), c);
+        if (resolve(b, c, vb)) {
+            emitCompareToCR(crf, isSigned, true, vb);
+        } else {
+            loadOperand(RDX, b, c);
+            emitCompareToCR(crf, isSigned, false, 0);
+        }
+    }
+
+    // addic / addic.: rD = rA + SIMM, XER[CA] = carry out
+    void emitAddCarrying(const TraceInst& t, uint32_t rd, uint32_t ra, uint32_t simm, bool rc, ConstState& c) {
+        uint32_t va;
+        if (c.get(ra, va)) {
+            uint64_t wide = uint64_t(va) + simm;
+            setConst(rd, uint32_t(wide), c);
+            if (!t.caDead) emitSetCAConst(wide >> 32);
+            if (rc && !t.crDead) {
+                emitter.movImm32(RAX, uint32_t(wide));
+                emitRecord(t);
+            }
+            return;
+        }
+        emitter.movImm32(RCX, 0);
+        loadGPR(RAX, ra);
+        emitter.aluRI(X64_ADD_IMM, RAX, simm);
+        if (!t.caDead) emitter.setcc(CC_B, RCX);
+        storeResult(rd, c);
+        if (!t.caDead) emitSetCA(RCX);
+        if (rc) emitRecord(t);
+    }
+
+    // srawi: rA = rS >> sh (arithmetic), XER[CA] = negative and 1 bits lost
+    void emitShiftRightAlgebraic(const TraceInst& t, uint32_t ra, uint32_t rs, uint32_t sh, bool rc, ConstState& c) {
+        uint32_t lost = sh ? (1u << sh) - 1 : 0, vs;
+        if (c.get(rs, vs)) {
+            uint32_t result = uint32_t(int32_t(vs) >> sh);
+            setConst(ra, result, c);
+            if (!t.caDead) emitSetCAConst(int32_t(vs) < 0 && (vs & lost));
+            if (rc && !t.crDead) {
+                emitter.movImm32(RAX, result);
+                emitRecord(t);
+            }
+            return;
+        }
+        loadGPR(RDX, rs);
+        emitter.movReg32(RAX, RDX);
+        if (sh) emitter.shiftImm(X64_SAR, RAX, uint8_t(sh));
+        storeResult(ra, c);
+        if (!t.caDead) {
+            if (!sh) {
+                emitSetCAConst(false);
+            } else {
+                emitter.movImm32(RCX, 0);
+                emitter.movImm32(RSI, 0);
+                emitter.testRI(RDX, lost);
+                emitter.setcc(CC_NE, RCX);
+                emitter.testReg32(RDX, RDX);
+                emitter.setcc(CC_S, RSI);
+                emitter.aluRR(X64_AND, RCX, RSI);
+                emitSetCA(RCX);
+            }
+        }
+        if (rc) emitRecord(t);
+    }
+
+    // rlwinm: rA = rotl(rS, sh) & mask(mb, me)
+    void emitRotateMask(const TraceInst& t, ConstState& c) {
+        uint32_t rs = (t.inst >> 21) & 0x1F, ra = (t.inst >> 16) & 0x1F, sh = (t.inst >> 11) & 0x1F;
+        uint32_t mask = rotateMask((t.inst >> 6) & 0x1F, (t.inst >> 1) & 0x1F), vs;
+        bool rc = t.inst & 1;
+        if (c.get(rs, vs)) {
+            uint32_t result = (sh ? (vs << sh) | (vs >> (32 - sh)) : vs) & mask;
+            setConst(ra, result, c);
+            if (rc && !t.crDead) {
+                emitter.movImm32(RAX, result);
+                emitRecord(t);
+            }
+            return;
+        }
+        loadGPR(RAX, rs);
+        if (sh) emitter.shiftImm(X64_ROL, RAX, uint8_t(sh));
+        if (mask != 0xFFFFFFFFu) emitter.aluRI(X64_AND_IMM, RAX, mask);
+        storeResult(ra, c);
+        if (rc) emitRecord(t);
+    }
+
+    // extsb / extsh
+    void emitSignExtend(const TraceInst& t, bool byte, ConstState& c) {
+        uint32_t rs = (t.inst >> 21) & 0x1F, ra = (t.inst >> 16) & 0x1F, vs;
+        bool rc = t.inst & 1;
+        if (c.get(rs, vs)) {
+            uint32_t result = byte ? uint32_t(int32_t(int8_t(vs))) : uint32_t(int32_t(int16_t(vs)));
+            setConst(ra, result, c);
+            if (rc && !t.crDead) {
+                emitter.movImm32(RAX, result);
+                emitRecord(t);
+            }
+            return;
+        }
+        loadGPR(RAX, rs);
+        if (byte) emitter.movsx8(RAX, RAX);
+        else      emitter.movsx16(RAX, RAX);
+        storeResult(ra, c);
+        if (rc) emitRecord(t);
+    }
+
+    // Native integer instructions (see isNativeALU). Returns false for
+    // anything else.
+    bool compileALU(const TraceInst& t, ConstState& c) {
+        if (!isNativeALU(t.inst)) return false;
+        uint32_t inst = t.inst, op = inst >> 26;
+        uint32_t rd = (inst >> 21) & 0x1F, ra = (inst >> 16) & 0x1F, rb = (inst >> 11) & 0x1F;
+        uint32_t simm = uint32_t(int32_t(int16_t(inst & 0xFFFF))), uimm = inst & 0xFFFF;
+        bool rc = inst & 1;
+        Operand raOrZero = ra ? gprOperand(ra) : immOperand(0);
+        switch (op) {
+            case 7:  emitAlu(ALU_MUL, rd, gprOperand(ra), immOperand(simm), false, t, c); break;       // mulli
+            case 10: emitCompare(t, ra, immOperand(uimm), false, c); break;                            // cmpli
+            case 11: emitCompare(t, ra, immOperand(simm), true, c); break;                             // cmpi
+            case 12: case 13: emitAddCarrying(t, rd, ra, simm, op == 13, c); break;                    // addic(.)
+            case 14: emitAlu(ALU_ADD, rd, raOrZero, immOperand(simm), false, t, c); break;             // addi
+            case 15: emitAlu(ALU_ADD, rd, raOrZero, immOperand(uimm << 16), false, t, c); break;       // addis
+            case 21: emitRotateMask(t, c); break;                                                      // rlwinm
+            case 24: emitAlu(ALU_OR,  ra, gprOperand(rd), immOperand(uimm), false, t, c); break;       // ori
+            case 25: emitAlu(ALU_OR,  ra, gprOperand(rd), immOperand(uimm << 16), false, t, c); break; // oris
+            case 26: emitAlu(ALU_XOR, ra, gprOperand(rd), immOperand(uimm), false, t, c); break;       // xori
+            case 27: emitAlu(ALU_XOR, ra, gprOperand(rd), immOperand(uimm << 16), false, t, c); break; // xoris
+            case 28: emitAlu(ALU_AND, ra, gprOperand(rd), immOperand(uimm), true, t, c); break;        // andi.
+            case 29: emitAlu(ALU_AND, ra, gprOperand(rd), immOperand(uimm << 16), true, t, c); break;  // andis.
+            default:  // 31
+                switch ((inst >> 1) & 0x3FF) {
+                    case 0:   emitCompare(t, ra, gprOperand(rb), true, c); break;                       // cmp
+                    case 32:  emitCompare(t, ra, gprOperand(rb), false, c); break;                      // cmpl
+                    case 28:  emitAlu(ALU_AND,  ra, gprOperand(rd), gprOperand(rb), rc, t, c); break;   // and
+                    case 40:  emitAlu(ALU_SUB,  rd, gprOperand(rb), gprOperand(ra), rc, t, c); break;   // subf
+                    case 60:  emitAlu(ALU_ANDC, ra, gprOperand(rd), gprOperand(rb), rc, t, c); break;   // andc
+                    case 104: emitAlu(ALU_SUB,  rd, immOperand(0), gprOperand(ra), rc, t, c); break;    // neg
+                    case 124: emitAlu(ALU_NOR,  ra, gprOperand(rd), gprOperand(rb), rc, t, c); break;   // nor
+                    case 235: emitAlu(ALU_MUL,  rd, gprOperand(ra), gprOperand(rb), rc, t, c); break;   // mullw
+                    case 266: emitAlu(ALU_ADD,  rd, gprOperand(ra), gprOperand(rb), rc, t, c); break;   // add
+                    case 316: emitAlu(ALU_XOR,  ra, gprOperand(rd), gprOperand(rb), rc, t, c); break;   // xor
+                    case 444: emitAlu(ALU_OR,   ra, gprOperand(rd), gprOperand(rb), rc, t, c); break;   // or
+                    case 824: emitShiftRightAlgebraic(t, ra, rd, rb, rc, c); break;                     // srawi
+                    case 922: emitSignExtend(t, false, c); break;                                        // extsh
+                    case 954: emitSignExtend(t, true, c); break;                                         // extsb
+                    case 339: {  // mfspr
+                        uint32_t n = ra | (rb << 5);
+                        emitter.load32(RAX, STATE, n == SPR_LR ? lrOffset() : ctrOffset());
+                        storeResult(rd, c);
+                        break;
+                    }
+                    case 467: {  // mtspr
+                        uint32_t n = ra | (rb << 5);
+                        loadOperand(RAX, gprOperand(rd), c);
+                        emitter.store32(STATE, n == SPR_LR ? lrOffset() : ctrOffset(), RAX);
+                        break;
+                    }
+                }
+                break;
+        }
+        return true;
+    }
+
+    CPU& cpu;
+    Memory& memory;
+    Scheduler& scheduler;
+    X64Emitter emitter;
+    uint8_t* codeBuffer;
+    uint8_t* trampolinesEnd;
+    PerfJitOutput* perf;
+    const SymbolDB* symbols;
+    bool tiering;
+    const uint8_t* trampolines[NUM_SITE_KINDS];
+    std::map<uint32_t, JitBlock> blocks;  // ordered for range invalidation
+    std::set<uint32_t> superblocks;       // tier 1 blocks, which may span several ranges
+    int8_t gprHost[32];                   // host register per guest GPR while compiling, or -1
+    uint32_t gprDirty;                    // allocated GPRs modified since CPUState was synced
+    std::vector<TraceInst> traceScratch;  // compileOptimized's trace, reused
+    JitBlock* fastLookup[FAST_LOOKUP_SIZE];
+    std::unordered_map<uint8_t*, FastmemSite> sites;  // keyed by faulting instruction
+};
+#endif
+
+void CPU::runBlock() {
+#if FLAMES_JIT
+    jit->runBlock();
+    if (state.exceptions) checkExceptions();
+#else
+    interpretBlock();
+#endif
+}
+
+void CPU::invalidateICache(uint32_t address, uint32_t len) {
+#if FLAMES_JIT
+    if (jit) jit->invalidate(address, len);
+#else
+    (void)address;
+    (void)len;
+#endif
+}
+
+// Disc header layout
+const uint32_t DISC_WII_MAGIC      = 0x5D1C9EA3;  // at 0x18
+const uint32_t DISC_GC_MAGIC       = 0xC2339F3D;  // at 0x1C
+const uint32_t DISC_BI2_OFFSET     = 0x440;
+const uint32_t DISC_BI2_SIZE       = 0x2000;
+const uint32_t DISC_APPLOADER      = 0x2440;
+const uint32_t DISC_DOL_OFFSET     = 0x420;       // header fields are >> 2 on Wii
+const uint32_t DISC_FST_OFFSET     = 0x424;
+const uint32_t DISC_FST_SIZE       = 0x428;
+const uint32_t DISC_FST_MAX_SIZE   = 0x42C;
+
+// Disc image: an unencrypted GameCube image or a decrypted Wii partition.
+// The file is mapped read-only so reads are plain memory copies.
+class Disc {
+public:
+    Disc() : data(nullptr), size(0), wii(false) {}
+    ~Disc() { close(); }
+
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            SDL_Log("Failed to open disc image %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < DISC_APPLOADER + 0x20) {
+            SDL_Log("Disc image %s is too small", path);
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            SDL_Log("Failed to map disc image %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        data = static_cast<const uint8_t*>(map);
+        size = uint64_t(st.st_size);
+        wii = read32(0x18) == DISC_WII_MAGIC;
+        if (!wii && read32(0x1C) != DISC_GC_MAGIC) {
+            SDL_Log("%s is not a GameCube or Wii disc image", path);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (data) munmap(const_cast<uint8_t*>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+
+    // Pointer to 'len' bytes at 'offset', or nullptr if out of range
+    const uint8_t* getPointer(uint64_t offset, uint64_t len) const {
+        if (!data || offset > size || len > size - offset) return nullptr;
+        return data + offset;
+    }
+
+    uint32_t read32(uint64_t offset) const {
+        const uint8_t* p = getPointer(offset, 4);
+        if (!p) return 0;
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    }
+
+    // Offset/size fields in the partition header are stored >> 2 on Wii
+    uint64_t readOffset(uint64_t offset) const {
+        uint64_t v = read32(offset);
+        return wii ? v << 2 : v;
+    }
+
+    bool isWii() const { return wii; }
+    uint64_t getSize() const { return size; }
+
+private:
+    const uint8_t* data;
+    uint64_t size;
+    bool wii;
+};
+
+// High-level emulation of the IPL + apploader. Instead of running the boot
+// ROM and the disc's apploader, parse the headers directly, copy the main
+// executable and FST into MEM1, set up the state the apploader would have
+// left behind and start the CPU at the game's entry point.
+class Apploader {
+public:
+    bool hleBoot(const Disc& disc, Memory& memory, CPU& cpu) {
+        // Apploader header: build date, entry point, size and trailer size
+        const uint8_t* header = disc.getPointer(DISC_APPLOADER, 0x20);
+        char date[17] = {};
+        std::memcpy(date, header, 16);
+        uint32_t apploaderSize = disc.read32(DISC_APPLOADER + 0x14);
+        if (apploaderSize == 0 || !disc.getPointer(DISC_APPLOADER + 0x20, apploaderSize)) {
+            SDL_Log("Invalid apploader header");
+            return false;
+        }
+        SDL_Log("Apploader %s (HLE, 0x%X bytes skipped)", date, apploaderSize);
+
+        uint64_t dolOffset = disc.readOffset(DISC_DOL_OFFSET);
+        if (dolOffset == 0) {
+            SDL_Log("No executable in disc header; encrypted Wii images must be "
+                    "extracted to a decrypted partition first");
+            return false;
+        }
+
+        uint32_t entry;
+        if (!loadDOL(disc, dolOffset, memory, entry)) {
+            return false;
+        }
+        uint32_t arenaHigh;
+        if (!loadFST(disc, memory, arenaHigh)) {
+            return false;
+        }
+        setupLowMemory(disc, memory, arenaHigh);
+        setupCPU(disc, cpu, entry);
+        return true;
+    }
+
+    struct Section {
+        uint32_t address;
+        uint32_t size;
+    };
+    // Text sections of the executable loaded by hleBoot
+    const std::vector<Section>& getTextSections() const { return textSections; }
+
+private:
+    // DOL layout: 7 text + 11 data sections, then BSS and entry point
+    bool loadDOL(const Disc& disc, uint64_t dolOffset, Memory& memory, uint32_t& entry) {
+        const uint8_t* header = disc.getPointer(dolOffset, 0x100);
+        if (!header) {
+            SDL_Log("Executable header out of range: 0x%llX", (unsigned long long)dolOffset);
+            return false;
+        }
+
+        // Clear BSS first: it usually spans the small data sections too
+        uint32_t bssAddress = disc.read32(dolOffset + 0xD8);
+        uint32_t bssSize = disc.read32(dolOffset + 0xDC);
+        if (bssSize && !memory.clearGuest(bssAddress, bssSize)) {
+            return false;
+        }
+
+        for (int i = 0; i < 18; i++) {
+            uint32_t offset  = disc.read32(dolOffset + i * 4);
+            uint32_t address = disc.read32(dolOffset + 0x48 + i * 4);
+            uint32_t size    = disc.read32(dolOffset + 0x90 + i * 4);
+            if (size == 0) continue;
+            const uint8_t* src = disc.getPointer(dolOffset + offset, size);
+            if (!src || !memory.copyToGuest(address, src, size)) {
+                SDL_Log("Failed to load %s section %d", i < 7 ? "text" : "data", i < 7 ? i : i - 7);
+                return false;
+            }
+            if (i < 7) textSections.push_back({address, size});
+        }
+
+        entry = disc.read32(dolOffset + 0xE0);
+        return true;
+    }
+
+    // The FST (and bi2 below it) live at the top of MEM1; the OS arena ends there
+    bool loadFST(const Disc& disc, Memory& memory, uint32_t& arenaHigh) {
+        uint64_t fstOffset = disc.readOffset(DISC_FST_OFFSET);
+        uint32_t fstSize = uint32_t(disc.readOffset(DISC_FST_SIZE));
+        uint32_t fstMaxSize = uint32_t(disc.readOffset(DISC_FST_MAX_SIZE));
+        if (fstMaxSize < fstSize) fstMaxSize = fstSize;
+
+        uint32_t fstAddress = (0x80000000 + MEM1_SIZE - fstMaxSize) & ~0x1Fu;
+        const uint8_t* fst = disc.getPointer(fstOffset, fstSize);
+        if (!fst || !memory.copyToGuest(fstAddress, fst, fstSize)) {
+            SDL_Log("Failed to load FST (offset 0x%llX, size 0x%X)",
+                    (unsigned long long)fstOffset, fstSize);
+            return false;
+        }
+
+        uint32_t bi2Address = fstAddress - DISC_BI2_SIZE;
+        memory.copyToGuest(bi2Address, disc.getPointer(DISC_BI2_OFFSET, DISC_BI2_SIZE), DISC_BI2_SIZE);
+        memory.write32(0x80000038, fstAddress);
+        memory.write32(0x8000003C, fstMaxSize);
+        memory.write32(0x800000F4, bi2Address);
+        arenaHigh = bi2Address;
+        return true;
+    }
+
+    // Globals the IPL/apploader leave in low memory for the OS
+    void setupLowMemory(const Disc& disc, Memory& memory, uint32_t arenaHigh) {
+        memory.copyToGuest(0x80000000, disc.getPointer(0, 0x20), 0x20);  // game ID, maker, disc no.
+        memory.write32(0x80000020, 0x0D15EA5E);             // booted from disc
+        memory.write32(0x80000024, 0x00000001);             // boot version
+        memory.write32(0x80000028, MEM1_SIZE);              // physical memory size
+        memory.write32(0x8000002C, disc.isWii() ? 0x00000023 : 0x00000003);  // console type
+        memory.write32(0x80000034, arenaHigh);              // arena high
+        memory.write32(0x800000CC, 0x00000000);             // video mode (NTSC)
+        memory.write32(0x800000EC, 0x80000000 + MEM1_SIZE); // debug monitor address
+        memory.write32(0x800000F0, MEM1_SIZE);              // simulated memory size
+        memory.write32(0x800000F8, BUS_CLOCK_HZ);
+        memory.write32(0x800000FC, CPU_CLOCK_HZ);
+
+        if (disc.isWii()) {
+            memory.write32(0x80003100, MEM1_SIZE);          // MEM1 physical / simulated size
+            memory.write32(0x80003104, MEM1_SIZE);
+            memory.write32(0x80003118, MEM2_SIZE);          // MEM2 physical / simulated size
+            memory.write32(0x8000311C, MEM2_SIZE);
+            memory.write32(0x80003120, 0x93400000);         // end of MEM2
+            memory.write32(0x80003124, 0x90000800);         // usable MEM2 start
+            memory.write32(0x80003128, 0x933E0000);         // usable MEM2 end
+            memory.write32(0x80003130, 0x933E0000);         // IOS heap
+            memory.write32(0x80003134, 0x93400000);
+            memory.write32(0x80003138, 0x00000011);         // Hollywood version
+        }
+    }
+
+    // BATs and MSR as the apploader hands them to the game
+    void setupCPU(const Disc& disc, CPU& cpu, uint32_t entry) {
+        cpu.reset();
+        CPUState& s = cpu.getState();
+        s.spr[SPR_IBAT0U]     = 0x80001FFF;  // 0x80000000: 256MB cached
+        s.spr[SPR_IBAT0U + 1] = 0x00000002;
+        s.spr[SPR_DBAT0U]     = 0x80001FFF;
+        s.spr[SPR_DBAT0U + 1] = 0x00000002;
+        s.spr[SPR_DBAT0U + 2] = 0xC0001FFF;  // 0xC0000000: 256MB uncached
+        s.spr[SPR_DBAT0U + 3] = 0x0000002A;
+        if (disc.isWii()) {
+            s.spr[SPR_HID4]       = 0x82000000;  // enable BAT4-7
+            s.spr[SPR_IBAT4U]     = 0x90001FFF;  // MEM2 cached / uncached
+            s.spr[SPR_IBAT4U + 1] = 0x10000002;
+            s.spr[SPR_DBAT4U]     = 0x90001FFF;
+            s.spr[SPR_DBAT4U + 1] = 0x10000002;
+            s.spr[SPR_DBAT4U + 2] = 0xD0001FFF;
+            s.spr[SPR_DBAT4U + 3] = 0x1000002A;
+        }
+        s.msr = 0x00002032;          // FP, IR, DR, RI
+        s.gpr[1] = 0x816FFFF0;       // initial stack
+        cpu.start(entry);
+    }
+
+    std::vector<Section> textSections;
+};
+
+// Function signatures: a hash of a routine's instructions with the fields
+// the linker relocates masked out, so the same SDK routine matches in any
+// game it is linked into. Stored one per line as "hash size name" with
+// the hash in hex and the size in bytes.
+class SignatureDB {
+public:
+    struct Signature {
+        uint64_t hash;
+        uint32_t size;
+        std::string name;
+    };
+
+    bool load(const char* path) {
+        FILE* f = std::fopen(path, "r");
+        if (!f) {
+            SDL_Log("Failed to open signature file %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        char line[512], name[256];
+        unsigned long long hash;
+        unsigned size;
+        size_t before = signatures.size();
+        while (std::fgets(line, sizeof(line), f)) {
+            if (std::sscanf(line, "%llx %x %255s", &hash, &size, name) == 3 && size >= 4) {
+                add(hash, size & ~3u, name);
+            }
+        }
+        std::fclose(f);
+        SDL_Log("Loaded %zu function signatures from %s", signatures.size() - before, path);
+        return true;
+    }
+
+    bool save(const char* path) const {
+        FILE* f = std::fopen(path, "w");
+        if (!f) {
+            SDL_Log("Failed to open signature file %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        for (const Signature& s : signatures) {
+            std::fprintf(f, "%016llX %X %s\n", (unsigned long long)s.hash, s.size, s.name.c_str());
+        }
+        std::fclose(f);
+        SDL_Log("Wrote %zu function signatures to %s", signatures.size(), path);
+        return true;
+    }
+
+    void add(uint64_t hash, uint32_t size, const std::string& name) {
+        byHash.emplace(hash, signatures.size());
+        signatures.push_back({hash, size, name});
+        sizes.insert(size);
+    }
+
+    // Signatures for every function symbol inside [start, end), hashed in
+    // parallel
+    void generate(Memory& memory, const SymbolDB& symbols, uint32_t start, uint32_t end) {
+        std::vector<const SymbolDB::Symbol*> functions;
+        for (const auto& entry : symbols.all()) {
+            const SymbolDB::Symbol& s = entry.second;
+            if (s.address < start || s.address >= end || s.size < 4 || s.size > end - s.address) continue;
+            functions.push_back(&s);
+        }
+        std::vector<uint64_t> hashes(functions.size());
+        JobSystem::parallelFor(functions.size(), 256, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                hashes[i] = hashFunction(memory, functions[i]->address, functions[i]->size & ~3u);
+            }
+        });
+        for (size_t i = 0; i < functions.size(); i++) {
+            add(hashes[i], functions[i]->size & ~3u, functions[i]->name);
+        }
+    }
+
+    const Signature* find(uint64_t hash, uint32_t size) const {
+        auto range = byHash.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (signatures[it->second].size == size) return &signatures[it->second];
+        }
+        return nullptr;
+    }
+
+    const std::set<uint32_t>& getSizes() const { return sizes; }
+    bool empty() const { return signatures.empty(); }
+
+    // FNV-1a over the instructions with relocated fields cleared: branch
+    // targets of b/bl and the 16-bit immediates of instructions that take
+    // @ha/@l/@sda21 relocations (addi, addis, ori, oris, loads, stores)
+    static const uint64_t HASH_BASIS = 0xCBF29CE484222325ull;
+
+    static uint64_t hashFunction(Memory& memory, uint32_t address, uint32_t size) {
+        return extendHash(HASH_BASIS, memory, address, size);
+    }
+
+    // Continue 'hash' over 'size' more bytes at 'address', so one pass can
+    // test every signature length at a candidate start
+    static uint64_t extendHash(uint64_t hash, Memory& memory, uint32_t address, uint32_t size) {
+        for (uint32_t i = 0; i < size; i += 4) {
+            uint32_t inst = memory.read32(address + i);
+            uint32_t op = inst >> 26;
+            if (op == 18) inst &= 0xFC000003;
+            else if (op == 14 || op == 15 || op == 24 || op == 25 || (op >= 32 && op <= 55)) inst &= 0xFFFF0000;
+            for (int b = 0; b < 4; b++) {
+                hash ^= (inst >> (24 - b * 8)) & 0xFF;
+                hash *= 0x100000001B3ull;
+            }
+        }
+        return hash;
+    }
+
+private:
+    std::vector<Signature> signatures;
+    std::unordered_multimap<uint64_t, size_t> byHash;  // into signatures
+    std::set<uint32_t> sizes;  // distinct lengths to hash at each candidate
+};
+
+// High-level emulation of SDK library routines. A hooked function's first
+// instruction is replaced with primary opcode 1 (unused on Broadway) and
+// the function's index; the CPU then runs the native implementation below
+// and returns to LR. Implementations work on the Memory backing directly.
+class HLE {
+public:
+    typedef void (*Function)(CPU& cpu, Memory& memory, CPUState& state);
+
+    struct Hook {
+        const char* name;
+        Function function;
+    };
+
+    static const uint32_t OPCODE = 1u << 26;
+
+    // Hook every function the symbol map names
+    static uint32_t hookSymbols(Memory& memory, const SymbolDB& symbols) {
+        uint32_t hooked = 0;
+        for (const auto& entry : symbols.all()) {
+            hooked += hookByName(memory, entry.second.address, entry.second.name);
+        }
+        return hooked;
+    }
+
+    // Find functions in [start, end) by signature and hook those with a
+    // native implementation. Candidate starts are the section start and
+    // every instruction after a blr, a tail-call branch or padding.
+    // The section is scanned in parallel chunks, which only read, and the
+    // matches are hooked afterwards in address order.
+    static uint32_t hookSignatures(Memory& memory, const SignatureDB& db, uint32_t start, uint32_t end) {
+        struct Match {
+            uint32_t address;
+            uint32_t hook;
+        };
+        const size_t SCAN_CHUNK = 4096;  // instructions per job
+        size_t words = end > start ? (end - start) / 4 : 0;
+        std::vector<std::vector<Match>> chunks((words + SCAN_CHUNK - 1) / SCAN_CHUNK);
+        JobSystem::parallelFor(words, SCAN_CHUNK, [&](size_t first, size_t last) {
+            std::vector<Match>& found = chunks[first / SCAN_CHUNK];
+            for (size_t word = first; word < last; word++) {
+                uint32_t address = start + uint32_t(word) * 4;
+                if (address != start) {
+                    uint32_t previous = memory.read32(address - 4);
+                    bool boundary = previous == 0x4E800020 || (previous & 0xFC000003) == 0x48000000 || previous == 0;
+                    if (!boundary) continue;
+                }
+                uint64_t hash = SignatureDB::HASH_BASIS;
+                uint32_t hashed = 0;
+                for (uint32_t size : db.getSizes()) {  // ascending
+                    if (size > end - address) break;
+                    hash = SignatureDB::extendHash(hash, memory, address + hashed, size - hashed);
+                    hashed = size;
+                    const SignatureDB::Signature* s = db.find(hash, size);
+                    int hook = s ? findHook(s->name) : -1;
+                    if (hook >= 0) {
+                        found.push_back({address, uint32_t(hook)});
+                        break;
+                    }
+                }
+            }
+        });
+
+        uint32_t hooked = 0, lastHooked = 0;
+        for (const std::vector<Match>& found : chunks) {
+            for (const Match& m : found) {
+                // A hook right before makes this no longer a boundary
+                if (hooked && m.address == lastHooked + 4) continue;
+                hook(memory, m.address, m.hook);
+                lastHooked = m.address;
+                hooked++;
+            }
+        }
+        return hooked;
+    }
+
+    static void call(uint32_t index, CPU& cpu, Memory& memory, CPUState& state) {
+        if (index < NUM_HOOKS) hooks[index].function(cpu, memory, state);
+        else SDL_Log("Invalid HLE call %u at 0x%08X", index, state.pc);
+        state.npc = state.lr;  // blr
+    }
+
+private:
+    static int findHook(const std::string& name) {
+        for (uint32_t i = 0; i < NUM_HOOKS; i++) {
+            if (name == hooks[i].name) return int(i);
+        }
+        return -1;
+    }
+
+    static void hook(Memory& memory, uint32_t address, uint32_t index) {
+        memory.write32(address, OPCODE | index);
+        SDL_Log("HLE: %s at 0x%08X", hooks[index].name, address);
+    }
+
+    static bool hookByName(Memory& memory, uint32_t address, const std::string& name) {
+        int index = findHook(name);
+        if (index < 0) return false;
+        hook(memory, address, uint32_t(index));
+        return true;
+    }
+
+    static float readFloat(Memory& memory, uint32_t address) {
+        uint32_t bits = memory.read32(address);
+        float f;
+        std::memcpy(&f, &bits, 4);
+        return f;
+    }
+    static void writeFloat(Memory& memory, uint32_t address, float f) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, 4);
+        memory.write32(address, bits);
+    }
+
+    // void* memcpy(void* dst, const void* src, size_t n)
+    static void memcpyHook(CPU&, Memory& memory, CPUState& state) {
+        uint32_t dst = state.gpr[3], src = state.gpr[4], n = state.gpr[5];
+        uint8_t* d = memory.getWritePointer(dst, n);
+        uint8_t* s = memory.getPointer(src, n);
+        if (d && s) {
+            std::memmove(d, s, n);
+        } else {
+            for (uint32_t i = 0; i < n; i++) memory.write8(dst + i, memory.read8(src + i));
+        }
+    }
+
+    // void* memset(void* dst, int c, size_t n)
+    static void memsetHook(CPU&, Memory& memory, CPUState& state) {
+        uint32_t dst = state.gpr[3], n = state.gpr[5];
+        uint8_t c = uint8_t(state.gpr[4]);
+        if (uint8_t* d = memory.getWritePointer(dst, n)) {
+            std::memset(d, c, n);
+        } else {
+            for (uint32_t i = 0; i < n; i++) memory.write8(dst + i, c);
+        }
+    }
+
+    // Data cache maintenance: caches are not modelled
+    static void cacheNoOp(CPU&, Memory&, CPUState&) {}
+
+    // void ICInvalidateRange(void* addr, u32 len)
+    static void icInvalidateRange(CPU& cpu, Memory&, CPUState& state) {
+        cpu.invalidateICache(state.gpr[3] & ~31u, (state.gpr[4] + (state.gpr[3] & 31) + 31) & ~31u);
+    }
+
+    // void OSReport(const char* fmt, ...): integer arguments come from
+    // r4-r10, floating point ones from f1-f8
+    static void osReport(CPU&, Memory& memory, CPUState& state) {
+        std::string out;
+        uint32_t fmt = state.gpr[3];
+        int nextGPR = 4, nextFPR = 1;
+        for (uint32_t i = 0; i < 4096; i++) {
+            char c = char(memory.read8(fmt + i));
+            if (!c) break;
+            if (c != '%') {
+                out += c;
+                continue;
+            }
+            // Copy the conversion spec and format one argument with it
+            std::string spec = "%";
+            char conv;
+            do {
+                conv = char(memory.read8(fmt + ++i));
+                if (conv == 'h' || conv == 'l') continue;  // guest longs are 32-bit
+                spec += conv;
+            } while (conv && std::strchr("diouxXcspfFeEgG%", conv) == nullptr);
+            if (!conv) break;
+            char buffer[512];
+            if (conv == '%') {
+                out += '%';
+                continue;
+            } else if (std::strchr("fFeEgG", conv)) {
+                double v = nextFPR <= 8 ? state.ps0[nextFPR++] : 0.0;
+                std::snprintf(buffer, sizeof(buffer), spec.c_str(), v);
+            } else {
+                uint32_t arg = nextGPR <= 10 ? state.gpr[nextGPR++] : 0;
+                if (conv == 's') {
+                    std::string str;
+                    for (uint32_t j = 0; j < 1024; j++) {
+                        char ch = char(memory.read8(arg + j));
+                        if (!ch) break;
+                        str += ch;
+                    }
+                    std::snprintf(buffer, sizeof(buffer), spec.c_str(), str.c_str());
+                } else if (conv == 'p') {
+                    std::snprintf(buffer, sizeof(buffer), "0x%08X", arg);
+                } else if (conv == 'd' || conv == 'i') {
+                    std::snprintf(buffer, sizeof(buffer), spec.c_str(), int32_t(arg));
+                } else {
+                    std::snprintf(buffer, sizeof(buffer), spec.c_str(), arg);
+                }
+            }
+            out += buffer;
+        }
+        while (!out.empty() && (out.back() == '\n' || out.back() == '\r')) out.pop_back();
+        SDL_Log("OSReport: %s", out.c_str());
+    }
+
+    // Mtx is float[3][4], row major
+    static void psmtxIdentity(CPU&, Memory& memory, CPUState& state) {
+        for (uint32_t i = 0; i < 12; i++) {
+            writeFloat(memory, state.gpr[3] + i * 4, (i % 5) == 0 ? 1.0f : 0.0f);
+        }
+    }
+
+    static void psmtxCopy(CPU&, Memory& memory, CPUState& state) {
+        for (uint32_t i = 0; i < 12; i++) {
+            memory.write32(state.gpr[4] + i * 4, memory.read32(state.gpr[3] + i * 4));
+        }
+    }
+
+    // PSMTXConcat(a, b, ab): ab = a * b with an implied 0 0 0 1 bottom row
+    static void psmtxConcat(CPU&, Memory& memory, CPUState& state) {
+        float a[12], b[12], ab[12];
+        for (uint32_t i = 0; i < 12; i++) {
+            a[i] = readFloat(memory, state.gpr[3] + i * 4);
+            b[i] = readFloat(memory, state.gpr[4] + i * 4);
+        }
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 4; c++) {
+                float v = a[r * 4] * b[c] + a[r * 4 + 1] * b[4 + c] + a[r * 4 + 2] * b[8 + c];
+                ab[r * 4 + c] = c == 3 ? v + a[r * 4 + 3] : v;
+            }
+        }
+        for (uint32_t i = 0; i < 12; i++) writeFloat(memory, state.gpr[5] + i * 4, ab[i]);
+    }
+
+    // PSMTXMultVec(m, src, dst): dst = m * (src, 1)
+    static void psmtxMultVec(CPU&, Memory& memory, CPUState& state) {
+        float m[12], v[3], out[3];
+        for (uint32_t i = 0; i < 12; i++) m[i] = readFloat(memory, state.gpr[3] + i * 4);
+        for (uint32_t i = 0; i < 3; i++) v[i] = readFloat(memory, state.gpr[4] + i * 4);
+        for (int r = 0; r < 3; r++) {
+            out[r] = m[r * 4] * v[0] + m[r * 4 + 1] * v[1] + m[r * 4 + 2] * v[2] + m[r * 4 + 3];
+        }
+        for (uint32_t i = 0; i < 3; i++) writeFloat(memory, state.gpr[5] + i * 4, out[i]);
+    }
+
+    static inline const Hook hooks[] = {
+        { "memcpy",            memcpyHook },
+        { "memset",            memsetHook },
+        { "DCFlushRange",      cacheNoOp },
+        { "DCStoreRange",      cacheNoOp },
+        { "DCInvalidateRange", cacheNoOp },
+        { "ICInvalidateRange", icInvalidateRange },
+        { "OSReport",          osReport },
+        { "PSMTXIdentity",     psmtxIdentity },
+        { "PSMTXCopy",         psmtxCopy },
+        { "PSMTXConcat",       psmtxConcat },
+        { "PSMTXMultVec",      psmtxMultVec },
+    };
+    static const uint32_t NUM_HOOKS = sizeof(hooks) / sizeof(hooks[0]);
+};
+
+void CPU::executeHLE(uint32_t inst) {
+    HLE::call(inst & 0x03FFFFFF, *this, memory, state);
+}
+
+// 's' as a JSON string literal
+static std::string jsonQuote(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (uint8_t(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04X", uint8_t(c));
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// Lockstep netplay over UDP (--netplay). Every player runs the same disc
+// and sends only its controller word for each frame; the guest has one
+// input register, so it sees the OR of all players' words. Local input
+// takes effect 'delay' frames after it is read, which on a fast link gives
+// the other players' words time to arrive. When one is late the emulator
+// predicts it (the player's last known word) and runs ahead, at most
+// MAX_ROLLBACK frames; when the real word arrives and differs, it rolls
+// back to the save state taken before that frame and runs the frames
+// again (see WiiEmulator::replayMispredicted). Every HASH_INTERVAL frames
+// the players compare state hashes of frames whose input is final, which
+// catches desyncs.
+//
+// Each packet carries the sender's input from the first frame the
+// receiver has not acknowledged, so lost packets only delay input. Fields
+// are 32-bit words in network byte order.
+class Netplay {
+public:
+    static const uint32_t MAX_PLAYERS = 4;
+    static const uint32_t MAX_DELAY = 15;
+    static const uint32_t MAX_ROLLBACK = 8;
+    static const uint32_t HASH_INTERVAL = 30;
+
+    Netplay() : sock(-1), player(0), players(0), delay(0), queried(0), confirmed(0), mispredicted(UINT32_MAX),
+                nextHashFrame(0), latestHash(UINT32_MAX), desynced(false), stallMs(0), peers(), hashes(), finalHashes() {}
+
+    ~Netplay() {
+        if (sock >= 0) ::close(sock);
+    }
+
+    Netplay(const Netplay&) = delete;
+    Netplay& operator=(const Netplay&) = delete;
+
+    // 'addresses' lists every player's host:port in player order, the same
+    // on every machine; this machine is 'localPlayer' and binds its port
+    bool open(uint32_t localPlayer, const char* addresses, uint32_t inputDelay) {
+        if (inputDelay > MAX_DELAY) {
+            SDL_Log("Netplay input delay %u is over the limit of %u frames", inputDelay, MAX_DELAY);
+            return false;
+        }
+        players = 0;
+        for (const char* p = addresses; *p;) {
+            const char* end = std::strchr(p, ',');
+            std::string entry(p, end ? size_t(end - p) : std::strlen(p));
+            if (players == MAX_PLAYERS || !resolve(entry, peers[players].address)) {
+                SDL_Log("Bad netplay address list %s (up to %u host:port entries)", addresses, MAX_PLAYERS);
+                return false;
+            }
+            players++;
+            p = end ? end + 1 : p + entry.size();
+        }
+        if (players < 2 || localPlayer >= players) {
+            SDL_Log("Netplay needs at least two players and a local player index below %u", players);
+            return false;
+        }
+        sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        const sockaddr_in& local = peers[localPlayer].address;
+        if (sock < 0 || bind(sock, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+            SDL_Log("Failed to open netplay port %u: %s", ntohs(local.sin_port), std::strerror(errno));
+            if (sock >= 0) ::close(sock);
+            sock = -1;
+            return false;
+        }
+        player = localPlayer;
+        delay = inputDelay;
+        // Nobody has input for the first 'delay' frames; they are all zero
+        for (uint32_t p = 0; p < players; p++) {
+            peers[p].received = delay;
+            peers[p].hashFrame = UINT32_MAX;
+        }
+        SDL_Log("Netplay: player %u of %u on port %u, input delay %u frames",
+                player, players, ntohs(local.sin_port), delay);
+        return true;
+    }
+
+    bool isOpen() const { return sock >= 0; }
+    uint32_t getPlayer() const { return player; }
+    uint32_t getPlayerCount() const { return players; }
+    uint32_t getDelay() const { return delay; }
+    bool hasDesynced() const { return desynced; }
+    double getStallMs() const { return stallMs; }
+
+    // The local controller as read at 'frame', which applies 'delay' frames
+    // later. Frames are given in order.
+    void setLocalInput(uint32_t frame, uint32_t word) {
+        Peer& self = peers[player];
+        if (frame + delay != self.received) return;
+        self.words[self.received % INPUT_RING] = word;
+        self.received++;
+        updateConfirmed();
+    }
+
+    // Exchange input, then wait while running 'frame' would put this
+    // machine more than MAX_ROLLBACK frames ahead of the input it has.
+    // False when a player stopped sending.
+    bool waitForFrame(uint32_t frame) {
+        return waitFor(frame + 1 > MAX_ROLLBACK ? frame + 1 - MAX_ROLLBACK : 0, 0);
+    }
+
+    // End of a session after 'frames' frames: wait for every player's
+    // input for them, and for the others to have ours
+    bool finish(uint32_t frames) {
+        bool ok = waitFor(frames, frames);
+        send();  // the others may still be waiting for our acknowledgement
+        return ok;
+    }
+
+    // Every player's input for 'frame', merged. Words not received yet
+    // are predicted; if a prediction turns out wrong, the frame is
+    // reported by takeMispredictedFrame().
+    uint32_t getInput(uint32_t frame) {
+        uint32_t merged = 0;
+        for (uint32_t p = 0; p < players; p++) {
+            Peer& peer = peers[p];
+            uint32_t word = frame < peer.received ? peer.words[frame % INPUT_RING]
+                          : peer.received ? peer.words[(peer.received - 1) % INPUT_RING] : 0;
+            peer.used[frame % INPUT_RING] = word;
+            merged |= word;
+        }
+        queried = std::max(queried, frame + 1);
+        return merged;
+    }
+
+    // First frame run with a wrong prediction since the last call, or
+    // UINT32_MAX
+    uint32_t takeMispredictedFrame() {
+        uint32_t frame = mispredicted;
+        mispredicted = UINT32_MAX;
+        return frame;
+    }
+
+    // State hash after 'frame' ran, again after every rollback over it
+    void setFrameHash(uint32_t frame, uint64_t hash) {
+        hashes[frame % INPUT_RING] = { frame, hash };
+    }
+
+private:
+    static const uint32_t INPUT_RING = 64;          // frames of input and hashes kept
+    static const uint32_t HASH_HISTORY = 8;         // final hashes kept for comparison
+    static const uint32_t MAX_PACKET_INPUTS = 32;
+    static const uint32_t HEADER_WORDS = 7;
+    static const uint32_t MAGIC = 0x464C4E50;       // "FLNP"
+    static const uint32_t RESEND_MS = 5;
+    static const uint32_t TIMEOUT_MS = 5000;
+    static const uint32_t CONNECT_TIMEOUT_MS = 30000;  // for players not heard from yet
+
+    struct Peer {
+        sockaddr_in address;
+        uint32_t received;               // frames of this player's input known here
+        uint32_t acked;                  // frames of our input this player has
+        uint32_t words[INPUT_RING];      // input by frame
+        uint32_t used[INPUT_RING];       // word getInput() used, to spot mispredictions
+        uint32_t hashFrame;              // the player's latest final hash, checked if 'hashPending'
+        uint64_t hash;
+        bool hashPending;
+        bool heard;
+    };
+
+    struct FrameHash {
+        uint32_t frame;
+        uint64_t hash;
+    };
+
+    static bool resolve(const std::string& entry, sockaddr_in& address) {
+        size_t colon = entry.rfind(':');
+        if (colon == std::string::npos) return false;
+        std::string host = entry.substr(0, colon), port = entry.substr(colon + 1);
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result) return false;
+        std::memcpy(&address, result->ai_addr, sizeof(address));
+        freeaddrinfo(result);
+        return true;
+    }
+
+    void updateConfirmed() {
+        uint32_t frames = UINT32_MAX;
+        for (uint32_t p = 0; p < players; p++) frames = std::min(frames, peers[p].received);
+        confirmed = frames;
+    }
+
+    // Poll until 'inputs' frames of input are confirmed and every player
+    // has 'acks' frames of ours
+    bool waitFor(uint32_t inputs, uint32_t acks) {
+        auto start = std::chrono::steady_clock::now();
+        for (;;) {
+            exchange();
+            uint32_t lagging = UINT32_MAX;
+            for (uint32_t p = 0; p < players && lagging == UINT32_MAX; p++) {
+                if (peers[p].received < inputs || (p != player && peers[p].acked < acks)) lagging = p;
+            }
+            double waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (lagging == UINT32_MAX) {
+                stallMs += waited;
+                return true;
+            }
+            if (waited > (peers[lagging].heard ? TIMEOUT_MS : CONNECT_TIMEOUT_MS)) {
+                SDL_Log("Netplay: timed out waiting for player %u", lagging);
+                stallMs += waited;
+                return false;
+            }
+            pollfd pfd = { sock, POLLIN, 0 };
+            ::poll(&pfd, 1, RESEND_MS);
+        }
+    }
+
+    // Publish newly final hashes, send our input to everyone and take in
+    // whatever has arrived
+    void exchange() {
+        // Hashes are final once the input before them is and no rollback
+        // over them is pending
+        uint32_t final = std::min({confirmed, queried, mispredicted});
+        for (; nextHashFrame < final; nextHashFrame += HASH_INTERVAL) {
+            const FrameHash& h = hashes[nextHashFrame % INPUT_RING];
+            if (h.frame != nextHashFrame) continue;
+            finalHashes[(nextHashFrame / HASH_INTERVAL) % HASH_HISTORY] = h;
+            latestHash = nextHashFrame;
+        }
+        send();
+        receive();
+        checkHashes();
+    }
+
+    void send() {
+        const Peer& self = peers[player];
+        uint32_t packet[HEADER_WORDS + MAX_PACKET_INPUTS];
+        for (uint32_t p = 0; p < players; p++) {
+            if (p == player) continue;
+            const Peer& peer = peers[p];
+            uint32_t first = std::min(peer.acked, self.received);
+            uint32_t count = std::min(self.received - first, MAX_PACKET_INPUTS);
+            const FrameHash& h = finalHashes[(latestHash / HASH_INTERVAL) % HASH_HISTORY];
+            packet[0] = htonl(MAGIC);
+            packet[1] = htonl(player | (delay << 8) | (count << 16));
+            packet[2] = htonl(first);
+            packet[3] = htonl(peer.received);  // acknowledges their input
+            packet[4] = htonl(latestHash);
+            packet[5] = htonl(uint32_t(h.hash >> 32));
+            packet[6] = htonl(uint32_t(h.hash));
+            for (uint32_t i = 0; i < count; i++) packet[HEADER_WORDS + i] = htonl(self.words[(first + i) % INPUT_RING]);
+            // Losses and unreachable players are covered by resending
+            sendto(sock, packet, (HEADER_WORDS + count) * 4, 0,
+                   reinterpret_cast<const sockaddr*>(&peer.address), sizeof(peer.address));
+        }
+    }
+
+    void receive() {
+        uint32_t packet[HEADER_WORDS + MAX_PACKET_INPUTS];
+        for (;;) {
+            ssize_t size = recv(sock, packet, sizeof(packet), 0);
+            if (size < 0) {
+                if (errno == EINTR) continue;
+                return;  // EAGAIN: nothing more queued
+            }
+            if (size < ssize_t(HEADER_WORDS * 4) || ntohl(packet[0]) != MAGIC) continue;
+            uint32_t info = ntohl(packet[1]);
+            uint32_t from = info & 0xFF, count = info >> 16;
+            if (from >= players || from == player || size != ssize_t((HEADER_WORDS + count) * 4)) continue;
+            if (((info >> 8) & 0xFF) != delay) {
+                if (!desynced) SDL_Log("Netplay: player %u uses a different input delay", from);
+                desynced = true;
+                continue;
+            }
+            Peer& peer = peers[from];
+            peer.heard = true;
+            peer.acked = std::max(peer.acked, ntohl(packet[3]));
+            uint32_t hashFrame = ntohl(packet[4]);
+            if (hashFrame != UINT32_MAX && hashFrame != peer.hashFrame) {
+                peer.hashFrame = hashFrame;
+                peer.hash = (uint64_t(ntohl(packet[5])) << 32) | ntohl(packet[6]);
+                peer.hashPending = true;
+            }
+            // Take the frames that extend what we have, as far as the ring
+            // can hold them without overwriting frames that may roll back
+            uint32_t first = ntohl(packet[2]);
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t frame = first + i;
+                if (frame != peer.received || frame >= queried + INPUT_RING - MAX_ROLLBACK - 1) continue;
+                uint32_t word = ntohl(packet[HEADER_WORDS + i]);
+                peer.words[frame % INPUT_RING] = word;
+                if (frame < queried && peer.used[frame % INPUT_RING] != word) {
+                    mispredicted = std::min(mispredicted, frame);
+                }
+                peer.received++;
+            }
+        }
+        updateConfirmed();
+    }
+
+    void checkHashes() {
+        for (uint32_t p = 0; p < players; p++) {
+            Peer& peer = peers[p];
+            if (!peer.hashPending || latestHash == UINT32_MAX || peer.hashFrame > latestHash) continue;
+            peer.hashPending = false;
+            const FrameHash& own = finalHashes[(peer.hashFrame / HASH_INTERVAL) % HASH_HISTORY];
+            if (own.frame != peer.hashFrame) continue;  // too old to compare
+            if (own.hash != peer.hash) {
+                if (!desynced) SDL_Log("Netplay: desync with player %u at frame %u", p, peer.hashFrame);
+                desynced = true;
+            }
+        }
+    }
+
+    int sock;
+    uint32_t player;
+    uint32_t players;
+    uint32_t delay;
+    uint32_t queried;        // frames getInput() has been asked for
+    uint32_t confirmed;      // frames with every player's input
+    uint32_t mispredicted;
+    uint32_t nextHashFrame;  // next frame whose hash becomes final
+    uint32_t latestHash;     // frame of the newest final hash, or UINT32_MAX
+    bool desynced;
+    double stallMs;
+    Peer peers[MAX_PLAYERS];
+    FrameHash hashes[INPUT_RING];
+    FrameHash finalHashes[HASH_HISTORY];
+};
+
+// Main emulator class
+class WiiEmulator {
+public:
+    // 'fastmem' = false keeps guest RAM in private anonymous memory, which
+    // fork() shares copy-on-write (see BatchRunner::setZygote)
+    explicit WiiEmulator(bool fastmem = true) : memory(fastmem), cpu(memory, scheduler),
+#if FLAMES_JIT
+                    jit(cpu, memory, scheduler), jitActive(false), jitCacheHash(0),
+#endif
+                    hleEnabled(true), profiler(cpu, symbols), running(false), useJIT(true), perfMap(false), jitdump(false),
+                    profileRate(0), headless(false), headlessFrames(0), runMs(0), frameTimes(), frameArena(FRAME_ARENA_SIZE),
+                    steadyHeap(), steadyAllocations(0), deterministic(false), netplayLost(false), rollbacks(0), rollbackFrames(0),
+                    demo{0, 440, false, false, false} {
+        memory.connectScheduler(&scheduler);
+        memory.connectCPU(&cpu);
+    }
+
+    // Run 'frames' frames without a window, audio device or frame pacing,
+    // recording per-frame state hashes and host times (call before init).
+    // Calling it again after a run starts a new report from the current
+    // state.
+    void setHeadless(uint32_t frames) {
+        headless = true;
+        headlessFrames = frames;
+        runMs = 0;
+        frameHashes.clear();
+        frameHashes.reserve(frames);
+        std::fill(std::begin(frameTimes), std::end(frameTimes), 0);
+    }
+
+    // Heap allocations the main thread made after the warm-up frames of
+    // the last run; 0 is expected
+    uint64_t getSteadyHeapAllocations() const { return steadyAllocations; }
+
+    // Whether the last run broke its allocation budget: any allocation an
+    // allocation-checking build caught, or with 'strict' (--assert-no-alloc)
+    // any steady-state heap allocation on the main thread
+    bool failsAllocationCheck(bool strict) const {
+        return AllocCheck::getViolations() || (strict && steadyAllocations);
+    }
+
+    // Drive input from a movie file (see Input::loadMovie)
+    bool loadMovie(const char* path) { return input.loadMovie(path); }
+
+    // Save the input of every frame to a movie file (see Input::recordMovie)
+    bool recordMovie(const char* path) { return input.recordMovie(path); }
+
+    // Make runs bit-exact: the same disc, options and input give the same
+    // frame hashes every time (call before init). Device timing already
+    // comes from guest cycles only, device work resumes on the scheduler
+    // and input is read once per frame; on top of that this turns off JIT
+    // superblocks (see JIT::setTiering) and pins the host floating
+    // point environment. The interpreter and the JIT charge the same
+    // cycles per block and dispatch events at the same block boundaries,
+    // so either gives the same hashes. Live input can be kept with
+    // recordMovie.
+    void setDeterministic(bool enabled) { deterministic = enabled; }
+
+    // Join a netplay session (see Netplay; call before init). Rollback
+    // needs save states, which journal guest RAM, so the JIT runs without
+    // fastmem. Every player has to take the same steps, so the session
+    // runs in deterministic mode.
+    bool setNetplay(uint32_t player, const char* addresses, uint32_t delay) {
+        if (!netplay.open(player, addresses, delay)) return false;
+        deterministic = true;
+        memory.enableSaveStates(NETPLAY_STATES);
+        netplayStates.resize(NETPLAY_STATES);
+        return true;
+    }
+
+    // Whether a netplay session desynced or lost a player
+    bool failsNetplay() const { return netplay.isOpen() && (netplayLost || netplay.hasDesynced()); }
+
+    // Run guest code on the interpreter only (call before init)
+    void setInterpreterOnly(bool interpreterOnly) { useJIT = !interpreterOnly; }
+
+    // Describe JIT blocks to perf via a perf map and/or jitdump (call
+    // before init)
+    void setPerfOutput(bool map, bool dump) {
+        perfMap = map;
+        jitdump = dump;
+    }
+
+    // Guest symbols (.map or ELF) used to name JIT blocks and profiles,
+    // and to find functions to replace with HLE
+    bool loadSymbols(const char* path) { return symbols.load(path); }
+
+    // Function signatures used to find SDK routines to replace with HLE
+    bool loadSignatures(const char* path) { return signatures.load(path); }
+
+    // Write signatures for the booted game's symbols to 'path'
+    void setSignatureOutput(const char* path) { signatureOutput = path; }
+
+    void setHLEEnabled(bool enabled) { hleEnabled = enabled; }
+
+    // Keep recompiler analysis in 'dir' between runs (see JIT::loadCache)
+    void setJitCacheDir(const char* dir) { jitCacheDir = dir; }
+
+    // Log guest stores to 'length' bytes at 'address', or with 'access'
+    // every load too (see Watchpoints)
+    bool addWatchpoint(uint32_t address, uint32_t length, bool access) {
+        return memory.addWatchpoint(address, length, access, &cpu.getState().pc);
+    }
+
+    // Sample the guest PC at 'rateHz' while running and write the profile
+    // to '<prefix>.txt' and '<prefix>.folded' on exit
+    void setProfiler(const char* prefix, uint32_t rateHz) {
+        profilePrefix = prefix;
+        profileRate = rateHz;
+    }
+
+    bool init() {
+        if (!headless) {
+            if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+                SDL_Log("SDL initialization failed: %s", SDL_GetError());
+                return false;
+            }
+
+            if (!video.init() || !audio.init()) {
+                return false;
+            }
+
+            // Connect components to memory
+            memory.connectVideo(&video);
+            memory.connectAudio(&audio);
+        }
+        memory.connectInput(&input);
+
+#if FLAMES_JIT
+        if ((perfMap || jitdump) && perfOutput.open(perfMap, jitdump)) {
+            jit.setProfilingOutput(&perfOutput, &symbols);
+        }
+        if (useJIT && jit.init()) {
+            jit.setTiering(!deterministic);
+            cpu.setJIT(&jit);
+            jitActive = true;
+        }
+#endif
+        return true;
+    }
+
+    void shutdown() {
+        JobSystem::stop();
+        JobSystem::report();
+        ThreadRoles::report();  // while the audio thread still exists
+        SDL_Log("Frame arena peak %zu of %zu bytes (%zu overflowed to the heap); device task peak %zu of %u",
+                frameArena.getPeak(), frameArena.getCapacity(), frameArena.getOverflowPeak(),
+                memory.getDeviceTaskPeak(), DeviceTasks::MAX_TASKS);
+        AllocCheck::report();
+        if (netplay.isOpen()) {
+            SDL_Log("Netplay: %llu rollbacks over %llu frames, %.1f ms waiting for input%s",
+                    (unsigned long long)rollbacks, (unsigned long long)rollbackFrames, netplay.getStallMs(),
+                    netplay.hasDesynced() ? ", desynced" : "");
+        }
+#if FLAMES_JIT
+        if (!jitCachePath.empty()) jit.saveCache(jitCachePath.c_str(), jitCacheHash);
+#endif
+        video.shutdown();
+        audio.shutdown();
+        Tracer::write();  // after the audio thread has stopped
+        SDL_Quit();
+    }
+
+    // Boot a disc image straight into the game via the HLE apploader
+    bool bootDisc(const char* path) {
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!disc.open(path)) {
+            return false;
+        }
+        discPath = path;
+        Apploader apploader;
+        if (!apploader.hleBoot(disc, memory, cpu)) {
+            SDL_Log("HLE boot failed for %s", path);
+            return false;
+        }
+        hookLibraryFunctions(apploader.getTextSections());
+#if FLAMES_JIT
+        if (jitActive && !jitCacheDir.empty()) {
+            uint64_t executableHash = 0xCBF29CE484222325ull;
+            for (const Apploader::Section& section : apploader.getTextSections()) {
+                executableHash = JIT::hashGuest(memory, section.address, section.size, executableHash);
+            }
+            char name[32];
+            std::snprintf(name, sizeof(name), "/%016llX.jitcache", (unsigned long long)executableHash);
+            jitCachePath = jitCacheDir + name;
+            jitCacheHash = executableHash;
+            jit.loadCache(jitCachePath.c_str(), jitCacheHash);
+        }
+#endif
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+        SDL_Log("Booted %s disc in %.2f ms, entry point 0x%08X",
+                disc.isWii() ? "Wii" : "GameCube", elapsed / 1000.0, cpu.getState().pc);
+        return true;
+    }
+
+    void run() {
+        if (deterministic) pinFloatingPoint();
+        if (headless) {
+            runHeadless();
+            return;
+        }
+        running = true;
+        
+        // Timing for 60 FPS
+        const auto frameTime = std::chrono::microseconds(16667);  // ~60 FPS
+        auto nextFrame = std::chrono::high_resolution_clock::now();
+        uint32_t frameNumber = 0;
+        ThreadRoles::enter(THREAD_MAIN);
+        if (profileRate) profiler.start(profileRate);
+        
+        while (running) {
+            auto frameStart = std::chrono::high_resolution_clock::now();
+            uint32_t frame = frameNumber++;
+            beginFrame(frame);
+            AllocCheck::Scope allocScope(THREAD_MAIN);
+            TraceScope frameTrace(TRACE_FRAME, frame);
+            
+            // Update input
+            {
+                TraceScope trace(TRACE_FRAME_INPUT);
+                input.update();
+            }
+            if (input.shouldQuit()) {
+                running = false;
+                break;
+            }
+            
+            if (netplay.isOpen()) {
+                if (!runNetplayFrame(frame)) break;
+            } else {
+                emulateFrame();
+            }
+
+            // Render
+            video.render();
+            
+            // Frame timing for consistent 60 FPS
+            nextFrame += frameTime;
+            {
+                TraceScope trace(TRACE_FRAME_PACING);
+                std::this_thread::sleep_until(nextFrame);
+            }
+            
+            // Log FPS occasionally
+            static int frameCount = 0;
+            static auto lastFpsLog = frameStart;
+            frameCount++;
+            if (frameCount >= 300) {  // Every 5 seconds at 60 FPS
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    frameStart - lastFpsLog).count();
+                double fps = (frameCount * 1000.0) / elapsed;
+                SDL_Log("FPS: %.2f", fps);
+                frameCount = 0;
+                lastFpsLog = frameStart;
+            }
+        }
+        endFrames(frameNumber);
+
+        if (profileRate) {
+            profiler.stop();
+            profiler.write(profilePrefix);
+        }
+    }
+
+    // JSON summary of a headless run: per-frame state hashes, a histogram
+    // of host frame times and a hash of guest RAM at the end
+    void writeReport(FILE* out) {
+        uint64_t ramHash = hashBytes(memory.getPointer(0x80000000, MEM1_SIZE), MEM1_SIZE, FNV_BASIS);
+        ramHash = hashBytes(memory.getPointer(0x90000000, MEM2_SIZE), MEM2_SIZE, ramHash);
+        std::fprintf(out, "{\"disc\": %s, \"frames\": %zu, \"wall_ms\": %.3f, \"frames_per_second\": %.1f, "
+                          "\"ram_hash\": \"%016llX\", \"frame_hashes\": [",
+                     jsonQuote(discPath).c_str(), frameHashes.size(), runMs,
+                     runMs > 0 ? frameHashes.size() * 1000.0 / runMs : 0.0, (unsigned long long)ramHash);
+        for (size_t i = 0; i < frameHashes.size(); i++) {
+            std::fprintf(out, "%s\"%016llX\"", i ? ", " : "", (unsigned long long)frameHashes[i]);
+        }
+        // Bucket 0 is under 1 us, bucket k is [2^(k-1), 2^k) us
+        std::fprintf(out, "], \"frame_time_us_log2\": [");
+        for (uint32_t i = 0; i < FRAME_TIME_BUCKETS; i++) std::fprintf(out, "%s%u", i ? ", " : "", frameTimes[i]);
+        std::fprintf(out, "], \"steady_heap_allocations\": %llu, \"frame_arena_peak\": %zu, \"threads\": ",
+                     (unsigned long long)steadyAllocations, frameArena.getPeak());
+        ThreadRoles::report(out);
+        std::fprintf(out, ", \"deterministic\": %s", deterministic ? "true" : "false");
+        if (!memory.getWatchpoints().empty()) {
+            std::fprintf(out, ", \"watchpoint_hits\": %llu", (unsigned long long)memory.getWatchpoints().getHits());
+        }
+        if (netplay.isOpen()) {
+            std::fprintf(out, ", \"netplay\": {\"player\": %u, \"players\": %u, \"input_delay\": %u, "
+                              "\"rollbacks\": %llu, \"rollback_frames\": %llu, \"stall_ms\": %.1f, "
+                              "\"desync\": %s, \"lost\": %s}",
+                         netplay.getPlayer(), netplay.getPlayerCount(), netplay.getDelay(),
+                         (unsigned long long)rollbacks, (unsigned long long)rollbackFrames, netplay.getStallMs(),
+                         netplay.hasDesynced() ? "true" : "false", netplayLost ? "true" : "false");
+        }
+#if FLAMES_ALLOC_CHECK
+        std::fprintf(out, ", \"allocation_violations\": ");
+        AllocCheck::report(out);
+#endif
+        std::fprintf(out, "}\n");
+        std::fflush(out);
+    }
+
+private:
+    static const uint32_t FRAME_TIME_BUCKETS = 24;
+    static const uint32_t WARMUP_FRAMES = 60;
+    static const size_t FRAME_ARENA_SIZE = 1 << 20;
+    static const uint64_t FNV_BASIS = 0xCBF29CE484222325ull;
+
+    // State of the built-in demo, part of save states
+    struct Demo {
+        uint32_t colorCycle;
+        int toneFreq;
+        bool audioOn;
+        bool spacePressed;
+        bool memTestDone;
+    };
+
+    // FNV-1a over 64-bit words (then the tail bytes): the RAM hash covers
+    // 88MB per report, which is too slow a byte at a time
+    static uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, p + i, 8);
+            hash ^= word;
+            hash *= 0x100000001B3ull;
+        }
+        for (; i < size; i++) {
+            hash ^= p[i];
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // What a frame leaves behind that can be compared between runs: the
+    // CPU registers and the video and audio registers
+    uint64_t frameHash() {
+        const CPUState& s = cpu.getState();
+        uint64_t hash = hashBytes(s.gpr, sizeof(s.gpr), FNV_BASIS);
+        hash = hashBytes(s.ps0, sizeof(s.ps0), hash);
+        hash = hashBytes(s.ps1, sizeof(s.ps1), hash);
+        const uint32_t regs[] = { s.pc, s.cr, s.xer, s.lr, s.ctr, s.msr, s.fpscr,
+                                  memory.read32(REG_VIDEO_BG_COLOR), memory.read32(REG_AUDIO_FREQ) };
+        return hashBytes(regs, sizeof(regs), hash);
+    }
+
+    void runHeadless() {
+        ThreadRoles::enter(THREAD_MAIN);
+        if (profileRate) profiler.start(profileRate);
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < headlessFrames; frame++) {
+            auto frameStart = std::chrono::steady_clock::now();
+            beginFrame(frame);
+            AllocCheck::Scope allocScope(THREAD_MAIN);
+            TraceScope frameTrace(TRACE_FRAME, frame);
+            if (input.hasMovie()) input.update();
+            if (netplay.isOpen()) {
+                if (!runNetplayFrame(frame)) break;
+            } else {
+                emulateFrame();
+            }
+            frameHashes.push_back(frameHash());
+            uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - frameStart).count();
+            uint32_t bucket = us ? uint32_t(64 - __builtin_clzll(us)) : 0;
+            frameTimes[std::min(bucket, FRAME_TIME_BUCKETS - 1)]++;
+        }
+        endFrames(headlessFrames);
+        if (netplay.isOpen() && !netplayLost) finishNetplay(uint32_t(frameHashes.size()));
+        runMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (profileRate) {
+            profiler.stop();
+            profiler.write(profilePrefix);
+        }
+    }
+
+    // Round to nearest with denormals kept, whatever the launching process
+    // or a loaded library left in the control registers; flushing denormals
+    // or another rounding mode would change results.
+    static void pinFloatingPoint() {
+        std::fesetround(FE_TONEAREST);
+#if defined(__SSE__)
+        _mm_setcsr(0x1F80);  // all exceptions masked, no flush to zero or denormals as zero
+#endif
+    }
+
+    // Guest code drives the hardware once a disc is booted; with no disc
+    // the CPU stays halted, only guest time advances and the demo runs
+    void emulateFrame() {
+        {
+            TraceScope trace(TRACE_FRAME_CPU);
+            cpu.run(CPU_CLOCK_HZ / 60);
+        }
+        if (!cpu.isRunning()) {
+            TraceScope trace(TRACE_FRAME_DEMO);
+            updateDemo();
+        }
+    }
+
+    // Everything a rollback restores. Guest RAM is in the Memory journal,
+    // so a state is a few KB and only valid in this emulator.
+    struct SaveState {
+        CPU::State cpu;
+        Scheduler::State scheduler;
+        Memory::State memory;
+        Demo demo;
+    };
+
+    void saveState(SaveState& s) {
+        cpu.saveState(s.cpu);
+        scheduler.saveState(s.scheduler);
+        memory.saveState(s.memory);
+        s.demo = demo;
+    }
+
+    bool loadState(const SaveState& s) {
+        RamJournal::PageList restored;
+        if (!memory.restoreState(s.memory, frameArena, restored)) return false;
+        scheduler.restoreState(s.scheduler);
+        cpu.restoreState(s.cpu);
+        demo = s.demo;
+        for (size_t i = 0; i < restored.count; i++) cpu.invalidateICache(restored.pages[i], RamJournal::PAGE_SIZE);
+        return true;
+    }
+
+    // Netplay frame: hand over this frame's local input, wait if too far
+    // ahead of the other players, redo frames run on wrong predictions,
+    // then run the frame. False, ending the run, when a player is lost.
+    bool runNetplayFrame(uint32_t frame) {
+        netplay.setLocalInput(frame, input.getLocalState());
+        if (!netplay.waitForFrame(frame)) {
+            netplayLost = true;
+            return false;
+        }
+        replayMispredicted(frame);
+        runNetplayStep(frame);
+        return true;
+    }
+
+    // Run 'frame' from a new save state, as the first time or again
+    void runNetplayStep(uint32_t frame) {
+        saveState(netplayStates[frame % NETPLAY_STATES]);
+        input.setNetplayInput(netplay.getInput(frame));
+        emulateFrame();
+        uint64_t hash = frameHash();
+        netplay.setFrameHash(frame, hash);
+        if (frame < frameHashes.size()) frameHashes[frame] = hash;
+    }
+
+    // Roll back to the first frame before 'frame' that ran on a wrong
+    // prediction and run the frames from there again
+    void replayMispredicted(uint32_t frame) {
+        uint32_t first = netplay.takeMispredictedFrame();
+        if (first >= frame) return;
+        if (!loadState(netplayStates[first % NETPLAY_STATES])) {
+            SDL_Log("Netplay: no save state for frame %u", first);
+            netplayLost = true;
+            return;
+        }
+        rollbacks++;
+        rollbackFrames += frame - first;
+        for (uint32_t f = first; f < frame; f++) runNetplayStep(f);
+    }
+
+    // End of a headless netplay run: once every player's input for the
+    // frames run is in, correct the last frames if they were predicted
+    void finishNetplay(uint32_t frames) {
+        if (!netplay.finish(frames)) {
+            netplayLost = true;
+            return;
+        }
+        replayMispredicted(frames);
+    }
+
+    // Start of every frame in either loop. Transient data from the last
+    // frame is dropped, and once the warm-up frames (first compiles,
+    // containers reaching their working size) are over, the main thread's
+    // heap allocations start being counted and AllocCheck is armed.
+    void beginFrame(uint32_t frame) {
+        frameArena.reset();
+        if (frame == WARMUP_FRAMES) {
+            steadyHeap = HeapStats::current();
+            AllocCheck::arm(true);
+        }
+    }
+
+    void endFrames(uint32_t frames) {
+        AllocCheck::arm(false);
+        steadyAllocations = frames > WARMUP_FRAMES ? HeapStats::current().allocations - steadyHeap.allocations : 0;
+        if (steadyAllocations) {
+            SDL_Log("%llu heap allocations during %u steady-state frames",
+                    (unsigned long long)steadyAllocations, frames - WARMUP_FRAMES);
+        }
+    }
+
+    // Replace SDK routines in the loaded executable with native versions,
+    // found by symbol name or by signature
+    void hookLibraryFunctions(const std::vector<Apploader::Section>& text) {
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!signatureOutput.empty()) {
+            SignatureDB generated;
+            for (const Apploader::Section& section : text) {
+                generated.generate(memory, symbols, section.address, section.address + section.size);
+            }
+            generated.save(signatureOutput.c_str());
+        }
+        if (!hleEnabled) return;
+
+        uint32_t hooked = HLE::hookSymbols(memory, symbols);
+        if (!signatures.empty()) {
+            for (const Apploader::Section& section : text) {
+                hooked += HLE::hookSignatures(memory, signatures, section.address, section.address + section.size);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+        SDL_Log("HLE hooked %u functions in %.2f ms", hooked, elapsed / 1000.0);
+    }
+
+    // Built-in demo used when no disc is loaded
+    void updateDemo() {
+        // Demo: Read input and update system
+        uint32_t buttons = memory.read32(REG_INPUT_STATE);
+        
+        // Change background color based on input
+        if (buttons & 0x00000001) demo.colorCycle += 0x01000000;  // UP - increase red
+        if (buttons & 0x00000002) demo.colorCycle -= 0x01000000;  // DOWN - decrease red
+        if (buttons & 0x00000004) demo.colorCycle += 0x00010000;  // LEFT - increase green
+        if (buttons & 0x00000008) demo.colorCycle -= 0x00010000;  // RIGHT - decrease green
+        
+        // Change audio tone with A/B buttons
+        if (buttons & 0x00000010) demo.toneFreq = std::min(demo.toneFreq + 10, 2000);  // A - higher
+        if (buttons & 0x00000020) demo.toneFreq = std::max(demo.toneFreq - 10, 100);   // B - lower
+        
+        // Space toggles audio on/off
+        if ((buttons & 0x00000040) && !demo.spacePressed) {
+            demo.audioOn = !demo.audioOn;
+            demo.spacePressed = true;
+        } else if (!(buttons & 0x00000040)) {
+            demo.spacePressed = false;
+        }
+        
+        // Write to memory-mapped registers
+        memory.write32(REG_VIDEO_BG_COLOR, demo.colorCycle);
+        memory.write32(REG_AUDIO_FREQ, demo.audioOn ? demo.toneFreq : 0);
+        
+        // Test memory read/write
+        if (!demo.memTestDone) {
+            // Write test pattern to MEM1
+            memory.write32(0x80000000, 0xDEADBEEF);
+            uint32_t testRead = memory.read32(0x80000000);
+            SDL_Log("Memory test - Written: 0xDEADBEEF, Read: 0x%08X", testRead);
+            demo.memTestDone = true;
+        }
+    }
+
+    Scheduler scheduler;
+    Memory memory;
+    Video video;
+    Audio audio;
+    Input input;
+    CPU cpu;
+#if FLAMES_JIT
+    JIT jit;
+    PerfJitOutput perfOutput;
+    bool jitActive;
+    std::string jitCachePath;
+    uint64_t jitCacheHash;
+#endif
+    std::string jitCacheDir;
+    SymbolDB symbols;
+    SignatureDB signatures;
+    std::string signatureOutput;
+    bool hleEnabled;
+    GuestProfiler profiler;
+    Disc disc;
+    bool running;
+    bool useJIT;
+    bool perfMap;
+    bool jitdump;
+    std::string profilePrefix;
+    uint32_t profileRate;
+    std::string discPath;
+
+    // Headless runs
+    bool headless;
+    uint32_t headlessFrames;
+    double runMs;
+    std::vector<uint64_t> frameHashes;
+    uint32_t frameTimes[FRAME_TIME_BUCKETS];
+
+    // Per-frame transient data (see FrameArena) and the heap check
+    FrameArena frameArena;
+    HeapStats::Counts steadyHeap;  // main thread's counts after warm-up
+    uint64_t steadyAllocations;
+
+    bool deterministic;
+
+    // Netplay, with a save state per frame that can still roll back
+    static const uint32_t NETPLAY_STATES = Netplay::MAX_ROLLBACK + 1;
+    Netplay netplay;
+    std::vector<SaveState> netplayStates;
+    bool netplayLost;
+    uint64_t rollbacks;
+    uint64_t rollbackFrames;
+
+    // Demo variables
+    Demo demo;
+};
+
+// Microbenchmarks for the per-access and per-frame hot paths (--bench).
+// Every case runs a fixed iteration count several times over the same
+// inputs; the median and fastest runs are written as JSON so results can
+// be compared between builds.
+class Benchmarks {
+public:
+    Benchmarks() : cpu(memory, scheduler), sink(0) {
+        memory.connectScheduler(&scheduler);
+        memory.connectCPU(&cpu);
+        memory.connectVideo(&video);
+        memory.connectAudio(&audio);
+        memory.connectInput(&input);
+    }
+
+    bool run(FILE* out) {
+        if (SDL_Init(SDL_INIT_EVENTS) < 0) {
+            SDL_Log("SDL initialization failed: %s", SDL_GetError());
+            return false;
+        }
+
+        const uint64_t ACCESSES = 1 << 20;
+        struct Region { const char* name; uint32_t base; };
+        const Region regions[] = {
+            { "mem1_cached",   0x80000000 },
+            { "mem1_uncached", 0xC0000000 },
+            { "mem2_cached",   0x90000000 },
+            { "locked_cache",  LOCKED_CACHE_BASE },
+        };
+        for (const Region& region : regions) {
+            // Walk a 16 KiB window so the host caches are not the bottleneck
+            uint32_t base = region.base;
+            measure(std::string("read32_") + region.name, ACCESSES, [&](uint64_t i) {
+                sink += memory.read32(base + ((uint32_t(i) << 2) & 0x3FFC));
+            });
+            measure(std::string("write32_") + region.name, ACCESSES, [&](uint64_t i) {
+                memory.write32(base + ((uint32_t(i) << 2) & 0x3FFC), uint32_t(i));
+            });
+        }
+
+        const uint32_t HOLLYWOOD_UNCACHED = 0xC0000000 | HOLLYWOOD_BASE;
+        measure("mmio_read32_timer", ACCESSES, [&](uint64_t) {
+            sink += memory.read32(HOLLYWOOD_UNCACHED + HW_TIMER);
+        });
+        measure("mmio_read32_input_state", ACCESSES, [&](uint64_t) {
+            sink += memory.read32(REG_INPUT_STATE);
+        });
+        measure("mmio_write32_bg_color", ACCESSES, [&](uint64_t i) {
+            memory.write32(REG_VIDEO_BG_COLOR, uint32_t(i));
+        });
+        measure("mmio_write32_irq_mask", ACCESSES, [&](uint64_t) {
+            memory.write32(HOLLYWOOD_UNCACHED + HW_PPCIRQMASK, 0);
+        });
+
+        // One callback's worth of samples, as requested by the device
+        std::vector<float> samples(512 * 2);
+        measure("audio_generate_512_frames", 4096, [&](uint64_t) {
+            audio.generateSamples(samples.data(), 512);
+            sink += uint32_t(samples[0] != 0.0f);
+        });
+
+        // Input::update with a queue of key transitions, per update call
+        const SDL_Keycode keys[] = { SDLK_UP, SDLK_DOWN, SDLK_LEFT, SDLK_RIGHT, SDLK_a, SDLK_b, SDLK_SPACE };
+        measure("input_update_14_events", 16384, [&](uint64_t) {
+            for (SDL_Keycode key : keys) {
+                SDL_Event event;
+                SDL_zero(event);
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = key;
+                SDL_PushEvent(&event);
+                event.type = SDL_KEYUP;
+                SDL_PushEvent(&event);
+            }
+            input.update();
+            sink += input.getButtonState();
+        });
+
+        // Rendering needs a window; skip it where none can be created
+        if (SDL_InitSubSystem(SDL_INIT_VIDEO) == 0 && video.init()) {
+            measure("video_render_frame", 120, [&](uint64_t i) {
+                video.setBackgroundColor(uint32_t(i) * 0x01010100);
+                video.render();
+            });
+            video.shutdown();
+        } else {
+            SDL_Log("Skipping video benchmark: %s", SDL_GetError());
+        }
+        SDL_Quit();
+
+        write(out);
+        return true;
+    }
+
+private:
+    static const int RUNS = 7;
+
+    struct Result {
+        std::string name;
+        uint64_t iterations;
+        double medianNs;   // per iteration
+        double minNs;
+    };
+
+    template <typename Body>
+    void measure(const std::string& name, uint64_t iterations, Body body) {
+        double runs[RUNS];
+        for (uint64_t i = 0; i < iterations / 8; i++) body(i);  // warm up
+        for (int r = 0; r < RUNS; r++) {
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < iterations; i++) body(i);
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            runs[r] = double(ns) / double(iterations);
+        }
+        std::sort(runs, runs + RUNS);
+        results.push_back({name, iterations, runs[RUNS / 2], runs[0]});
+    }
+
+    void write(FILE* out) const {
+        std::fprintf(out, "{\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            std::fprintf(out, "    {\"name\": \"%s\", \"iterations\": %llu, \"runs\": %d, "
+                              "\"median_ns\": %.3f, \"min_ns\": %.3f}%s\n",
+                         r.name.c_str(), (unsigned long long)r.iterations, RUNS,
+                         r.medianNs, r.minNs, i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(out, "  ],\n  \"checksum\": %u\n}\n", sink);
+    }
+
+    Scheduler scheduler;
+    Memory memory;
+    Video video;
+    Audio audio;
+    Input input;
+    CPU cpu;
+    uint32_t sink;  // keeps measured reads observable
+    std::vector<Result> results;
+};
+
+// Checks of emulator internals that need no disc (--self-check). Each
+// failed expectation is logged; the run fails if any did.
+class SelfChecks {
+public:
+    SelfChecks() : checks(0), failures(0) {}
 
-        // Create renderer with vsync for smooth 60 FPS
-        renderer = SDL_CreateRenderer(window, -1, 
-                                      SDL_RENDERER_ACCELERATED | 
-                                      SDL_RENDERER_PRESENTVSYNC);
-        if (!renderer) {
-            SDL_Log("Failed to create renderer: %s", SDL_GetError());
-            return false;
-        }
+    bool run(FILE* out) {
+        checkFrameArena();
+        checkFixedPool();
+        checkDeviceTasks();
+        checkFctiw();
+        std::fprintf(out, "Self-check: %u checks, %u failed\n", checks, failures);
+        return failures == 0;
+    }
 
-        return true;
+private:
+    void expect(bool ok, const char* what) {
+        checks++;
+        if (ok) return;
+        failures++;
+        SDL_Log("Self-check failed: %s", what);
     }
 
-    void shutdown() {
-        if (renderer) SDL_DestroyRenderer(renderer);
-        if (window) SDL_DestroyWindow(window);
+    void checkFrameArena() {
+        FrameArena arena(256);
+        uint8_t* block = static_cast<uint8_t*>(arena.allocate(100, 8));
+        uint32_t* words = arena.allocate<uint32_t>(10);
+        expect(block && words, "arena: allocations fit");
+        expect(reinterpret_cast<uintptr_t>(words) % alignof(uint32_t) == 0, "arena: typed allocation is aligned");
+        expect(reinterpret_cast<uint8_t*>(words) >= block + 100, "arena: allocations do not overlap");
+        expect(arena.getUsed() == 140 && arena.getPeak() == 140, "arena: used and peak count the bytes");
+
+        arena.reset();
+        expect(arena.getUsed() == 0, "arena: reset frees everything");
+        expect(arena.getPeak() == 140, "arena: reset keeps the peak");
+        expect(arena.allocate(16, 8) == block, "arena: reset reuses the block");
+
+        uint8_t* large = static_cast<uint8_t*>(arena.allocate(1000, 8));
+        expect(large && (large < block || large >= block + arena.getCapacity()), "arena: oversize request falls back to the heap");
+        if (large) std::memset(large, 0xA5, 1000);
+        expect(arena.getUsed() == 16, "arena: fallback leaves the block alone");
+        expect(arena.getOverflowPeak() == 0, "arena: overflow counts at reset");
+        arena.reset();
+        expect(arena.getOverflowPeak() == 1000, "arena: fallback bytes are reported");
+        expect(arena.getPeak() == 140, "arena: fallback does not count towards the peak");
     }
 
-    void setBackgroundColor(uint32_t color) {
-        bgColor = color;
+    void checkFixedPool() {
+        FixedPool<uint64_t, 4> pool;
+        void* slots[4];
+        for (void*& slot : slots) slot = pool.acquire();
+        expect(slots[0] && slots[1] && slots[2] && slots[3], "pool: N objects fit");
+        expect(std::set<void*>(std::begin(slots), std::end(slots)).size() == 4, "pool: slots are distinct");
+        expect(pool.acquire() == nullptr && pool.getFailures() == 1, "pool: exhaustion returns nullptr and counts");
+        expect(pool.getLive() == 4 && pool.getPeak() == 4, "pool: live and peak count objects");
+
+        pool.release(slots[2]);
+        expect(pool.acquire() == slots[2], "pool: released slot is reused");
+        pool.release(slots[0]);
+        pool.release(slots[1]);
+        expect(pool.getLive() == 2 && pool.getPeak() == 4, "pool: release keeps the peak");
+
+        *static_cast<uint64_t*>(slots[2]) = 0x1122334455667788ull;
+        FixedPool<uint64_t, 4>::State state;
+        pool.saveState(state);
+        *static_cast<uint64_t*>(slots[2]) = 0;
+        pool.acquire();
+        pool.restoreState(state);
+        expect(pool.getLive() == 2 && *static_cast<uint64_t*>(slots[2]) == 0x1122334455667788ull,
+               "pool: state restores contents and free list");
+        expect(pool.acquire() && pool.acquire() && !pool.acquire(), "pool: restored free list has the saved room");
     }
 
-    void render() {
-        // Extract RGBA from 32-bit color
-        uint8_t r = (bgColor >> 24) & 0xFF;
-        uint8_t g = (bgColor >> 16) & 0xFF;
-        uint8_t b = (bgColor >> 8) & 0xFF;
-        uint8_t a = bgColor & 0xFF;
+    // A task that waits for a completion, then finishes
+    class WaitingTask : public DeviceTask {
+    public:
+        WaitingTask(uint32_t& h, uint32_t& s) : handleOut(h), steps(s) {}
 
-        SDL_SetRenderDrawColor(renderer, r, g, b, a);
-        SDL_RenderClear(renderer);
+        int64_t resume() override {
+            handleOut = handle;
+            return steps++ == 0 ? WAIT : DONE;
+        }
 
-        // Draw some debug info
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_Rect rect = {10, 10, 200, 50};
-        SDL_RenderDrawRect(renderer, &rect);
+    private:
+        uint32_t& handleOut;
+        uint32_t& steps;
+    };
 
-        SDL_RenderPresent(renderer);
+    void checkDeviceTasks() {
+        Scheduler scheduler;
+        DeviceTasks tasks;
+        tasks.connectScheduler(&scheduler);
+        uint32_t handle = 0, steps = 0;
+        tasks.start<WaitingTask>(handle, steps);
+        scheduler.advanceTo(1000);
+        expect(steps == 1, "tasks: WAIT is not resumed by time alone");
+        tasks.wake(handle + DeviceTasks::MAX_TASKS);
+        scheduler.advanceTo(2000);
+        expect(steps == 1, "tasks: a handle from another serial is ignored");
+        tasks.wake(handle);
+        tasks.wake(handle);
+        scheduler.advanceTo(3000);
+        expect(steps == 2, "tasks: wake() resumes the task once");
+        uint32_t stale = handle;
+        steps = 0;
+        tasks.start<WaitingTask>(handle, steps);
+        expect(handle != stale && handle % DeviceTasks::MAX_TASKS == stale % DeviceTasks::MAX_TASKS,
+               "tasks: a reused frame gets a new handle");
+        tasks.wake(stale);
+        scheduler.advanceTo(4000);
+        expect(steps == 1, "tasks: waking a finished task's handle does nothing");
     }
 
-private:
-    SDL_Renderer* renderer;
-    SDL_Window* window;
-    uint32_t bgColor;
+    // fctiw in each FPSCR[RN] mode, and fctiwz, at the special values and
+    // the edges of the 32-bit range
+    void checkFctiw() {
+        struct Case {
+            double value;
+            int32_t expected[5];  // RN = 0 (nearest), 1 (zero), 2 (+inf), 3 (-inf); fctiwz
+        };
+        const Case cases[] = {
+            { 2.5,             { 2, 2, 3, 2, 2 } },
+            { -2.5,            { -2, -2, -2, -3, -2 } },
+            { 1.5,             { 2, 1, 2, 1, 1 } },
+            { INFINITY,        { INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX } },
+            { -INFINITY,       { INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN } },
+            { NAN,             { INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN } },
+            { 2147483648.0,    { INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX } },
+            { 2147483647.5,    { INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX } },
+            { 2147483646.5,    { 2147483646, 2147483646, INT32_MAX, 2147483646, 2147483646 } },
+            { -2147483648.0,   { INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN } },
+            { -2147483648.5,   { INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN } },
+            { -2147483647.5,   { INT32_MIN, -2147483647, -2147483647, INT32_MIN, -2147483647 } },
+        };
+
+        Scheduler scheduler;
+        Memory memory;
+        CPU cpu(memory, scheduler);
+        CPUState& state = cpu.getState();
+        state.msr |= MSR_FP;
+        for (const Case& c : cases) {
+            for (uint32_t mode = 0; mode < 5; mode++) {
+                state.fpscr = mode < 4 ? mode : 0;
+                state.ps0[2] = c.value;
+                uint32_t xo = mode < 4 ? 14 : 15;  // fctiw, fctiwz
+                cpu.execute((63u << 26) | (1u << 21) | (2u << 11) | (xo << 1));
+                uint64_t bits;
+                std::memcpy(&bits, &state.ps0[1], sizeof(bits));
+                char what[96];
+                std::snprintf(what, sizeof(what), "%s(%.1f) with RN=%u gives %d, not %d",
+                              mode < 4 ? "fctiw" : "fctiwz", c.value, state.fpscr & 3,
+                              int32_t(uint32_t(bits)), c.expected[mode]);
+                expect(int32_t(uint32_t(bits)) == c.expected[mode], what);
+            }
+        }
+    }
+
+    uint32_t checks;
+    uint32_t failures;
 };
 
-// Audio subsystem
-class Audio {
+#if FLAMES_JIT
+// Differential testing of the recompiler. The same disc boots into two
+// independent cores, one interpreting and one running the JIT, which are
+// stepped in lockstep a compiled block at a time. After every block the
+// register files and the stores each side made are compared, and RAM as a
+// whole every RAM_CHECK_INTERVAL blocks; the first divergence is reported
+// with the block that produced it. Runs headless. The JIT core has no
+// fastmem arena, so its stores all pass through Memory and are logged.
+class Lockstep {
 public:
-    Audio() : deviceId(0), frequency(440.0), phase(0.0) {}
+    Lockstep() : reference(true), recompiled(false), jit(recompiled.cpu, recompiled.memory, recompiled.scheduler),
+                 blocks(0) {}
 
-    bool init() {
-        SDL_AudioSpec desired, obtained;
-        SDL_zero(desired);
-        desired.freq = 48000;
-        desired.format = AUDIO_F32;
-        desired.channels = 2;
-        desired.samples = 512;  // Low latency
-        desired.callback = audioCallback;
-        desired.userdata = this;
+    bool run(const char* discPath, uint64_t cycles, FILE* out) {
+        if (!jit.init() || !disc.open(discPath)) return false;
+        recompiled.cpu.setJIT(&jit);
+        if (!reference.boot(disc) || !recompiled.boot(disc)) return false;
 
-        deviceId = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, 0);
-        if (deviceId == 0) {
-            SDL_Log("Failed to open audio device: %s", SDL_GetError());
-            return false;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t end = reference.scheduler.getTicks() + cycles;
+        while (reference.scheduler.getTicks() < end && recompiled.cpu.isRunning()) {
+            uint32_t pc = recompiled.cpu.getState().pc;
+            uint32_t instructions;
+            uint32_t cycles = recompiled.cpu.runLockstepBlock(0, instructions);
+            reference.cpu.runLockstepBlock(cycles, instructions);
+            blocks++;
+            if (!compareBlock(pc, instructions, cycles, out)) return false;
+            reference.writes.clear();
+            recompiled.writes.clear();
+            if (blocks % RAM_CHECK_INTERVAL == 0 && !compareRAM(out)) return false;
         }
+        if (!compareRAM(out)) return false;
 
-        SDL_PauseAudioDevice(deviceId, 0);  // Start playback
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::fprintf(out, "Lockstep: %llu blocks, %llu cycles, no divergence (%.1f ms)\n",
+                     (unsigned long long)blocks, (unsigned long long)reference.scheduler.getTicks(), ms);
         return true;
     }
 
-    void shutdown() {
-        if (deviceId) {
-            SDL_CloseAudioDevice(deviceId);
+private:
+    static const uint64_t RAM_CHECK_INTERVAL = 1 << 16;
+
+    struct Core {
+        Scheduler scheduler;
+        Memory memory;
+        CPU cpu;
+        std::vector<MemoryWrite> writes;
+
+        explicit Core(bool fastmem) : memory(fastmem), cpu(memory, scheduler) {
+            memory.connectScheduler(&scheduler);
+            memory.connectCPU(&cpu);
+        }
+
+        bool boot(const Disc& disc) {
+            Apploader apploader;
+            if (!apploader.hleBoot(disc, memory, cpu)) return false;
+            memory.setWriteLog(&writes);
+            return true;
+        }
+    };
+
+    // First register that differs, or an empty string. npc is scratch
+    // space for the interpreter and is not compared.
+    static std::string diffState(const CPUState& a, const CPUState& b) {
+        const size_t rest = offsetof(CPUState, cr), restEnd = offsetof(CPUState, reserve);
+        if (std::memcmp(&a, &b, offsetof(CPUState, npc)) == 0 &&
+            std::memcmp(reinterpret_cast<const uint8_t*>(&a) + rest, reinterpret_cast<const uint8_t*>(&b) + rest,
+                        restEnd - rest) == 0 &&
+            a.reserve == b.reserve) {
+            return std::string();
+        }
+        char text[96];
+        for (int i = 0; i < 32; i++) {
+            if (a.gpr[i] != b.gpr[i]) {
+                std::snprintf(text, sizeof(text), "r%d: %08X (interpreter) vs %08X (JIT)", i, a.gpr[i], b.gpr[i]);
+                return text;
+            }
+        }
+        for (int i = 0; i < 32; i++) {
+            if (std::memcmp(&a.ps0[i], &b.ps0[i], 8) || std::memcmp(&a.ps1[i], &b.ps1[i], 8)) {
+                std::snprintf(text, sizeof(text), "f%d: %g/%g (interpreter) vs %g/%g (JIT)",
+                              i, a.ps0[i], a.ps1[i], b.ps0[i], b.ps1[i]);
+                return text;
+            }
+        }
+        struct Field { const char* name; uint32_t CPUState::*member; };
+        static const Field fields[] = {
+            { "pc", &CPUState::pc }, { "cr", &CPUState::cr }, { "xer", &CPUState::xer },
+            { "lr", &CPUState::lr }, { "ctr", &CPUState::ctr }, { "msr", &CPUState::msr },
+            { "fpscr", &CPUState::fpscr }, { "exceptions", &CPUState::exceptions },
+            { "reserve address", &CPUState::reserveAddress },
+        };
+        for (const Field& f : fields) {
+            if (a.*f.member != b.*f.member) {
+                std::snprintf(text, sizeof(text), "%s: %08X (interpreter) vs %08X (JIT)", f.name, a.*f.member, b.*f.member);
+                return text;
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            if (a.sr[i] != b.sr[i]) {
+                std::snprintf(text, sizeof(text), "sr%d: %08X (interpreter) vs %08X (JIT)", i, a.sr[i], b.sr[i]);
+                return text;
+            }
+        }
+        for (int i = 0; i < 1024; i++) {
+            if (a.spr[i] != b.spr[i]) {
+                std::snprintf(text, sizeof(text), "spr%d: %08X (interpreter) vs %08X (JIT)", i, a.spr[i], b.spr[i]);
+                return text;
+            }
         }
+        if (a.reserve != b.reserve) return "reservation flag";
+        return std::string();
     }
 
-    void setToneFrequency(double freq) {
-        frequency = freq;
+    bool compareBlock(uint32_t pc, uint32_t instructions, uint32_t cycles, FILE* out) {
+        std::string diff = diffState(reference.cpu.getState(), recompiled.cpu.getState());
+        size_t count = std::max(reference.writes.size(), recompiled.writes.size()), w = 0;
+        while (w < count && w < reference.writes.size() && w < recompiled.writes.size() &&
+               sameWrite(reference.writes[w], recompiled.writes[w])) {
+            w++;
+        }
+        if (diff.empty() && w == count) return true;
+
+        std::fprintf(out, "Lockstep divergence in block %llu at 0x%08X (%u instructions, %u cycles, at cycle %llu)\n",
+                     (unsigned long long)blocks, pc, instructions, cycles,
+                     (unsigned long long)reference.scheduler.getTicks());
+        if (!diff.empty()) std::fprintf(out, "  %s\n", diff.c_str());
+        if (w < count) {
+            std::fprintf(out, "  store %zu differs\n", w);
+            printWrites("interpreter", reference.writes, out);
+            printWrites("JIT", recompiled.writes, out);
+        }
+        // The block as it was decoded; superblocks may continue elsewhere
+        std::fprintf(out, "  code:");
+        for (uint32_t i = 0; i < std::min<uint32_t>(instructions, 16); i++) {
+            std::fprintf(out, " %08X", reference.memory.read32(pc + i * 4));
+        }
+        std::fprintf(out, "%s\n", instructions > 16 ? " ..." : "");
+        return false;
     }
 
-private:
-    static void audioCallback(void* userdata, uint8_t* stream, int len) {
-        Audio* audio = static_cast<Audio*>(userdata);
-        float* buffer = reinterpret_cast<float*>(stream);
-        int samples = len / sizeof(float) / 2;  // stereo
+    static bool sameWrite(const MemoryWrite& a, const MemoryWrite& b) {
+        return a.address == b.address && a.size == b.size && a.value == b.value;
+    }
 
-        for (int i = 0; i < samples; i++) {
-            float sample = 0.0f;
-            if (audio->frequency > 0) {
-                sample = 0.1f * sinf(audio->phase);
-                audio->phase += 2.0f * M_PI * audio->frequency / 48000.0f;
-                if (audio->phase > 2.0f * M_PI) {
-                    audio->phase -= 2.0f * M_PI;
-                }
-            }
-            buffer[i * 2] = sample;      // left
-            buffer[i * 2 + 1] = sample;  // right
+    static void printWrites(const char* side, const std::vector<MemoryWrite>& writes, FILE* out) {
+        std::fprintf(out, "  %s stores:", side);
+        for (const MemoryWrite& w : writes) std::fprintf(out, " [%08X]%u=%X", w.address, w.size, w.value);
+        std::fprintf(out, "%s\n", writes.empty() ? " none" : "");
+    }
+
+    // Catches writes neither log sees, such as DMA
+    bool compareRAM(FILE* out) {
+        struct Region { const char* name; uint32_t base; uint32_t size; };
+        const Region regions[] = {
+            { "MEM1", 0x80000000, MEM1_SIZE },
+            { "MEM2", 0x90000000, MEM2_SIZE },
+            { "locked cache", LOCKED_CACHE_BASE, LOCKED_CACHE_SIZE },
+        };
+        for (const Region& r : regions) {
+            const uint8_t* a = reference.memory.getPointer(r.base, r.size);
+            const uint8_t* b = recompiled.memory.getPointer(r.base, r.size);
+            if (std::memcmp(a, b, r.size) == 0) continue;
+            uint32_t offset = 0;
+            while (a[offset] == b[offset]) offset++;
+            std::fprintf(out, "Lockstep divergence in %s at 0x%08X by block %llu: %02X (interpreter) vs %02X (JIT)\n",
+                         r.name, r.base + offset, (unsigned long long)blocks, a[offset], b[offset]);
+            return false;
         }
+        return true;
     }
 
-    SDL_AudioDeviceID deviceId;
-    double frequency;
-    float phase;
+    Disc disc;
+    Core reference;
+    Core recompiled;
+    JIT jit;
+    uint64_t blocks;
 };
+#endif
 
-// Input subsystem
-class Input {
+// Apply an emulator option from the command line. Returns how many
+// arguments it used, or 0 when args[0] is not an emulator option.
+static int applyEmulatorOption(WiiEmulator& emulator, const char* const* args, int count) {
+    if (std::strcmp(args[0], "--interpreter") == 0) {
+        emulator.setInterpreterOnly(true);
+        return 1;
+    }
+    if (std::strcmp(args[0], "--no-hle") == 0) {
+        emulator.setHLEEnabled(false);
+        return 1;
+    }
+    if (std::strcmp(args[0], "--deterministic") == 0) {
+        emulator.setDeterministic(true);
+        return 1;
+    }
+    if (count < 2) return 0;
+    if (std::strcmp(args[0], "--symbols") == 0) {
+        emulator.loadSymbols(args[1]);
+    } else if (std::strcmp(args[0], "--signatures") == 0) {
+        emulator.loadSignatures(args[1]);
+    } else if (std::strcmp(args[0], "--jit-cache") == 0) {
+        emulator.setJitCacheDir(args[1]);
+    } else if (std::strcmp(args[0], "--watch") == 0 || std::strcmp(args[0], "--watch-access") == 0) {
+        // address[:length], hex address, length in bytes (default a word)
+        char* end;
+        uint32_t address = uint32_t(std::strtoul(args[1], &end, 16));
+        uint32_t length = *end == ':' ? uint32_t(std::strtoul(end + 1, nullptr, 0)) : 4;
+        emulator.addWatchpoint(address, length, std::strcmp(args[0], "--watch-access") == 0);
+    } else {
+        return 0;
+    }
+    return 2;
+}
+
+// Regression batches (--batch manifest). Each manifest line is
+//   disc.iso [movie.txt|-] [frames]
+// and becomes one headless emulator process pinned to a core, at most
+// 'jobs' at a time. Instances are processes rather than in-process
+// contexts because fault handling and tracing are process-wide. Disc
+// images and the JIT cache are mapped read-only, so instances of the same
+// title share those pages. Each instance writes its report (see
+// WiiEmulator::writeReport) to a pipe, and the combined JSON report
+// lists every instance and the aggregate throughput.
+//
+// In zygote mode (--zygote N) the runner boots each title once in-process,
+// runs it N frames to a checkpoint and forks every instance of that title
+// from there instead of starting a new process, so instances skip startup
+// and share the checkpoint's guest RAM and JIT code copy-on-write.
+class BatchRunner {
 public:
-    Input() : buttonState(0) {}
+    BatchRunner() : defaultFrames(600), zygoteFrames(0), zygoteEnabled(false), assertNoAlloc(false) {}
 
-    void update() {
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                buttonState |= 0x80000000;  // Quit flag
-            } else if (event.type == SDL_KEYDOWN) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_UP:    buttonState |= 0x00000001; break;
-                    case SDLK_DOWN:  buttonState |= 0x00000002; break;
-                    case SDLK_LEFT:  buttonState |= 0x00000004; break;
-                    case SDLK_RIGHT: buttonState |= 0x00000008; break;
-                    case SDLK_a:     buttonState |= 0x00000010; break;
-                    case SDLK_b:     buttonState |= 0x00000020; break;
-                    case SDLK_SPACE: buttonState |= 0x00000040; break;
+    // Options passed to every instance, such as --interpreter
+    void addInstanceOption(const char* arg) { options.push_back(arg); }
+
+    // Fail instances whose steady-state frames allocate from the heap
+    void setAssertNoAlloc(bool enabled) { assertNoAlloc = enabled; }
+
+    // Fork instances from a checkpoint 'frames' frames into each title
+    void setZygote(uint32_t frames) {
+        zygoteEnabled = true;
+        zygoteFrames = frames;
+    }
+
+    bool load(const char* path) {
+        FILE* f = std::fopen(path, "r");
+        if (!f) {
+            SDL_Log("Failed to open batch manifest %s: %s", path, std::strerror(errno));
+            return false;
+        }
+        char line[1024];
+        while (std::fgets(line, sizeof(line), f)) {
+            char disc[512], movie[512];
+            unsigned frames = defaultFrames;
+            int fields = std::sscanf(line, "%511s %511s %u", disc, movie, &frames);
+            if (fields < 1 || disc[0] == '#') continue;
+            Instance instance = Instance();
+            instance.disc = disc;
+            instance.core = -1;
+            if (fields >= 2 && std::strcmp(movie, "-") != 0) instance.movie = movie;
+            instance.frames = frames;
+            instances.push_back(instance);
+        }
+        std::fclose(f);
+        return !instances.empty();
+    }
+
+    // Run every instance, 'jobs' at a time (0: one per available core).
+    // Instance output goes to '<logDir>/<n>.log' when logDir is set.
+    bool run(uint32_t jobs, const char* logDir, FILE* out) {
+        std::vector<int> cores = availableCores();
+        if (jobs == 0) jobs = uint32_t(cores.size());
+        std::vector<bool> slotBusy(jobs, false);
+        std::vector<size_t> active;
+        std::vector<size_t> order(instances.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        if (zygoteEnabled) {
+            // One zygote at a time, so run each title's instances together
+            std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+                return instances[a].disc < instances[b].disc;
+            });
+        }
+        size_t next = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        while (next < order.size() || !active.empty()) {
+            while (active.size() < jobs && next < order.size()) {
+                Instance& instance = instances[order[next]];
+                if (zygoteEnabled && (!zygote || zygoteDisc != instance.disc)) {
+                    if (!active.empty()) break;  // let the previous title finish
+                    if (!startZygote(instance.disc)) {
+                        instance.status = 1;
+                        next++;
+                        continue;
+                    }
                 }
-            } else if (event.type == SDL_KEYUP) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_UP:    buttonState &= ~0x00000001; break;
-                    case SDLK_DOWN:  buttonState &= ~0x00000002; break;
-                    case SDLK_LEFT:  buttonState &= ~0x00000004; break;
-                    case SDLK_RIGHT: buttonState &= ~0x00000008; break;
-                    case SDLK_a:     buttonState &= ~0x00000010; break;
-                    case SDLK_b:     buttonState &= ~0x00000020; break;
-                    case SDLK_SPACE: buttonState &= ~0x00000040; break;
+                uint32_t slot = 0;
+                while (slotBusy[slot]) slot++;
+                if (!spawn(order[next], slot, cores[slot % cores.size()], logDir)) return false;
+                slotBusy[slot] = true;
+                active.push_back(order[next++]);
+            }
+            if (active.empty()) continue;
+
+            std::vector<pollfd> fds;
+            for (size_t index : active) fds.push_back({ instances[index].reportFd, POLLIN, 0 });
+            if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+                SDL_Log("Batch poll failed: %s", std::strerror(errno));
+                return false;
+            }
+            for (size_t i = fds.size(); i-- > 0;) {
+                if (!fds[i].revents) continue;
+                Instance& instance = instances[active[i]];
+                char buffer[65536];
+                ssize_t n = ::read(instance.reportFd, buffer, sizeof(buffer));
+                if (n > 0) {
+                    instance.report.append(buffer, size_t(n));
+                    continue;
                 }
+                if (n < 0 && errno == EINTR) continue;
+                finish(instance);
+                slotBusy[instance.slot] = false;
+                active.erase(active.begin() + i);
             }
         }
-    }
-
-    uint32_t getButtonState() const {
-        return buttonState;
-    }
 
-    bool shouldQuit() const {
-        return (buttonState & 0x80000000) != 0;
+        stopZygote();
+        double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return writeReport(out, jobs, wallMs);
     }
 
 private:
-    uint32_t buttonState;
-};
+    static const int REPORT_FD = 3;  // instance side of the report pipe
 
-// Main emulator class
-class WiiEmulator {
-public:
-    WiiEmulator() : running(false) {}
+    struct Instance {
+        std::string disc;
+        std::string movie;
+        uint32_t frames;
+        pid_t pid;
+        int reportFd;
+        uint32_t slot;
+        int core;
+        int status;
+        double wallMs;
+        std::chrono::steady_clock::time_point start;
+        std::string report;
+    };
 
-    bool init() {
-        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
-            SDL_Log("SDL initialization failed: %s", SDL_GetError());
+    static std::vector<int> availableCores() {
+        std::vector<int> cores;
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &set)) cores.push_back(i);
+            }
+        }
+        if (cores.empty()) cores.push_back(0);
+        return cores;
+    }
+
+    bool spawn(size_t index, uint32_t slot, int core, const char* logDir) {
+        Instance& instance = instances[index];
+        std::string frames = std::to_string(instance.frames);
+        std::string reportFd = std::to_string(REPORT_FD);
+        std::string logPath = logDir ? std::string(logDir) + "/" + std::to_string(index) + ".log" : "/dev/null";
+        std::vector<const char*> args = { "flames", "--headless", frames.c_str(), "--report-fd", reportFd.c_str() };
+        if (!instance.movie.empty()) {
+            args.push_back("--movie");
+            args.push_back(instance.movie.c_str());
+        }
+        args.insert(args.end(), options.begin(), options.end());
+        if (assertNoAlloc) args.push_back("--assert-no-alloc");
+        args.push_back(instance.disc.c_str());
+        args.push_back(nullptr);
+
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            SDL_Log("Failed to create report pipe: %s", std::strerror(errno));
+            return false;
+        }
+        if (zygote) JobSystem::stop();  // a forked child would have no workers
+        instance.start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid < 0) {
+            SDL_Log("Failed to start instance %zu: %s", index, std::strerror(errno));
+            ::close(fds[0]);
+            ::close(fds[1]);
             return false;
         }
+        if (pid == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(core, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            int log = ::open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (log >= 0) {
+                dup2(log, STDOUT_FILENO);
+                dup2(log, STDERR_FILENO);
+            }
+            if (zygote) _exit(runForked(instance, fds[1]));
+            if (fds[1] == REPORT_FD) fcntl(REPORT_FD, F_SETFD, 0);
+            else dup2(fds[1], REPORT_FD);
+            execv("/proc/self/exe", const_cast<char* const*>(args.data()));
+            _exit(127);
+        }
+        ::close(fds[1]);
+        instance.pid = pid;
+        instance.reportFd = fds[0];
+        instance.slot = slot;
+        instance.core = core;
+        return true;
+    }
 
-        if (!video.init() || !audio.init()) {
+    // Boot 'disc' in this process and run it to the checkpoint. Guest RAM
+    // stays out of the fastmem arena: its shared mappings would make forked
+    // instances write to each other's memory instead of copying on write.
+    bool startZygote(const std::string& disc) {
+        stopZygote();  // fault handling is process-wide, so one at a time
+        zygoteDisc = disc;
+        zygote.reset(new WiiEmulator(false));
+        for (size_t i = 0; i < options.size();) {
+            int used = applyEmulatorOption(*zygote, options.data() + i, int(options.size() - i));
+            i += used ? size_t(used) : 1;
+        }
+        zygote->setHeadless(zygoteFrames);
+        if (!zygote->init() || !zygote->bootDisc(disc.c_str())) {
+            SDL_Log("Zygote for %s failed to boot", disc.c_str());
+            zygote.reset();
             return false;
         }
+        zygote->run();
+        return true;
+    }
 
-        // Connect components to memory
-        memory.connectVideo(&video);
-        memory.connectAudio(&audio);
-        memory.connectInput(&input);
+    void stopZygote() {
+        if (!zygote) return;
+        zygote->shutdown();
+        zygote.reset();
+    }
 
-        return true;
+    // Instance body in a child forked from the zygote. Returns the exit
+    // status; the child leaves with _exit so nothing the parent owns is
+    // flushed or destroyed twice.
+    int runForked(const Instance& instance, int reportFd) {
+        if (!instance.movie.empty() && !zygote->loadMovie(instance.movie.c_str())) return 1;
+        zygote->setHeadless(instance.frames);
+        zygote->run();
+        FILE* out = fdopen(reportFd, "w");
+        if (!out) return 1;
+        zygote->writeReport(out);
+        if (std::fclose(out) != 0) return 1;
+        return zygote->failsAllocationCheck(assertNoAlloc) ? 1 : 0;
     }
 
-    void shutdown() {
-        video.shutdown();
-        audio.shutdown();
-        SDL_Quit();
+    void finish(Instance& instance) {
+        ::close(instance.reportFd);
+        int status = 0;
+        while (waitpid(instance.pid, &status, 0) < 0 && errno == EINTR) {}
+        instance.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        instance.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - instance.start).count();
+        while (!instance.report.empty() && std::isspace(uint8_t(instance.report.back()))) instance.report.pop_back();
     }
 
-    void run() {
-        running = true;
-        
-        // Timing for 60 FPS
-        const auto frameTime = std::chrono::microseconds(16667);  // ~60 FPS
-        auto nextFrame = std::chrono::high_resolution_clock::now();
-        
-        // Demo variables
-        uint32_t colorCycle = 0;
-        int toneFreq = 440;
-        
-        while (running) {
-            auto frameStart = std::chrono::high_resolution_clock::now();
-            
-            // Update input
-            input.update();
-            if (input.shouldQuit()) {
-                running = false;
-                break;
-            }
-            
-            // Demo: Read input and update system
-            uint32_t buttons = memory.read32(REG_INPUT_STATE);
-            
-            // Change background color based on input
-            if (buttons & 0x00000001) colorCycle += 0x01000000;  // UP - increase red
-            if (buttons & 0x00000002) colorCycle -= 0x01000000;  // DOWN - decrease red
-            if (buttons & 0x00000004) colorCycle += 0x00010000;  // LEFT - increase green
-            if (buttons & 0x00000008) colorCycle -= 0x00010000;  // RIGHT - decrease green
-            
-            // Change audio tone with A/B buttons
-            if (buttons & 0x00000010) toneFreq = std::min(toneFreq + 10, 2000);  // A - higher
-            if (buttons & 0x00000020) toneFreq = std::max(toneFreq - 10, 100);   // B - lower
-            
-            // Space toggles audio on/off
-            static bool audioOn = false;
-            static bool spacePressed = false;
-            if ((buttons & 0x00000040) && !spacePressed) {
-                audioOn = !audioOn;
-                spacePressed = true;
-            } else if (!(buttons & 0x00000040)) {
-                spacePressed = false;
-            }
-            
-            // Write to memory-mapped registers
-            memory.write32(REG_VIDEO_BG_COLOR, colorCycle);
-            memory.write32(REG_AUDIO_FREQ, audioOn ? toneFreq : 0);
-            
-            // Test memory read/write
-            static bool memTestDone = false;
-            if (!memTestDone) {
-                // Write test pattern to MEM1
-                memory.write32(0x80000000, 0xDEADBEEF);
-                uint32_t testRead = memory.read32(0x80000000);
-                SDL_Log("Memory test - Written: 0xDEADBEEF, Read: 0x%08X", testRead);
-                memTestDone = true;
-            }
-            
-            // Render
-            video.render();
-            
-            // Frame timing for consistent 60 FPS
-            nextFrame += frameTime;
-            std::this_thread::sleep_until(nextFrame);
-            
-            // Log FPS occasionally
-            static int frameCount = 0;
-            static auto lastFpsLog = frameStart;
-            frameCount++;
-            if (frameCount >= 300) {  // Every 5 seconds at 60 FPS
-                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    frameStart - lastFpsLog).count();
-                double fps = (frameCount * 1000.0) / elapsed;
-                SDL_Log("FPS: %.2f", fps);
-                frameCount = 0;
-                lastFpsLog = frameStart;
-            }
+    bool writeReport(FILE* out, uint32_t jobs, double wallMs) const {
+        uint64_t frames = 0;
+        uint32_t failed = 0;
+        std::fprintf(out, "{\n  \"instances\": [\n");
+        for (size_t i = 0; i < instances.size(); i++) {
+            const Instance& instance = instances[i];
+            bool ok = instance.status == 0 && !instance.report.empty();
+            unsigned reported = 0;
+            const char* field = std::strstr(instance.report.c_str(), "\"frames\": ");
+            if (ok && field) std::sscanf(field, "\"frames\": %u", &reported);
+            frames += reported;
+            failed += !ok;
+            std::fprintf(out, "    {\"disc\": %s, \"movie\": %s, \"core\": %d, \"exit_status\": %d, \"wall_ms\": %.3f, "
+                              "\"result\": %s}%s\n",
+                         jsonQuote(instance.disc).c_str(), jsonQuote(instance.movie).c_str(), instance.core,
+                         instance.status, instance.wallMs, ok ? instance.report.c_str() : "null",
+                         i + 1 < instances.size() ? "," : "");
         }
+        std::fprintf(out, "  ],\n  \"aggregate\": {\"instances\": %zu, \"failed\": %u, \"jobs\": %u, \"frames\": %llu, "
+                          "\"wall_ms\": %.3f, \"frames_per_second\": %.1f}\n}\n",
+                     instances.size(), failed, jobs, (unsigned long long)frames, wallMs,
+                     wallMs > 0 ? frames * 1000.0 / wallMs : 0.0);
+        return failed == 0;
     }
 
-private:
-    Memory memory;
-    Video video;
-    Audio audio;
-    Input input;
-    bool running;
+    uint32_t defaultFrames;
+    uint32_t zygoteFrames;
+    bool zygoteEnabled;
+    bool assertNoAlloc;
+    std::unique_ptr<WiiEmulator> zygote;
+    std::string zygoteDisc;
+    std::vector<const char*> options;
+    std::vector<Instance> instances;
 };
 
 int main(int argc, char* argv[]) {
     WiiEmulator emulator;
+    const char* discPath = nullptr;
+    bool perfMap = false, jitdump = false;
+    uint64_t lockstepCycles = 0;
+    const char* profilePrefix = nullptr;
+    uint32_t profileRate = 1000;
+    uint32_t headlessFrames = 0, batchJobs = 0;
+    bool assertNoAlloc = false;
+    int reportFd = -1;
+    const char* movie = nullptr;
+    const char* movieOutput = nullptr;
+    const char* batchManifest = nullptr;
+    const char* batchReport = nullptr;
+    const char* batchLogs = nullptr;
+    const char* netplayAddresses = nullptr;
+    uint32_t netplayPlayer = 0, inputDelay = 2;
+    BatchRunner batch;
+    for (int i = 1; i < argc; i++) {
+        if (int used = applyEmulatorOption(emulator, argv + i, argc - i)) {
+            for (int k = 0; k < used; k++) batch.addInstanceOption(argv[i + k]);
+            i += used - 1;
+        } else if (std::strcmp(argv[i], "--perf-map") == 0) {
+            perfMap = true;
+        } else if (std::strcmp(argv[i], "--jitdump") == 0) {
+            jitdump = true;
+        } else if (std::strcmp(argv[i], "--make-signatures") == 0 && i + 1 < argc) {
+            emulator.setSignatureOutput(argv[++i]);
+        } else if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headlessFrames = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--movie") == 0 && i + 1 < argc) {
+            movie = argv[++i];
+        } else if (std::strcmp(argv[i], "--record-movie") == 0 && i + 1 < argc) {
+            movieOutput = argv[++i];
+        } else if (std::strcmp(argv[i], "--report-fd") == 0 && i + 1 < argc) {
+            reportFd = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchManifest = argv[++i];
+        } else if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            batchJobs = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--batch-report") == 0 && i + 1 < argc) {
+            batchReport = argv[++i];
+        } else if (std::strcmp(argv[i], "--batch-logs") == 0 && i + 1 < argc) {
+            batchLogs = argv[++i];
+        } else if (std::strcmp(argv[i], "--zygote") == 0 && i + 1 < argc) {
+            batch.setZygote(uint32_t(std::strtoul(argv[++i], nullptr, 10)));
+        } else if (std::strcmp(argv[i], "--netplay") == 0 && i + 2 < argc) {
+            netplayPlayer = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+            netplayAddresses = argv[++i];
+        } else if (std::strcmp(argv[i], "--input-delay") == 0 && i + 1 < argc) {
+            inputDelay = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profilePrefix = argv[++i];
+        } else if (std::strcmp(argv[i], "--profile-rate") == 0 && i + 1 < argc) {
+            profileRate = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--assert-no-alloc") == 0) {
+            assertNoAlloc = true;
+            batch.setAssertNoAlloc(true);
+        } else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            JobSystem::setWorkerCount(uint32_t(std::strtoul(argv[++i], nullptr, 10)));
+        } else if (std::strcmp(argv[i], "--pin") == 0 && i + 1 < argc) {
+            if (!ThreadRoles::parseAffinity(argv[++i])) return 1;
+        } else if (std::strcmp(argv[i], "--priority") == 0 && i + 1 < argc) {
+            if (!ThreadRoles::parsePriority(argv[++i])) return 1;
+        } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            Tracer::enable(argv[++i]);
+        } else if (std::strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) {
+            lockstepCycles = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--bench") == 0) {
+            Benchmarks benchmarks;
+            return benchmarks.run(stdout) ? 0 : 1;
+        } else if (std::strcmp(argv[i], "--self-check") == 0) {
+            SelfChecks selfChecks;
+            return selfChecks.run(stdout) ? 0 : 1;
+        } else {
+            discPath = argv[i];
+        }
+    }
+    if (lockstepCycles) {
+        if (!discPath) {
+            SDL_Log("--lockstep needs a disc image");
+            return 1;
+        }
+#if FLAMES_JIT
+        Lockstep lockstep;
+        return lockstep.run(discPath, lockstepCycles, stdout) ? 0 : 1;
+#else
+        SDL_Log("--lockstep needs the recompiler, which this build does not have");
+        return 1;
+#endif
+    }
+
+    if (batchManifest) {
+        if (!batch.load(batchManifest)) return 1;
+        FILE* out = batchReport ? std::fopen(batchReport, "w") : stdout;
+        if (!out) {
+            SDL_Log("Failed to write batch report %s: %s", batchReport, std::strerror(errno));
+            return 1;
+        }
+        bool ok = batch.run(batchJobs, batchLogs, out);
+        if (out != stdout) std::fclose(out);
+        return ok ? 0 : 1;
+    }
+
+    emulator.setPerfOutput(perfMap, jitdump);
+    if (profilePrefix) emulator.setProfiler(profilePrefix, profileRate);
+    if (headlessFrames) emulator.setHeadless(headlessFrames);
+    if (movie && !emulator.loadMovie(movie)) return 1;
+    if (movieOutput && !emulator.recordMovie(movieOutput)) return 1;
+    if (netplayAddresses && !emulator.setNetplay(netplayPlayer, netplayAddresses, inputDelay)) return 1;
     
     if (!emulator.init()) {
         SDL_Log("Failed to initialize emulator");
         return 1;
     }
+
+    if (discPath && !emulator.bootDisc(discPath)) {
+        emulator.shutdown();
+        return 1;
+    }
+
+    if (headlessFrames) {
+        emulator.run();
+        FILE* out = reportFd >= 0 ? fdopen(reportFd, "w") : stdout;
+        if (out) {
+            emulator.writeReport(out);
+            if (out != stdout) std::fclose(out);
+        }
+        emulator.shutdown();
+        return out && !emulator.failsAllocationCheck(assertNoAlloc) && !emulator.failsNetplay() ? 0 : 1;
+    }
     
     SDL_Log("Wii Memory Emulator started - 60 FPS");
     SDL_Log("Controls:");
@@ -442,5 +8436,5 @@ int main(int argc, char* argv[]) {
     emulator.run();
     emulator.shutdown();
     
-    return 0;
+    return emulator.failsAllocationCheck(assertNoAlloc) || emulator.failsNetplay() ? 1 : 0;
 }
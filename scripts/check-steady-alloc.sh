@@ -0,0 +1,55 @@
+#!/bin/sh
+# Steady-state heap check: run a title headless well past the emulator's
+# 60 warm-up frames, once recompiled and once interpreted, and fail if
+# any frame after warm-up allocated from the general heap. The frame
+# arena and fixed pool that keep it off the heap are checked first
+# (--self-check).
+#
+# usage: scripts/check-steady-alloc.sh EMULATOR [DISC] [FRAMES]
+#
+# Without DISC the built-in demo runs. Build EMULATOR with
+# -DFLAMES_ALLOC_CHECK=1 to also catch allocations on the audio and
+# worker threads.
+
+set -u
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 EMULATOR [DISC] [FRAMES]" >&2
+    exit 2
+fi
+emulator=$1
+disc=${2-}
+frames=${3-180}
+
+if [ "$frames" -le 60 ]; then
+    echo "FRAMES must be past the 60 warm-up frames" >&2
+    exit 2
+fi
+
+status=0
+if "$emulator" --self-check; then
+    echo "ok   self-check"
+else
+    echo "FAIL self-check"
+    status=1
+fi
+for mode in jit interpreter; do
+    if [ "$mode" = interpreter ]; then
+        set -- --interpreter
+    else
+        set --
+    fi
+    report=$("$emulator" --headless "$frames" --assert-no-alloc "$@" ${disc:+"$disc"} 2>/dev/null)
+    result=$?
+    count=$(printf '%s\n' "$report" | sed -n 's/.*"steady_heap_allocations": *\([0-9]*\).*/\1/p')
+    if [ -z "$count" ]; then
+        echo "FAIL $mode: no steady_heap_allocations in the report (exit $result)"
+        status=1
+    elif [ "$count" -ne 0 ] || [ "$result" -ne 0 ]; then
+        echo "FAIL $mode: $count heap allocations after warm-up (exit $result)"
+        status=1
+    else
+        echo "ok   $mode: no heap allocations in $((frames - 60)) steady-state frames"
+    fi
+done
+exit $status